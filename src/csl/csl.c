@@ -5,9 +5,8 @@
 #include <ctype.h>
 
 #include "csl/csl.h"
-
-#include "xstring/xstring.h"
-#include "xvector/xvector.h"
+#include "ll/ll.h"
+#include "mem/mem.h"
 
 typedef struct srcnode_t srcnode_t;
 
@@ -28,7 +27,7 @@ struct csl_src_t {
 struct srcnode_t {
    int type;
    union {
-      xvector_t *children;
+      void **children;
       char *token;
    } data;
    char    *fname;
@@ -43,17 +42,17 @@ void srcnode_del (srcnode_t *sn)
       return;
 
    printf ("[%p] Entering \n", sn);
-   free (sn->fname);
+   mem_free (sn->fname);
    if (sn->type==TYPE_LIST) {
       printf ("[%p] Iterating \n", sn);
-      xvector_iterate (sn->data.children, (void (*) (void *))srcnode_del);
-      xvector_free (sn->data.children);
+      ll_iterate (sn->data.children, (void (*) (void *))srcnode_del);
+      ll_del (sn->data.children);
    } else {
-      free (sn->data.token);
+      mem_free (sn->data.token);
    }
 
    printf ("[%p] Leaving \n", sn);
-   free (sn);
+   mem_free (sn);
 }
 
 srcnode_t *srcnode_new (csl_src_t *csl, srcnode_t *parent, int type, void *d)
@@ -61,19 +60,19 @@ srcnode_t *srcnode_new (csl_src_t *csl, srcnode_t *parent, int type, void *d)
    bool error = true;
    srcnode_t *ret = NULL;
 
-   if (!(ret = calloc (1, sizeof *ret)))
+   if (!(ret = mem_calloc (1, sizeof *ret)))
       goto errorexit;
 
-   ret->fname = xstr_dup (csl->fname);
+   ret->fname = mem_strdup (csl->fname);
    ret->line = csl->line;
    ret->charpos = csl->charpos;
    ret->parent = parent;
    ret->type = type;
 
    if (type==TYPE_LIST) {
-      ret->data.children = (xvector_t *)d;
+      ret->data.children = (void **)d;
    } else {
-      ret->data.token = xstr_dup ((char *)d);
+      ret->data.token = mem_strdup ((char *)d);
       if (!ret->data.token)
          goto errorexit;
    }
@@ -142,7 +141,7 @@ static char *get_next_token (csl_src_t *csl, FILE *inf)
    // process them first (there may be no spaces between them and the next
    // token).
    if (is_single_char_token (temps[0]))
-      return xstr_dup (temps);
+      return mem_strdup (temps);
 
    // Read token
    size_t i=1;
@@ -155,14 +154,14 @@ static char *get_next_token (csl_src_t *csl, FILE *inf)
    if (c!=EOF)
       push_back_char (csl, c);
 
-   return xstr_dup (temps);
+   return mem_strdup (temps);
 }
 
 static bool make_srcnode (csl_src_t *csl, FILE *inf, srcnode_t *parent);
 
 static void read_list (csl_src_t *csl, FILE *inf, srcnode_t *parent)
 {
-   parent->data.children = xvector_new ();
+   parent->data.children = ll_new ();
 
    while (1) {
       if (!make_srcnode (csl, inf, parent))
@@ -177,19 +176,19 @@ static bool make_srcnode (csl_src_t *csl, FILE *inf, srcnode_t *parent)
 
    str = get_next_token (csl, inf);
    if (!str || *str==')') {
-      free (str);
+      mem_free (str);
       return false;
    }
 
    if (*str == '(') {
-      srcnode_t *child = srcnode_new (csl, parent, TYPE_LIST, xvector_new ());
+      srcnode_t *child = srcnode_new (csl, parent, TYPE_LIST, ll_new ());
       read_list (csl, inf, child);
-      xvector_ins_tail (parent->data.children, child);
+      ll_ins_tail (&parent->data.children, child);
    } else {
       srcnode_new (csl, parent, TYPE_STRING, str);
    }
 
-   free (str);
+   mem_free (str);
 
    return true;
 }
@@ -199,10 +198,10 @@ csl_src_t *csl_src_load (const char *fname)
    bool error = true;
    csl_src_t *ret = NULL;
 
-   if (!(ret = calloc (1, sizeof *ret)))
+   if (!(ret = mem_calloc (1, sizeof *ret)))
       goto errorexit;
 
-   ret->fname = xstr_dup (fname);
+   ret->fname = mem_strdup (fname);
    ret->line = 1;
    ret->charpos = 1;
    ret->inf = fopen (fname, "rt");
@@ -210,7 +209,7 @@ csl_src_t *csl_src_load (const char *fname)
    if (!ret->fname || !ret->inf)
       goto errorexit;
 
-   ret->root = srcnode_new (ret, NULL, TYPE_LIST, xvector_new ());
+   ret->root = srcnode_new (ret, NULL, TYPE_LIST, ll_new ());
 
    while (!feof (ret->inf) && !ferror (ret->inf)) {
       make_srcnode (ret, ret->inf, ret->root);
@@ -233,12 +232,12 @@ void csl_src_del (csl_src_t *csl)
    if (!csl)
       return;
 
-   free (csl->fname);
+   mem_free (csl->fname);
    if (csl->inf)
       fclose (csl->inf);
 
    srcnode_del (csl->root);
 
-   free (csl);
+   mem_free (csl);
 }
 
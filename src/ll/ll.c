@@ -3,11 +3,63 @@
 #include <string.h>
 
 #include "ll/ll.h"
+#include "mem/mem.h"
 
 
+// Every list is preceded by a hidden header, so that the length is known
+// without walking the list. The pointer handed out still points at a
+// NULL-terminated array of elements.
+typedef struct ll_header_t ll_header_t;
+struct ll_header_t {
+   size_t length;
+   size_t capacity;     // Not counting the terminating NULL
+};
+
+#define LL_HEADER(ll)      (((ll_header_t *)(ll)) - 1)
+#define LL_MINCAPACITY     (3)
+
+static void **ll_alloc (size_t capacity)
+{
+   ll_header_t *header = mem_malloc (sizeof *header +
+                                 sizeof (void *) * (capacity + 1));
+   if (!header)
+      return NULL;
+
+   header->length = 0;
+   header->capacity = capacity;
+
+   void **ret = (void **)(header + 1);
+   ret[0] = NULL;
+
+   return ret;
+}
+
+// Makes room for at least nitems elements, growing geometrically.
+static bool ll_reserve (void ***ll, size_t nitems)
+{
+   ll_header_t *header = LL_HEADER (*ll);
+
+   if (nitems <= header->capacity)
+      return true;
+
+   size_t capacity = header->capacity * 2;
+   if (capacity < nitems)
+      capacity = nitems;
+
+   header = mem_realloc (header, sizeof *header +
+                             sizeof (void *) * (capacity + 1));
+   if (!header)
+      return false;
+
+   header->capacity = capacity;
+   (*ll) = (void **)(header + 1);
+
+   return true;
+}
+
 void **ll_new (void)
 {
-   return calloc (2, sizeof (void **));
+   return ll_alloc (LL_MINCAPACITY);
 }
 
 void ll_del (void **ll)
@@ -15,62 +67,54 @@ void ll_del (void **ll)
    if (!ll)
       return;
 
-   free (ll);
+   mem_free (LL_HEADER (ll));
 }
 
 void **ll_copy (void **src, size_t from_index, size_t to_index)
 {
-   size_t nitems;
-   void **ret = ll_new ();
-   bool error = true;
-
    if (!src)
       return NULL;
 
-   nitems = ll_length (src);
+   size_t nitems = ll_length (src);
 
-   for (size_t i=from_index; i>=from_index && i<to_index && i<nitems; i++) {
-      if (!(ll_ins_tail (&ret, src[i])))
-         goto errorexit;
-   }
+   if (to_index > nitems)
+      to_index = nitems;
+   if (from_index > to_index)
+      from_index = to_index;
 
-   error = false;
+   nitems = to_index - from_index;
 
-errorexit:
+   void **ret = ll_alloc (nitems > LL_MINCAPACITY ? nitems : LL_MINCAPACITY);
+   if (!ret)
+      return NULL;
 
-   if (error) {
-      ll_del (ret);
-      ret = NULL;
-   }
+   memcpy (ret, &src[from_index], sizeof *ret * nitems);
+   ret[nitems] = NULL;
+   LL_HEADER (ret)->length = nitems;
 
    return ret;
 }
 
 
 size_t ll_length (void **ll)
+{
+   return ll ? LL_HEADER (ll)->length : 0;
+}
+
+size_t ll_nbytes (void **ll)
 {
    if (!ll)
       return 0;
 
-   size_t ret = 0;
-   for (ret=0; ll[ret]; ret++)
-      ;
-
-   return ret;
+   return sizeof (ll_header_t) + sizeof (void *) * (LL_HEADER (ll)->capacity + 1);
 }
 
 void *ll_index (void **ll, size_t i)
 {
-   if (!ll)
+   if (!ll || i >= LL_HEADER (ll)->length)
       return NULL;
 
-   for (size_t count = 0; ll[count]; count++) {
-      if (count==i) {
-         return ll[i];
-      }
-   }
-
-   return NULL;
+   return ll[i];
 }
 
 void ll_iterate (void **ll, void (*fptr) (void *))
@@ -86,63 +130,49 @@ void ll_iterate (void **ll, void (*fptr) (void *))
 
 void *ll_ins_tail (void ***ll, void *el)
 {
-   size_t nitems = 0;
-
    if (!ll || !(*ll) || !el)
       return NULL;
 
-   nitems = ll_length (*ll);
-   size_t newsize = nitems + 2;
+   size_t nitems = LL_HEADER (*ll)->length;
 
-   void **tmp = realloc ((*ll), newsize * sizeof (void *));
-   if (!tmp)
+   if (!ll_reserve (ll, nitems + 1))
       return NULL;
 
-   (*ll) = tmp;
-
    (*ll)[nitems] = el;
-   (*ll)[nitems + 1] = 0;
+   (*ll)[nitems + 1] = NULL;
+   LL_HEADER (*ll)->length++;
 
-   return (*ll)[nitems];
+   return el;
 }
 
 void *ll_ins_head (void ***ll, void *el)
 {
-   size_t nitems = 0;
-
    if (!ll || !(*ll) || !el)
       return NULL;
 
-   nitems = ll_length (*ll);
-   size_t newsize = nitems + 2;
+   size_t nitems = LL_HEADER (*ll)->length;
 
-   void **tmp = realloc ((*ll), newsize * sizeof (void *));
-   if (!tmp)
+   if (!ll_reserve (ll, nitems + 1))
       return NULL;
 
-   (*ll) = tmp;
-
-   memmove (&(*ll)[1], &(*ll)[0], nitems + 1);
+   // Moves the terminating NULL as well
+   memmove (&(*ll)[1], &(*ll)[0], sizeof (void *) * (nitems + 1));
    (*ll)[0] = el;
+   LL_HEADER (*ll)->length++;
 
-   return (*ll)[nitems];
+   return el;
 }
 
 void *ll_remove_tail (void ***ll)
 {
-   if(!ll || !(*ll) || !(*ll)[0])
+   if (!ll || !(*ll) || !LL_HEADER (*ll)->length)
       return NULL;
 
-   for (size_t i=1; (*ll)[i-1]; i++) {
-      if ((*ll)[i]==0) {
-         void *ret = (*ll)[i-1];
-         (*ll)[i-1] = 0;
-         return ret;
-      }
-   }
-
-   return NULL;
+   size_t last = --LL_HEADER (*ll)->length;
+   void *ret = (*ll)[last];
+   (*ll)[last] = NULL;
 
+   return ret;
 }
 
 void *ll_remove_head (void ***ll)
@@ -156,14 +186,16 @@ void *ll_remove (void ***ll, size_t index)
    if (!ll || !*ll)
       return NULL;
 
-   size_t len = ll_length (*ll);
-   if (index > len)
+   size_t len = LL_HEADER (*ll)->length;
+   if (index >= len)
       return NULL;
 
    void *ret = (*ll)[index];
 
+   // Moves the terminating NULL as well
    memmove (&(*ll)[index], &(*ll)[index + 1],
             (sizeof (void *)) * (len - index));
+   LL_HEADER (*ll)->length--;
 
    return ret;
 }
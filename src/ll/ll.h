@@ -11,6 +11,8 @@ extern "C" {
    void **ll_copy (void **src, size_t from_index, size_t to_index);
 
    size_t ll_length (void **ll);
+   // Bytes allocated for the list, including room it has not used yet
+   size_t ll_nbytes (void **ll);
    void *ll_index (void **ll, size_t i);
    void ll_iterate (void **ll, void (*fptr) (void *));
 
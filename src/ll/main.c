@@ -1,12 +1,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include "ll/ll.h"
 
 #include "xerror/xerror.h"
 #include "xstring/xstring.h"
 
+#define LARGE_NITEMS    (100000)
+
 static void printstr (void *string)
 {
    printf (" Printing [%s]\n", (char *)string);
@@ -70,6 +73,39 @@ int main (void)
 
    ll_iterate (ll, printstr);
 
+   // Large lists must keep their order through head inserts and removals.
+   // Even values go to the head and odd values to the tail, giving
+   // N-2 ... 2 0 1 3 ... N-1.
+   static size_t values[LARGE_NITEMS];
+   void **large = ll_new ();
+   bool ordered = large != NULL;
+   for (size_t i=0; ordered && i<LARGE_NITEMS; i++) {
+      values[i] = i;
+      ordered = i & 1 ? ll_ins_tail (&large, &values[i]) != NULL
+                      : ll_ins_head (&large, &values[i]) != NULL;
+   }
+   ordered = ordered && ll_length (large)==LARGE_NITEMS;
+   for (size_t i=0; ordered && i<LARGE_NITEMS; i++) {
+      size_t expected = i < LARGE_NITEMS / 2 ?
+                        LARGE_NITEMS - 2 - 2 * i :
+                        2 * (i - LARGE_NITEMS / 2) + 1;
+      ordered = *(size_t *)ll_index (large, i) == expected;
+   }
+   ordered = ordered &&
+             ll_remove (&large, LARGE_NITEMS / 2) == &values[1] &&
+             *(size_t *)ll_index (large, LARGE_NITEMS / 2) == 3 &&
+             ll_remove_tail (&large) == &values[LARGE_NITEMS - 1] &&
+             ll_remove_head (&large) == &values[LARGE_NITEMS - 2] &&
+             ll_length (large)==LARGE_NITEMS - 3 &&
+             !large[LARGE_NITEMS - 3];
+   ll_del (large);
+
+   printf ("Large list %s\n", ordered ? "in order" : "OUT OF ORDER");
+   if (!ordered) {
+      XERROR ("Large list lost its order\n");
+      goto errorexit;
+   }
+
    ret = EXIT_SUCCESS;
 
 errorexit:
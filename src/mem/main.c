@@ -0,0 +1,155 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mem/mem.h"
+#include "parser/parser.h"
+
+#include "xerror/xerror.h"
+
+#define TESTFILE     ("token/test_input.csl")
+#define MAGIC        ((size_t)0x6d656d6d)
+
+// A host allocator that tags its blocks, so that anything freed through
+// it that it did not allocate is noticed.
+typedef struct host_t host_t;
+struct host_t {
+   size_t nallocs;
+   size_t nfrees;
+   size_t nforeign;
+};
+
+typedef struct host_block_t host_block_t;
+struct host_block_t {
+   size_t magic;
+   size_t size;
+};
+
+static void *host_malloc (void *ctx, size_t size)
+{
+   host_block_t *ret = malloc (sizeof *ret + size);
+   if (!ret)
+      return NULL;
+
+   ret->magic = MAGIC;
+   ret->size = size;
+   ((host_t *)ctx)->nallocs++;
+
+   return &ret[1];
+}
+
+static void host_free (void *ctx, void *ptr)
+{
+   host_t *host = ctx;
+
+   if (!ptr)
+      return;
+
+   host_block_t *block = &((host_block_t *)ptr)[-1];
+   if (block->magic != MAGIC) {
+      host->nforeign++;
+      return;
+   }
+
+   block->magic = 0;
+   host->nfrees++;
+   free (block);
+}
+
+static void *host_realloc (void *ctx, void *ptr, size_t size)
+{
+   void *ret = host_malloc (ctx, size);
+   if (!ret || !ptr)
+      return ret;
+
+   host_block_t *block = &((host_block_t *)ptr)[-1];
+   memcpy (ret, ptr, block->size < size ? block->size : size);
+   host_free (ctx, ptr);
+
+   return ret;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   host_t host = { 0, 0, 0 };
+   mem_allocator_t allocator = {
+      host_malloc, host_realloc, host_free, NULL, &host,
+   };
+
+   token_t **tokens = NULL;
+   pool_t *pool = NULL;
+   atom_t *list = NULL;
+
+   mem_allocator_t incomplete = allocator;
+   incomplete.free_fptr = NULL;
+   if (mem_set_allocator (&incomplete) || mem_hooked ()) {
+      XERROR ("Allocator without a free hook was accepted\n");
+      goto errorexit;
+   }
+
+   if (!mem_set_allocator (&allocator)) {
+      XERROR ("Allocator was refused\n");
+      goto errorexit;
+   }
+
+   // Tokens, atoms, pool slabs and large buffers all come from the host
+   if (!(tokens = token_read_file (TESTFILE))) {
+      XERROR ("Unable to read tokens from [%s]\n", TESTFILE);
+      goto errorexit;
+   }
+
+   pool = pool_new ();
+   atom_set_pool (pool);
+
+   if (!pool || !(list = atom_list_new ())) {
+      XERROR ("Unable to create pool or list\n");
+      goto errorexit;
+   }
+
+   size_t index = 0;
+   while (tokens[index]) {
+      atom_t *atom = parser_parse (tokens, &index);
+      if (!atom || !atom_list_ins_tail (list, atom)) {
+         XERROR ("Failed to parse or store atom %zu\n", index);
+         atom_del (atom);
+         goto errorexit;
+      }
+   }
+
+   atom_list_ins_tail (list, atom_buffer_new (NULL, 100));
+   atom_list_ins_tail (list, atom_buffer_new (NULL, POOL_BLOCK_MAX * 2));
+
+   printf ("Parsed %zu atoms\n", atom_list_length (list));
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+
+   atom_del (list);
+   atom_set_pool (NULL);
+   pool_del (pool);
+   token_array_del (tokens);
+
+   // Interned symbol names and source file names are kept for good
+   mem_set_allocator (NULL);
+
+   printf ("Host allocator: %s, %s, %zu foreign frees\n",
+            host.nallocs ? "used" : "not used",
+            host.nfrees ? "freed to" : "not freed to",
+            host.nforeign);
+
+   if (!host.nallocs || !host.nfrees || host.nforeign) {
+      XERROR ("Host allocator saw %zu allocations, %zu frees, %zu foreign\n",
+               host.nallocs, host.nfrees, host.nforeign);
+      ret = EXIT_FAILURE;
+   }
+
+   xerror_set_logfile (NULL);
+
+   return ret;
+}
+
@@ -0,0 +1,148 @@
+
+#ifndef PLATFORM_WINDOWS
+#define _POSIX_C_SOURCE    200112L
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef PLATFORM_WINDOWS
+#include <malloc.h>
+#endif
+
+#include "mem/mem.h"
+
+// All hooks NULL when the C library's allocator is in use
+static mem_allocator_t g_allocator;
+
+bool mem_set_allocator (const mem_allocator_t *allocator)
+{
+   if (!allocator) {
+      memset (&g_allocator, 0, sizeof g_allocator);
+      return true;
+   }
+
+   if (!allocator->malloc_fptr || !allocator->realloc_fptr ||
+       !allocator->free_fptr)
+      return false;
+
+   g_allocator = *allocator;
+
+   return true;
+}
+
+bool mem_hooked (void)
+{
+   return g_allocator.malloc_fptr != NULL;
+}
+
+void *mem_malloc (size_t size)
+{
+   if (!g_allocator.malloc_fptr)
+      return malloc (size);
+
+   return g_allocator.malloc_fptr (g_allocator.ctx, size);
+}
+
+void *mem_calloc (size_t nmemb, size_t size)
+{
+   if (!g_allocator.malloc_fptr)
+      return calloc (nmemb, size);
+
+   if (size && nmemb > SIZE_MAX / size)
+      return NULL;
+
+   void *ret = g_allocator.malloc_fptr (g_allocator.ctx, nmemb * size);
+   if (ret)
+      memset (ret, 0, nmemb * size);
+
+   return ret;
+}
+
+void *mem_realloc (void *ptr, size_t size)
+{
+   if (!g_allocator.realloc_fptr)
+      return realloc (ptr, size);
+
+   return g_allocator.realloc_fptr (g_allocator.ctx, ptr, size);
+}
+
+void mem_free (void *ptr)
+{
+   if (!ptr)
+      return;
+
+   if (!g_allocator.free_fptr) {
+      free (ptr);
+      return;
+   }
+
+   g_allocator.free_fptr (g_allocator.ctx, ptr);
+}
+
+char *mem_strdup (const char *str)
+{
+   if (!str)
+      return NULL;
+
+   size_t len = strlen (str) + 1;
+   char *ret = mem_malloc (len);
+   if (ret)
+      memcpy (ret, str, len);
+
+   return ret;
+}
+
+// Without a memalign hook, the block from malloc_fptr is over-allocated
+// and the pointer to it is stored just below the aligned address.
+void *mem_memalign (size_t alignment, size_t size)
+{
+   if (!g_allocator.malloc_fptr) {
+#ifdef PLATFORM_WINDOWS
+      return _aligned_malloc (size, alignment);
+#else
+      void *ret = NULL;
+      return posix_memalign (&ret, alignment, size) ? NULL : ret;
+#endif
+   }
+
+   if (g_allocator.memalign_fptr)
+      return g_allocator.memalign_fptr (g_allocator.ctx, alignment, size);
+
+   if (size > SIZE_MAX - alignment - sizeof (void *))
+      return NULL;
+
+   void *block = g_allocator.malloc_fptr (g_allocator.ctx,
+                                          size + alignment + sizeof (void *));
+   if (!block)
+      return NULL;
+
+   uintptr_t addr = (uintptr_t)block + sizeof (void *);
+   addr = (addr + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+   ((void **)addr)[-1] = block;
+
+   return (void *)addr;
+}
+
+void mem_aligned_free (void *ptr)
+{
+   if (!ptr)
+      return;
+
+   if (!g_allocator.free_fptr) {
+#ifdef PLATFORM_WINDOWS
+      _aligned_free (ptr);
+#else
+      free (ptr);
+#endif
+      return;
+   }
+
+   if (!g_allocator.memalign_fptr)
+      ptr = ((void **)ptr)[-1];
+
+   g_allocator.free_fptr (g_allocator.ctx, ptr);
+}
+
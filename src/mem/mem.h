@@ -0,0 +1,50 @@
+
+#ifndef H_MEM
+#define H_MEM
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Every allocation made by the library goes through these functions, so
+// that an embedding host can route them to its own allocator. The ctx
+// pointer is handed back to each hook untouched. memalign_fptr may be
+// NULL, in which case aligned requests are carved out of a larger block
+// from malloc_fptr.
+//
+// The allocator must be set before the library allocates anything, and
+// must not be changed while any memory allocated through it is still in
+// use: blocks are always freed with the allocator that is current.
+typedef struct mem_allocator_t mem_allocator_t;
+struct mem_allocator_t {
+   void *(*malloc_fptr) (void *ctx, size_t size);
+   void *(*realloc_fptr) (void *ctx, void *ptr, size_t size);
+   void  (*free_fptr) (void *ctx, void *ptr);
+   void *(*memalign_fptr) (void *ctx, size_t alignment, size_t size);
+   void *ctx;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Passing NULL restores the C library's allocator. Returns false, and
+   // leaves the allocator alone, if any of the required hooks is NULL.
+   bool mem_set_allocator (const mem_allocator_t *allocator);
+   bool mem_hooked (void);
+
+   void *mem_malloc (size_t size);
+   void *mem_calloc (size_t nmemb, size_t size);
+   void *mem_realloc (void *ptr, size_t size);
+   void mem_free (void *ptr);
+   char *mem_strdup (const char *str);
+
+   // alignment must be a power of two. Free with mem_aligned_free().
+   void *mem_memalign (size_t alignment, size_t size);
+   void mem_aligned_free (void *ptr);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -1,100 +1,1472 @@
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <inttypes.h>
 
+#ifndef PLATFORM_WINDOWS
+#include <pthread.h>
+#endif
+
 #include "parser/atom.h"
 
-#include "ll/ll.h"
-#include "xerror/xerror.h"
-#include "xstring/xstring.h"
+#include "ll/ll.h"
+#include "mem/mem.h"
+#include "xerror/xerror.h"
+
+// Runtimes may evaluate on several threads at once, each with its own
+// pool and arena, so the allocation state in use is kept per thread.
+// The tables shared by all of them (interned names, source positions
+// and census origins) each have a lock.
+#define THREAD_LOCAL       __thread
+
+#ifndef PLATFORM_WINDOWS
+#define TABLE_LOCK(lock)   pthread_mutex_lock (&lock)
+#define TABLE_UNLOCK(lock) pthread_mutex_unlock (&lock)
+#else
+#define TABLE_LOCK(lock)
+#define TABLE_UNLOCK(lock)
+#endif
+
+typedef atom_t *(atom_newfunc_t) (atom_t *dst, const char *);
+typedef void (atom_delfunc_t) (atom_t *);
+typedef void (atom_prnfunc_t) (const atom_t *, size_t, FILE *);
+typedef atom_t *(atom_dupfunc_t) (atom_t *dst, const atom_t *);
+typedef int (atom_cmpfunc_t) (const atom_t *lhs, const atom_t *rhs);
+
+// Small integers and nil are preallocated; results of arithmetic and
+// comparisons in this range never allocate.
+#define SMALLINT_MIN          (-16)
+#define SMALLINT_MAX          (255)
+
+#define SMALLINT(i)     { .type = atom_INT, .ival = (i), \
+                          .storage = ATOM_STORAGE_STATIC }
+#define SMALLINT4(i)    SMALLINT (i), SMALLINT ((i) + 1), \
+                        SMALLINT ((i) + 2), SMALLINT ((i) + 3)
+#define SMALLINT16(i)   SMALLINT4 (i), SMALLINT4 ((i) + 4), \
+                        SMALLINT4 ((i) + 8), SMALLINT4 ((i) + 12)
+
+// Both are initialised here, as they are shared by every thread
+static atom_t g_nil = { .type = atom_NIL, .storage = ATOM_STORAGE_STATIC };
+static atom_t g_smallints[SMALLINT_MAX - SMALLINT_MIN + 1] = {
+   SMALLINT16 (-16), SMALLINT16 (0),   SMALLINT16 (16),  SMALLINT16 (32),
+   SMALLINT16 (48),  SMALLINT16 (64),  SMALLINT16 (80),  SMALLINT16 (96),
+   SMALLINT16 (112), SMALLINT16 (128), SMALLINT16 (144), SMALLINT16 (160),
+   SMALLINT16 (176), SMALLINT16 (192), SMALLINT16 (208), SMALLINT16 (224),
+   SMALLINT16 (240),
+};
+
+// List payloads are reference counted and shared between atoms, so
+// that duplicating a list is O(1). A shared payload is copied the first
+// time one of the atoms sharing it is modified.
+//
+// Most lists are tiny (symbol table pairs, stack entries, argument
+// lists), so the first few items are kept in the payload itself. Only a
+// list that grows past LIST_NINLINE items moves them to an ll vector.
+#define LIST_NINLINE       (4)
+
+// A list that grows past LIST_NINLINE items that are all INT or all
+// FLOAT keeps their values in one contiguous array instead, so that a
+// copy of it (as made by list_unshare()) is one allocation rather than
+// one per item. Next to each value is its item: the atom that was
+// inserted or, in a copy, NULL until someone asks for it and it is built
+// from the value. Items are never moved or freed while they are in the
+// list. Inserting an item of any other type moves them back to an ll
+// vector.
+#define LIST_NNUMS_MIN     (LIST_NINLINE * 2)
+
+typedef union list_num_t list_num_t;
+union list_num_t {
+   int64_t ival;
+   double  fval;
+};
+
+// A long list of entries keyed by a symbol (lists whose first item is a
+// symbol), such as a symbol table, is given an index from the ID of each
+// key to the position of the first entry with that key when it is first
+// searched. The entries added at the tail since are indexed by the next
+// search; any other change to the list drops the index.
+#define LIST_KEYS_MIN      (16)
+
+typedef struct list_key_t list_key_t;
+struct list_key_t {
+   uint32_t id;         // ATOM_SYMBOL_NOID for an empty slot
+   uint32_t index;
+};
+
+typedef struct list_keys_t list_keys_t;
+struct list_keys_t {
+   size_t     nbytes;
+   size_t     mask;     // Slots are kept at most half full
+   size_t     length;   // Of the list when last brought up to date
+   size_t     nother;   // Entries that are not keyed by a symbol
+   list_key_t slots[];
+};
+
+//
+// A view (the result of a slice or a concatenation) owns no items at
+// all: it refers to runs of items in other, flat, payloads, so that REST
+// and CONCAT need not copy anything. Views are flattened when modified.
+typedef struct atom_list_t atom_list_t;
+
+typedef struct list_seg_t list_seg_t;
+struct list_seg_t {
+   atom_list_t *base;      // Always a flat payload
+   size_t       start;     // Index in the view of the first item
+   size_t       offset;    // Index in base of the first item
+   size_t       length;
+};
+
+struct atom_list_t {
+   size_t   refs;
+   void   **spill;      // ll vector holding all the items once spilled
+   list_num_t *nums;    // Or the values, if all items are numbers
+   atom_t  **boxes;     // and their items, where built
+   uint8_t  numtype;
+   uint8_t  ninline;
+   uint8_t  storage;
+   bool     arena;      // Set once any item may be an arena atom
+   void    *items[LIST_NINLINE + 1];  // NULL-terminated
+
+   list_keys_t *keys;   // Set once searched by key
+
+   list_seg_t *segs;    // Only set for views
+   size_t      nsegs;
+   size_t      length;  // Of a view, or of nums
+
+   size_t      nbytes;  // Charged for spill, segs or nums and boxes
+};
+
+#define LIST(atom)         ((atom_list_t *)(atom)->data)
+
+static THREAD_LOCAL pool_t *g_pool = NULL;
+static THREAD_LOCAL arena_t *g_arena = NULL;
+
+// Every new atom node is tagged with the current census origin
+static THREAD_LOCAL uint16_t g_origin = 0;
+
+pool_t *atom_set_pool (pool_t *pool)
+{
+   pool_t *ret = g_pool;
+   g_pool = pool;
+   return ret;
+}
+
+arena_t *atom_set_arena (arena_t *arena)
+{
+   arena_t *ret = g_arena;
+   g_arena = arena;
+   return ret;
+}
+
+// Atom nodes and list payloads are pool objects of kinds of their own,
+// so that the collector and the census visit nothing else.
+#define POOL_KIND_ATOM     (1)
+#define POOL_KIND_LIST     (2)
+
+// Arena atoms are charged to the current pool, as the arena is only
+// ever set together with the pool of the same runtime.
+static atom_t *atom_alloc (void)
+{
+   atom_t *ret = NULL;
+
+   if (g_arena) {
+      if (!pool_charge (g_pool, sizeof *ret))
+         return NULL;
+
+      if ((ret = arena_alloc (g_arena))) {
+         ret->storage = ATOM_STORAGE_ARENA;
+         ret->origin = g_origin;
+         return ret;
+      }
+
+      pool_uncharge (g_pool, sizeof *ret);
+   }
+
+   if (g_pool) {
+      if ((ret = pool_alloc_kind (g_pool, sizeof *ret, POOL_KIND_ATOM))) {
+         ret->storage = ATOM_STORAGE_POOL;
+         ret->origin = g_origin;
+      }
+      return ret;
+   }
+
+   if ((ret = mem_calloc (1, sizeof *ret)))
+      ret->origin = g_origin;
+
+   return ret;
+}
+
+void atom_free_node (atom_t *atom)
+{
+   if (atom->storage!=ATOM_STORAGE_STATIC)
+      atom_srcloc_del (atom->srcloc);
+
+   switch (atom->storage) {
+      // Arena nodes are only marked as dead here, the memory itself is
+      // reclaimed by atom_arena_reset().
+      case ATOM_STORAGE_ARENA:   atom->type = atom_UNKNOWN;
+                                 atom->data = NULL;
+                                 pool_uncharge (g_pool, sizeof *atom);
+                                 break;
+
+      case ATOM_STORAGE_POOL:    pool_free (atom);
+                                 break;
+
+      case ATOM_STORAGE_STATIC:  break;
+
+      default:                   mem_free (atom);
+                                 break;
+   }
+}
+
+// A buffer atom points at a view: a window onto a store that holds the
+// bytes. Duplicates share the view and slices share the store, so that
+// nothing is copied until someone writes to a store that is shared.
+// Like list payloads, both are reference counted and come from the
+// current pool, which is charged for the bytes of the store.
+typedef struct buffer_store_t buffer_store_t;
+struct buffer_store_t {
+   size_t   refs;
+   size_t   nbytes;
+   uint8_t *bytes;
+   uint8_t  storage;
+};
+
+typedef struct buffer_view_t buffer_view_t;
+struct buffer_view_t {
+   size_t          refs;
+   buffer_store_t *store;
+   size_t          offset;
+   size_t          length;
+   uint8_t         storage;
+};
+
+#define BUFFER(atom)       ((buffer_view_t *)(atom)->data)
+
+static void *payload_alloc (size_t size, uint8_t *storage)
+{
+   void *ret = NULL;
+
+   if (g_pool) {
+      if ((ret = pool_alloc (g_pool, size)))
+         *storage = ATOM_STORAGE_POOL;
+      return ret;
+   }
+
+   return mem_calloc (1, size);
+}
+
+static void payload_free (void *payload, uint8_t storage)
+{
+   if (storage==ATOM_STORAGE_POOL) {
+      pool_free (payload);
+   } else {
+      mem_free (payload);
+   }
+}
+
+// The bytes are a pool block charged to the same pool as the store, so
+// that buffers of recurring sizes reuse the runtime's cached blocks.
+static buffer_store_t *store_new (size_t nbytes, bool zero)
+{
+   uint8_t storage = ATOM_STORAGE_HEAP;
+   buffer_store_t *ret = payload_alloc (sizeof *ret, &storage);
+   if (!ret)
+      return NULL;
+
+   ret->storage = storage;
+   pool_t *owner = storage==ATOM_STORAGE_POOL ? pool_owner (ret) : NULL;
+
+   if (!(ret->bytes = pool_block_alloc (owner, nbytes, zero))) {
+      payload_free (ret, storage);
+      return NULL;
+   }
+
+   ret->refs = 1;
+   ret->nbytes = nbytes;
+
+   return ret;
+}
+
+static void store_del (buffer_store_t *store)
+{
+   if (!store || --store->refs)
+      return;
+
+   pool_block_free (store->bytes);
+   payload_free (store, store->storage);
+}
+
+// Takes over the caller's reference to the store.
+static buffer_view_t *view_new (buffer_store_t *store, size_t offset,
+                                                       size_t length)
+{
+   uint8_t storage = ATOM_STORAGE_HEAP;
+   buffer_view_t *ret = payload_alloc (sizeof *ret, &storage);
+   if (!ret)
+      return NULL;
+
+   ret->refs = 1;
+   ret->store = store;
+   ret->offset = offset;
+   ret->length = length;
+   ret->storage = storage;
+
+   return ret;
+}
+
+static void view_del (buffer_view_t *view)
+{
+   if (!view || --view->refs)
+      return;
+
+   store_del (view->store);
+   payload_free (view, view->storage);
+}
+
+// Without bytes to copy, the buffer is zeroed.
+static buffer_view_t *buffer_new (const void *bytes, size_t nbytes)
+{
+   buffer_store_t *store = store_new (nbytes, bytes==NULL);
+   if (!store)
+      return NULL;
+
+   if (bytes)
+      memcpy (store->bytes, bytes, nbytes);
+
+   buffer_view_t *ret = view_new (store, 0, nbytes);
+   if (!ret)
+      store_del (store);
+
+   return ret;
+}
+
+static const uint8_t *buffer_bytes (const buffer_view_t *view)
+{
+   return &view->store->bytes[view->offset];
+}
+
+// String and quote payloads carry their length in a header in front of
+// the characters that data points at; those short enough to fit are kept
+// in the node itself instead, with slen set.
+typedef struct string_t string_t;
+struct string_t {
+   size_t length;
+   char   chars[];
+};
+
+#define STRING_HDR(str)    ((string_t *)((char *)(str) - offsetof (string_t, chars)))
+
+static const char *string_chars (const atom_t *atom)
+{
+   return atom->slen ? atom->sso : atom->data;
+}
+
+// Stores len bytes of str, which need not be terminated, in dst.
+static atom_t *string_set (atom_t *dst, const char *str, size_t len)
+{
+   if (len <= ATOM_SSO_MAX) {
+      memcpy (dst->sso, str, len);
+      dst->sso[len] = 0;
+      dst->slen = (uint8_t)(len + 1);
+      return dst;
+   }
+
+   string_t *tmp = mem_malloc (sizeof *tmp + len + 1);
+   if (!tmp)
+      return NULL;
+
+   tmp->length = len;
+   memcpy (tmp->chars, str, len);
+   tmp->chars[len] = 0;
+
+   dst->data = tmp->chars;
+   dst->slen = 0;
+
+   return dst;
+}
+
+// Symbol names are interned: all symbols with the same name point at the
+// same string, so symbols compare equal by pointer. Each name is also
+// numbered in order of first appearance. Interned names are never freed.
+typedef struct intern_t intern_t;
+struct intern_t {
+   uint32_t id;
+   uint32_t hash;
+   uint32_t length;
+   char     name[];
+};
+
+#define INTERN_NAME(str)   ((intern_t *)((char *)(str) - offsetof (intern_t, name)))
+
+static intern_t **g_intern_slots = NULL;
+static size_t g_intern_nslots = 0;
+static size_t g_intern_count = 0;
+#ifndef PLATFORM_WINDOWS
+static pthread_mutex_t g_intern_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static uint32_t intern_hash (const char *name)
+{
+   uint32_t ret = 2166136261u;
+   while (*name) {
+      ret ^= (uint8_t)*name++;
+      ret *= 16777619u;
+   }
+   return ret;
+}
+
+static intern_t **intern_slot (const char *name, uint32_t hash)
+{
+   size_t mask = g_intern_nslots - 1;
+
+   for (size_t i=hash & mask; ; i=(i + 1) & mask) {
+      intern_t *entry = g_intern_slots[i];
+      if (!entry || (entry->hash==hash && strcmp (entry->name, name)==0))
+         return &g_intern_slots[i];
+   }
+}
+
+static bool intern_grow (void)
+{
+   size_t nslots = g_intern_nslots ? g_intern_nslots * 2 : 256;
+   intern_t **slots = mem_calloc (nslots, sizeof *slots);
+   if (!slots)
+      return false;
+
+   intern_t **old_slots = g_intern_slots;
+   size_t old_nslots = g_intern_nslots;
+
+   g_intern_slots = slots;
+   g_intern_nslots = nslots;
+
+   for (size_t i=0; i<old_nslots; i++) {
+      if (old_slots[i])
+         *intern_slot (old_slots[i]->name, old_slots[i]->hash) = old_slots[i];
+   }
+
+   mem_free (old_slots);
+   return true;
+}
+
+const char *atom_intern_find (const char *name)
+{
+   intern_t *entry = NULL;
+
+   if (!name)
+      return NULL;
+
+   TABLE_LOCK (g_intern_lock);
+   if (g_intern_nslots)
+      entry = *intern_slot (name, intern_hash (name));
+   TABLE_UNLOCK (g_intern_lock);
+
+   return entry ? entry->name : NULL;
+}
+
+const char *atom_intern (const char *name)
+{
+   const char *ret = NULL;
+
+   if (!name)
+      return NULL;
+
+   uint32_t hash = intern_hash (name);
+
+   TABLE_LOCK (g_intern_lock);
+
+   // Keep the table at most half full
+   if ((g_intern_count + 1) * 2 > g_intern_nslots && !intern_grow ())
+      goto errorexit;
+
+   intern_t **slot = intern_slot (name, hash);
+
+   if (!*slot) {
+      size_t len = strlen (name);
+      intern_t *entry = mem_malloc (sizeof *entry + len + 1);
+      if (!entry)
+         goto errorexit;
+
+      entry->id = (uint32_t)g_intern_count++;
+      entry->hash = hash;
+      entry->length = (uint32_t)len;
+      memcpy (entry->name, name, len + 1);
+      *slot = entry;
+   }
+
+   ret = (*slot)->name;
+
+errorexit:
+   TABLE_UNLOCK (g_intern_lock);
+
+   return ret;
+}
+
+uint32_t atom_symbol_id (const atom_t *atom)
+{
+   if (!atom || atom->type!=atom_SYMBOL || !atom->data)
+      return ATOM_SYMBOL_NOID;
+
+   return INTERN_NAME (atom->data)->id;
+}
+
+// Source positions, indexed by atom_t.srcloc. Entry 0 is unused so that
+// a zeroed atom has no position. File names are stored once each.
+//
+// Every atom that carries an index holds a reference to its entry, and
+// entries that are no longer referenced are reused, so the table only
+// grows with the number of parsed atoms alive at once. Free entries are
+// chained through their group field.
+typedef struct srcloc_t srcloc_t;
+struct srcloc_t {
+   uint32_t file;
+   uint32_t line;
+   uint32_t charpos;
+   uint32_t group;
+   uint32_t refs;
+};
+
+static srcloc_t *g_srclocs = NULL;
+static size_t g_nsrclocs = 0;
+static size_t g_srclocs_len = 0;
+static size_t g_srclocs_live = 0;
+static uint32_t g_srclocs_free = 0;
+
+// The lines of the positions in a group are moved together by adding to
+// the group's, rather than to each of theirs. Group 0 is no group.
+//
+// A group is referenced by its owner and by each of its positions, and
+// its slot is reused once all of them are gone. Free slots are chained
+// through their file field.
+typedef struct srcgroup_t srcgroup_t;
+struct srcgroup_t {
+   uint32_t file;
+   uint32_t refs;
+   int64_t  lines;
+};
+
+static srcgroup_t *g_srcgroups = NULL;
+static size_t g_nsrcgroups = 0;
+static size_t g_srcgroups_len = 0;
+static size_t g_srcgroups_live = 0;
+static uint32_t g_srcgroups_free = 0;
+
+// Positions are added to the group current on the adding thread
+static THREAD_LOCAL uint32_t g_srcgroup = 0;
+
+static const char **g_srcfiles = NULL;
+static size_t g_nsrcfiles = 0;
+
+// Taken by the public functions below; the static ones expect it held
+#ifndef PLATFORM_WINDOWS
+static pthread_mutex_t g_srcloc_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static bool srcfile_find (const char *fname, uint32_t *index)
+{
+   // Positions are added a file at a time, so check the latest first
+   for (size_t i=g_nsrcfiles; i>0; i--) {
+      if (strcmp (g_srcfiles[i - 1], fname)==0) {
+         *index = (uint32_t)(i - 1);
+         return true;
+      }
+   }
+
+   const char **tmp = mem_realloc (g_srcfiles,
+                                   sizeof *tmp * (g_nsrcfiles + 1));
+   if (!tmp)
+      return false;
+   g_srcfiles = tmp;
+
+   if (!(g_srcfiles[g_nsrcfiles] = mem_strdup (fname)))
+      return false;
+
+   *index = (uint32_t)g_nsrcfiles++;
+   return true;
+}
+
+static void srcgroup_del (uint32_t group)
+{
+   if (!group || group >= g_nsrcgroups || !g_srcgroups[group].refs)
+      return;
+
+   if (--g_srcgroups[group].refs)
+      return;
+
+   if (g_srcgroup==group)
+      g_srcgroup = 0;
+
+   g_srcgroups[group].file = g_srcgroups_free;
+   g_srcgroups_free = group;
+   g_srcgroups_live--;
+}
+
+static uint32_t srcloc_add (const char *fname, size_t line, size_t charpos)
+{
+   uint32_t file;
+   uint32_t ret;
+
+   if (!fname || !srcfile_find (fname, &file))
+      return 0;
+
+   if (g_srclocs_free) {
+      ret = g_srclocs_free;
+      g_srclocs_free = g_srclocs[ret].group;
+   } else {
+      if (!g_nsrclocs)
+         g_nsrclocs = 1;
+
+      if (g_nsrclocs >= g_srclocs_len) {
+         size_t newlen = g_srclocs_len ? g_srclocs_len * 2 : 1024;
+         if (newlen > UINT32_MAX)
+            return 0;
+         srcloc_t *tmp = mem_realloc (g_srclocs, sizeof *tmp * newlen);
+         if (!tmp)
+            return 0;
+         g_srclocs = tmp;
+         g_srclocs_len = newlen;
+      }
+
+      ret = (uint32_t)g_nsrclocs++;
+   }
+
+   srcloc_t *loc = &g_srclocs[ret];
+
+   loc->file = file;
+   loc->line = (uint32_t)line;
+   loc->charpos = (uint32_t)charpos;
+   loc->group = 0;
+   loc->refs = 1;
+
+   if (g_srcgroup && g_srcgroups[g_srcgroup].file == file) {
+      loc->group = g_srcgroup;
+      g_srcgroups[g_srcgroup].refs++;
+   }
+
+   g_srclocs_live++;
+   return ret;
+}
+
+uint32_t atom_srcloc_add (const char *fname, size_t line, size_t charpos)
+{
+   TABLE_LOCK (g_srcloc_lock);
+   uint32_t ret = srcloc_add (fname, line, charpos);
+   TABLE_UNLOCK (g_srcloc_lock);
+
+   return ret;
+}
+
+uint32_t atom_srcloc_dup (uint32_t srcloc)
+{
+   if (!srcloc)
+      return 0;
+
+   TABLE_LOCK (g_srcloc_lock);
+   if (srcloc < g_nsrclocs && g_srclocs[srcloc].refs)
+      g_srclocs[srcloc].refs++;
+   TABLE_UNLOCK (g_srcloc_lock);
+
+   return srcloc;
+}
+
+static void srcloc_del (uint32_t srcloc)
+{
+   if (srcloc >= g_nsrclocs || !g_srclocs[srcloc].refs)
+      return;
+
+   srcloc_t *loc = &g_srclocs[srcloc];
+
+   if (--loc->refs)
+      return;
+
+   srcgroup_del (loc->group);
+
+   loc->group = g_srclocs_free;
+   g_srclocs_free = srcloc;
+   g_srclocs_live--;
+}
+
+void atom_srcloc_del (uint32_t srcloc)
+{
+   if (!srcloc)
+      return;
+
+   TABLE_LOCK (g_srcloc_lock);
+   srcloc_del (srcloc);
+   TABLE_UNLOCK (g_srcloc_lock);
+}
+
+size_t atom_srcloc_count (void)
+{
+   TABLE_LOCK (g_srcloc_lock);
+   size_t ret = g_srclocs_live;
+   TABLE_UNLOCK (g_srcloc_lock);
+
+   return ret;
+}
+
+static uint32_t srcloc_group (const char *fname)
+{
+   uint32_t file;
+   uint32_t ret;
+
+   if (!fname || !srcfile_find (fname, &file))
+      return 0;
+
+   if (g_srcgroups_free) {
+      ret = g_srcgroups_free;
+      g_srcgroups_free = g_srcgroups[ret].file;
+   } else {
+      if (!g_nsrcgroups)
+         g_nsrcgroups = 1;
+
+      if (g_nsrcgroups >= g_srcgroups_len) {
+         size_t newlen = g_srcgroups_len ? g_srcgroups_len * 2 : 64;
+         if (newlen > UINT32_MAX)
+            return 0;
+         srcgroup_t *tmp = mem_realloc (g_srcgroups, sizeof *tmp * newlen);
+         if (!tmp)
+            return 0;
+         g_srcgroups = tmp;
+         g_srcgroups_len = newlen;
+      }
+
+      ret = (uint32_t)g_nsrcgroups++;
+   }
+
+   g_srcgroups[ret].file = file;
+   g_srcgroups[ret].refs = 1;
+   g_srcgroups[ret].lines = 0;
+
+   g_srcgroups_live++;
+   return ret;
+}
+
+uint32_t atom_srcloc_group (const char *fname)
+{
+   TABLE_LOCK (g_srcloc_lock);
+   uint32_t ret = srcloc_group (fname);
+   TABLE_UNLOCK (g_srcloc_lock);
+
+   return ret;
+}
+
+void atom_srcloc_group_del (uint32_t group)
+{
+   TABLE_LOCK (g_srcloc_lock);
+   srcgroup_del (group);
+   TABLE_UNLOCK (g_srcloc_lock);
+}
+
+size_t atom_srcloc_group_count (void)
+{
+   TABLE_LOCK (g_srcloc_lock);
+   size_t ret = g_srcgroups_live;
+   TABLE_UNLOCK (g_srcloc_lock);
+
+   return ret;
+}
+
+uint32_t atom_srcloc_set_group (uint32_t group)
+{
+   uint32_t ret = g_srcgroup;
+
+   TABLE_LOCK (g_srcloc_lock);
+   g_srcgroup = group < g_nsrcgroups && g_srcgroups[group].refs ? group : 0;
+   TABLE_UNLOCK (g_srcloc_lock);
+
+   return ret;
+}
+
+void atom_srcloc_move (uint32_t group, int64_t lines)
+{
+   TABLE_LOCK (g_srcloc_lock);
+   if (group && group < g_nsrcgroups && g_srcgroups[group].refs)
+      g_srcgroups[group].lines += lines;
+   TABLE_UNLOCK (g_srcloc_lock);
+}
+
+bool atom_srcloc (const atom_t *atom, const char **fname,
+                                      size_t *line, size_t *charpos)
+{
+   bool ret = false;
+
+   if (!atom || !atom->srcloc)
+      return false;
+
+   TABLE_LOCK (g_srcloc_lock);
+
+   if (atom->srcloc < g_nsrclocs && g_srclocs[atom->srcloc].refs) {
+      const srcloc_t *loc = &g_srclocs[atom->srcloc];
+
+      if (fname)     *fname = g_srcfiles[loc->file];
+      if (line)      *line = loc->line + (loc->group ?
+                                           g_srcgroups[loc->group].lines : 0);
+      if (charpos)   *charpos = loc->charpos;
+
+      ret = true;
+   }
+
+   TABLE_UNLOCK (g_srcloc_lock);
+
+   return ret;
+}
+
+static atom_t *smallint_find (int64_t i)
+{
+   if (i < SMALLINT_MIN || i > SMALLINT_MAX)
+      return NULL;
+
+   return &g_smallints[i - SMALLINT_MIN];
+}
+
+static atom_list_t *list_new (void)
+{
+   atom_list_t *ret = NULL;
+
+   if (g_pool) {
+      if (!(ret = pool_alloc_kind (g_pool, sizeof *ret, POOL_KIND_LIST)))
+         return NULL;
+      ret->storage = ATOM_STORAGE_POOL;
+   } else if (!(ret = mem_calloc (1, sizeof *ret))) {
+      return NULL;
+   }
+
+   ret->refs = 1;
+   ret->arena = g_arena != NULL;
+
+   return ret;
+}
+
+static size_t list_length (const atom_list_t *list)
+{
+   if (list->segs || list->nums)
+      return list->length;
+
+   return list->spill ? ll_length (list->spill) : list->ninline;
+}
+
+// Returns the item of a number kept in place, building it if the list
+// is a copy that has none yet. Items are built outside of any arena, from
+// the pool of the list, as they live as long as it does.
+static atom_t *list_nums_item (const atom_list_t *list, size_t index)
+{
+   if (list->boxes[index])
+      return list->boxes[index];
+
+   pool_t *owner = list->storage==ATOM_STORAGE_POOL ?
+                        pool_owner ((void *)list) : NULL;
+   pool_t *prev_pool = atom_set_pool (owner);
+   arena_t *prev_arena = atom_set_arena (NULL);
+
+   list->boxes[index] = list->numtype==atom_INT ?
+                           atom_int_new (list->nums[index].ival) :
+                           atom_float_new (list->nums[index].fval);
+
+   atom_set_arena (prev_arena);
+   atom_set_pool (prev_pool);
+
+   return list->boxes[index];
+}
+
+static void *list_index (const atom_list_t *list, size_t index)
+{
+   if (list->segs) {
+      if (index >= list->length)
+         return NULL;
+
+      size_t lo = 0, hi = list->nsegs;
+      while (hi - lo > 1) {
+         size_t mid = lo + (hi - lo) / 2;
+         if (list->segs[mid].start <= index) {
+            lo = mid;
+         } else {
+            hi = mid;
+         }
+      }
+
+      const list_seg_t *seg = &list->segs[lo];
+      return list_index (seg->base, seg->offset + index - seg->start);
+   }
+
+   if (list->nums)
+      return index < list->length ? list_nums_item (list, index) : NULL;
+
+   if (list->spill)
+      return ll_index (list->spill, index);
+
+   return index < list->ninline ? list->items[index] : NULL;
+}
+
+// Charges the owner of a pool payload for the memory held by its spill
+// vector and segments, which must come to nbytes. Nothing is changed if
+// the charge is refused.
+static bool list_account (atom_list_t *list, size_t nbytes)
+{
+   pool_t *owner = list->storage==ATOM_STORAGE_POOL ? pool_owner (list) : NULL;
+
+   if (nbytes > list->nbytes) {
+      if (!pool_charge (owner, nbytes - list->nbytes))
+         return false;
+   } else {
+      pool_uncharge (owner, list->nbytes - nbytes);
+   }
+
+   list->nbytes = nbytes;
+   return true;
+}
+
+static void list_keys_drop (atom_list_t *list)
+{
+   if (!list->keys)
+      return;
+
+   pool_t *owner = list->storage==ATOM_STORAGE_POOL ? pool_owner (list) : NULL;
+   pool_uncharge (owner, list->keys->nbytes);
+
+   mem_free (list->keys);
+   list->keys = NULL;
+}
+
+static void list_del (atom_list_t *list)
+{
+   if (!list || --list->refs)
+      return;
+
+   if (list->segs) {
+      for (size_t i=0; i<list->nsegs; i++)
+         list_del (list->segs[i].base);
+      mem_free (list->segs);
+   } else if (list->nums) {
+      for (size_t i=0; i<list->length; i++)
+         atom_del (list->boxes[i]);
+      mem_free (list->boxes);
+      mem_free (list->nums);
+   } else if (list->spill) {
+      ll_iterate (list->spill, (void (*) (void *))atom_del);
+      ll_del (list->spill);
+   } else {
+      for (size_t i=0; i<list->ninline; i++)
+         atom_del (list->items[i]);
+   }
+
+   list_keys_drop (list);
+   list_account (list, 0);
+
+   if (list->storage==ATOM_STORAGE_POOL) {
+      pool_free (list);
+   } else {
+      mem_free (list);
+   }
+}
+
+// Moves the inline items to an ll vector with room for one more.
+static bool list_spill (atom_list_t *list)
+{
+   void **spill = ll_new ();
+
+   for (size_t i=0; spill && i<list->ninline; i++) {
+      if (!ll_ins_tail (&spill, list->items[i])) {
+         ll_del (spill);
+         spill = NULL;
+      }
+   }
+
+   if (!spill)
+      return false;
+
+   list->spill = spill;
+   list->ninline = 0;
+   list->items[0] = NULL;
+
+   return true;
+}
+
+static bool list_numeric (const atom_list_t *list, const atom_t *el)
+{
+   if (el->type!=atom_INT && el->type!=atom_FLOAT)
+      return false;
+
+   for (size_t i=0; i<list->ninline; i++) {
+      if (((atom_t *)list->items[i])->type!=el->type)
+         return false;
+   }
+
+   return true;
+}
+
+// Makes room for at least one more number in place, which may move the
+// values, but never their items.
+static bool list_nums_grow (atom_list_t *list)
+{
+   const size_t slot = sizeof *list->nums + sizeof *list->boxes;
+   size_t nbytes = list->nbytes;
+   size_t nalloc = nbytes / slot;
+   if (list->length < nalloc)
+      return true;
+
+   nalloc = nalloc ? nalloc * 2 : LIST_NNUMS_MIN;
+
+   if (!list_account (list, slot * nalloc))
+      return false;
+
+   list_num_t *nums = mem_realloc (list->nums, sizeof *nums * nalloc);
+   if (nums)
+      list->nums = nums;
+
+   atom_t **boxes = nums ? mem_realloc (list->boxes, sizeof *boxes * nalloc)
+                         : NULL;
+   if (!boxes) {
+      list_account (list, nbytes);
+      return false;
+   }
+
+   list->boxes = boxes;
+   return true;
+}
+
+// Keeps the value of a number next to the number itself.
+static atom_t *list_nums_set (atom_list_t *list, size_t index, atom_t *el)
+{
+   if (el->type==atom_INT) {
+      list->nums[index].ival = el->ival;
+   } else {
+      list->nums[index].fval = el->fval;
+   }
+
+   list->boxes[index] = el;
+
+   return el;
+}
+
+// Moves the inline items, which are all numbers of one type, in place.
+static bool list_unbox (atom_list_t *list)
+{
+   if (!list_nums_grow (list))
+      return false;
+
+   for (size_t i=0; i<list->ninline; i++) {
+      list_nums_set (list, i, list->items[i]);
+   }
+
+   list->numtype = ((atom_t *)list->items[0])->type;
+   list->length = list->ninline;
+   list->ninline = 0;
+   list->items[0] = NULL;
+
+   return true;
+}
+
+// Moves the items of the numbers kept in place to an ll vector, building
+// those that are missing.
+static bool list_box (atom_list_t *list)
+{
+   void **spill = ll_new ();
+
+   for (size_t i=0; spill && i<list->length; i++) {
+      atom_t *item = list_nums_item (list, i);
+      if (!item || !ll_ins_tail (&spill, item)) {
+         ll_del (spill);
+         spill = NULL;
+      }
+   }
+
+   if (!spill || !list_account (list, ll_nbytes (spill))) {
+      ll_del (spill);
+      return false;
+   }
+
+   mem_free (list->boxes);
+   mem_free (list->nums);
+   list->boxes = NULL;
+   list->nums = NULL;
+   list->length = 0;
+   list->spill = spill;
+
+   return true;
+}
+
+// Picks the storage for the items once el is added: numbers that match
+// stay in place, anything else ends up in an ll vector.
+static bool list_grow (atom_list_t *list, const atom_t *el)
+{
+   if (list->nums) {
+      if (el->type!=list->numtype)
+         return list_box (list);
+
+      return list_nums_grow (list);
+   }
+
+   if (list->spill || list->ninline < LIST_NINLINE)
+      return true;
+
+   return list_numeric (list, el) ? list_unbox (list) : list_spill (list);
+}
+
+static void *list_ins_tail (atom_list_t *list, void *el)
+{
+   if (!el || !list_grow (list, el))
+      return NULL;
+
+   if (list->nums)
+      return list_nums_set (list, list->length++, el);
+
+   if (list->spill) {
+      if (!ll_ins_tail (&list->spill, el))
+         return NULL;
+
+      if (!list_account (list, ll_nbytes (list->spill))) {
+         ll_remove_tail (&list->spill);
+         return NULL;
+      }
+
+      return el;
+   }
+
+   list->items[list->ninline++] = el;
+   list->items[list->ninline] = NULL;
+
+   return el;
+}
+
+static void *list_ins_head (atom_list_t *list, void *el)
+{
+   if (!el || !list_grow (list, el))
+      return NULL;
+
+   list_keys_drop (list);
+
+   if (list->nums) {
+      memmove (&list->nums[1], &list->nums[0],
+               sizeof list->nums[0] * list->length);
+      memmove (&list->boxes[1], &list->boxes[0],
+               sizeof list->boxes[0] * list->length);
+      list->length++;
+      return list_nums_set (list, 0, el);
+   }
+
+   if (list->spill) {
+      if (!ll_ins_head (&list->spill, el))
+         return NULL;
+
+      if (!list_account (list, ll_nbytes (list->spill))) {
+         ll_remove_head (&list->spill);
+         return NULL;
+      }
+
+      return el;
+   }
+
+   memmove (&list->items[1], &list->items[0],
+            sizeof list->items[0] * (list->ninline + 1));
+   list->items[0] = el;
+   list->ninline++;
+
+   return el;
+}
+
+static void *list_remove (atom_list_t *list, size_t index)
+{
+   list_keys_drop (list);
+
+   if (list->nums) {
+      atom_t *ret = index < list->length ? list_nums_item (list, index) : NULL;
+      if (!ret)
+         return NULL;
+
+      list->length--;
+      memmove (&list->nums[index], &list->nums[index + 1],
+               sizeof list->nums[0] * (list->length - index));
+      memmove (&list->boxes[index], &list->boxes[index + 1],
+               sizeof list->boxes[0] * (list->length - index));
+      return ret;
+   }
+
+   if (list->spill)
+      return ll_remove (&list->spill, index);
+
+   if (index >= list->ninline)
+      return NULL;
+
+   void *ret = list->items[index];
+   memmove (&list->items[index], &list->items[index + 1],
+            sizeof list->items[0] * (list->ninline - index));
+   list->ninline--;
+
+   return ret;
+}
+
+// Returns the ID of the key of an entry, or ATOM_SYMBOL_NOID if it is
+// not keyed by a symbol.
+static uint32_t entry_key_id (const atom_t *entry)
+{
+   if (!entry || entry->type!=atom_LIST)
+      return ATOM_SYMBOL_NOID;
+
+   return atom_symbol_id (list_index (LIST (entry), 0));
+}
+
+static list_key_t *keys_slot (list_keys_t *keys, uint32_t id)
+{
+   for (size_t i=(id * 2654435761u) & keys->mask; ; i=(i + 1) & keys->mask) {
+      if (keys->slots[i].id==id || keys->slots[i].id==ATOM_SYMBOL_NOID)
+         return &keys->slots[i];
+   }
+}
+
+// Brings the index of a list up to date, building it anew once it would
+// be more than half full. Returns NULL if the list is not worth indexing
+// or out of memory, in which case it is searched item by item.
+static list_keys_t *list_keys (const atom_list_t *list)
+{
+   size_t len = list_length (list);
+
+   if (list->segs || list->nums || len < LIST_KEYS_MIN || len > UINT32_MAX)
+      return NULL;
+
+   list_keys_t *keys = list->keys;
+
+   if (!keys || len * 2 > keys->mask + 1) {
+      size_t nslots = LIST_KEYS_MIN * 4;
+      while (nslots < len * 4)
+         nslots *= 2;
+
+      size_t nbytes = sizeof *keys + sizeof keys->slots[0] * nslots;
+      pool_t *owner = list->storage==ATOM_STORAGE_POOL ?
+                           pool_owner ((void *)list) : NULL;
+
+      if (!pool_charge (owner, nbytes))
+         return NULL;
+
+      if (!(keys = mem_malloc (nbytes))) {
+         pool_uncharge (owner, nbytes);
+         return NULL;
+      }
+
+      keys->nbytes = nbytes;
+      keys->mask = nslots - 1;
+      keys->length = 0;
+      keys->nother = 0;
+      for (size_t i=0; i<nslots; i++)
+         keys->slots[i].id = ATOM_SYMBOL_NOID;
+
+      list_keys_drop ((atom_list_t *)list);
+      ((atom_list_t *)list)->keys = keys;
+   }
+
+   for (size_t i=keys->length; i<len; i++) {
+      uint32_t id = entry_key_id (list_index (list, i));
+      if (id==ATOM_SYMBOL_NOID) {
+         keys->nother++;
+         continue;
+      }
+
+      list_key_t *slot = keys_slot (keys, id);
+      if (slot->id==ATOM_SYMBOL_NOID) {
+         slot->id = id;
+         slot->index = (uint32_t)i;
+      }
+   }
+
+   keys->length = len;
+   return keys;
+}
+
+// Appends a run of items from a flat payload to a view.
+static bool view_push (atom_list_t *view, atom_list_t *base,
+                       size_t offset, size_t length)
+{
+   if (!length)
+      return true;
+
+   list_seg_t *last = view->nsegs ? &view->segs[view->nsegs - 1] : NULL;
+
+   if (last && last->base==base && last->offset + last->length==offset) {
+      last->length += length;
+   } else {
+      if (!list_account (view, sizeof *view->segs * (view->nsegs + 1)))
+         return false;
+
+      list_seg_t *tmp = mem_realloc (view->segs,
+                                     sizeof *tmp * (view->nsegs + 1));
+      if (!tmp) {
+         list_account (view, sizeof *view->segs * view->nsegs);
+         return false;
+      }
+
+      view->segs = tmp;
+      view->segs[view->nsegs].base = base;
+      view->segs[view->nsegs].start = view->length;
+      view->segs[view->nsegs].offset = offset;
+      view->segs[view->nsegs].length = length;
+      view->nsegs++;
 
-typedef atom_t *(atom_newfunc_t) (atom_t *dst, const char *);
-typedef void (atom_delfunc_t) (atom_t *);
-typedef void (atom_prnfunc_t) (const atom_t *, size_t, FILE *);
-typedef atom_t *(atom_dupfunc_t) (atom_t *dst, const atom_t *);
-typedef int (atom_cmpfunc_t) (const atom_t *lhs, const atom_t *rhs);
+      base->refs++;
+      view->arena |= base->arena;
+   }
 
-static atom_t *a_new_list (atom_t *dst, const char *str)
-{
-   str = str;
-   dst->data = ll_new ();
-   return dst;
+   view->length += length;
+   return true;
 }
 
-static atom_t *a_new_string (atom_t *dst, const char *str)
+// Appends items [from, to) of src to a view that is not shared yet.
+static bool view_add (atom_list_t *view, atom_list_t *src,
+                      size_t from, size_t to)
 {
-   char *tmp = xstr_dup (str);
+   if (!src->segs)
+      return view_push (view, src, from, to - from);
+
+   for (size_t i=0; i<src->nsegs && from < to; i++) {
+      const list_seg_t *seg = &src->segs[i];
+      size_t seg_end = seg->start + seg->length;
+
+      if (from >= seg_end)
+         continue;
+
+      size_t n = (to < seg_end ? to : seg_end) - from;
+      if (!view_push (view, seg->base, seg->offset + from - seg->start, n))
+         return false;
 
-   if (tmp && tmp[0]=='"') {
-      size_t nbytes = strlen (tmp);
-      memmove (&tmp[0], &tmp[1], nbytes);
-      char *equote = strrchr (tmp, '"');
-      if (equote)
-         *equote = 0;
+      from += n;
    }
-   dst->data = tmp;
-   return dst;
+
+   return true;
 }
 
-static atom_t *a_new_int (atom_t *dst, const char *str)
+// Makes a private copy of the payload, duplicating each item.
+static atom_list_t *list_copy (const atom_list_t *src)
 {
    bool error = true;
-   atom_t *ret = NULL;
+   atom_list_t *ret = list_new ();
 
-   dst->data = malloc (sizeof (int64_t));
-   if (!dst->data)
+   if (!ret)
       return NULL;
 
-   int64_t tmp;
-   if (sscanf (str, "%" PRIi64, &tmp)!=1) {
-      XERROR ("[%s] is not an integer\n", str);
-      goto errorexit;
+   // Numbers kept in place are copied by value; only the items that
+   // carry more than their value are duplicated, the others are built
+   // from it when they are asked for.
+   if (src->nums && src->length) {
+      size_t n = src->length;
+      if (!list_account (ret, (sizeof *src->nums + sizeof *src->boxes) * n) ||
+          !(ret->nums = mem_malloc (sizeof *src->nums * n)) ||
+          !(ret->boxes = mem_calloc (n, sizeof *src->boxes)))
+         goto errorexit;
+
+      memcpy (ret->nums, src->nums, sizeof *src->nums * n);
+      ret->numtype = src->numtype;
+      ret->length = n;
+
+      for (size_t i=0; i<n; i++) {
+         const atom_t *item = src->boxes[i];
+         if (!item || !(item->srcloc || item->flags))
+            continue;
+
+         if (!(ret->boxes[i] = atom_dup (item)))
+            goto errorexit;
+
+         ret->arena |= atom_in_arena (ret->boxes[i]);
+      }
+
+      return ret;
    }
 
-   *(int64_t *)dst->data = tmp;
+   size_t len = list_length (src);
+
+   for (size_t i=0; i<len; i++) {
+
+      atom_t *na = atom_dup (list_index (src, i));
+      if (!na)
+         goto errorexit;
+
+      bool arena = atom_in_arena (na);
+
+      if (!(list_ins_tail (ret, na))) {
+         atom_del (na);
+         goto errorexit;
+      }
+
+      ret->arena |= arena;
+   }
 
-   ret = dst;
    error = false;
 
 errorexit:
-
    if (error) {
-      free (dst->data);
+      list_del (ret);
       ret = NULL;
    }
-
    return ret;
 }
 
-static atom_t *a_new_float (atom_t *dst, const char *str)
+// Must be called before modifying a list payload.
+static bool list_unshare (atom_t *atom)
 {
-   bool error = true;
-   atom_t *ret = NULL;
+   atom_list_t *list = LIST (atom);
 
-   dst->data = malloc (sizeof (int64_t));
-   if (!dst->data)
-      return NULL;
+   if (list->refs==1 && !list->segs)
+      return true;
 
-   double tmp;
-   if (sscanf (str, "%lf", &tmp)!=1) {
-      XERROR ("[%s] is not a float\n", str);
-      goto errorexit;
+   if (!(atom->data = list_copy (list))) {
+      atom->data = list;
+      return false;
    }
 
-   *(double *)dst->data = tmp;
+   list_del (list);
+   return true;
+}
 
-   ret = dst;
-   error = false;
+static atom_t *a_new_list (atom_t *dst, const char *str)
+{
+   str = str;
+   dst->data = list_new ();
+   return dst->data ? dst : NULL;
+}
 
-errorexit:
+static atom_t *a_new_string (atom_t *dst, const char *str)
+{
+   if (!str)
+      return dst;
 
-   if (error) {
-      free (dst->data);
-      ret = NULL;
+   size_t len = 0;
+
+   if (str[0]=='"') {
+      const char *equote = strrchr (++str, '"');
+      len = equote ? (size_t)(equote - str) : strlen (str);
+   } else {
+      len = strlen (str);
    }
 
-   return ret;
+   return string_set (dst, str, len);
+}
+
+static atom_t *a_new_symbol (atom_t *dst, const char *str)
+{
+   if (!str)
+      return dst;
+
+   dst->data = (char *)atom_intern (str);
+   return dst->data ? dst : NULL;
+}
+
+static atom_t *a_new_int (atom_t *dst, const char *str)
+{
+   if (sscanf (str, "%" PRIi64, &dst->ival)!=1) {
+      XERROR ("[%s] is not an integer\n", str);
+      return NULL;
+   }
+
+   return dst;
+}
+
+static atom_t *a_new_float (atom_t *dst, const char *str)
+{
+   if (sscanf (str, "%lf", &dst->fval)!=1) {
+      XERROR ("[%s] is not a float\n", str);
+      return NULL;
+   }
+
+   return dst;
 }
 
 static atom_t *a_new_fptr (atom_t *dst, const char *str)
@@ -113,14 +1485,11 @@ static atom_t *a_new_buffer (atom_t *dst, const char *str)
    tmp = &str[1];
    nbytes /= 2;
 
-   dst->data = malloc (nbytes + sizeof (size_t));
-
-   if (!dst->data)
+   if (!(dst->data = buffer_new (NULL, nbytes)))
       return NULL;
 
-   *(size_t *)dst->data = nbytes;
-   uint8_t *b = dst->data;
-   for (size_t i=sizeof (size_t); i<nbytes + sizeof (size_t); i++) {
+   uint8_t *b = BUFFER (dst)->store->bytes;
+   for (size_t i=0; i<nbytes; i++) {
       sscanf (tmp, "%02hhx", &b[i]);
       tmp += 2;
    }
@@ -131,19 +1500,18 @@ static atom_t *a_new_buffer (atom_t *dst, const char *str)
 
 static void a_del_list (atom_t *atom)
 {
-   void **tmp = atom->data;
-   size_t len = ll_length (tmp);
+   list_del (LIST (atom));
+}
 
-   for (size_t i=0; i<len; i++) {
-      atom_t *a = ll_index (tmp, i);
-      atom_del (a);
-   }
-   ll_del (tmp);
+static void a_del_string (atom_t *atom)
+{
+   if (!atom->slen && atom->data)
+      mem_free (STRING_HDR (atom->data));
 }
 
-static void a_del_nonlist (atom_t *atom)
+static void a_del_buffer (atom_t *atom)
 {
-   free (atom->data);
+   view_del (BUFFER (atom));
 }
 
 static void print_depth (size_t depth, FILE *outf)
@@ -154,14 +1522,14 @@ static void print_depth (size_t depth, FILE *outf)
 
 static void a_pr_list (const atom_t *atom, size_t depth, FILE *outf)
 {
-   void **children = atom->data;
-   size_t nchildren = ll_length (children);
+   const atom_list_t *list = atom->data;
+   size_t nchildren = list ? list_length (list) : 0;
 
    if (depth) fprintf (outf, "\n");
    print_depth (depth, outf);
    fprintf (outf, "(");
    for (size_t i=0; i<nchildren; i++) {
-      atom_t *child = ll_index (children, i);
+      atom_t *child = list_index (list, i);
       fprintf (outf, " ");
       atom_print (child, depth + 1, outf);
       // fprintf (outf, "\n");
@@ -173,13 +1541,13 @@ static void a_pr_list (const atom_t *atom, size_t depth, FILE *outf)
 static void a_pr_quote (const atom_t *atom, size_t depth, FILE *outf)
 {
    depth = depth;
-   fprintf (outf, "quot[%s]", (char *)atom->data);
+   fprintf (outf, "quot[%s]", string_chars (atom));
 }
 
 static void a_pr_string (const atom_t *atom, size_t depth, FILE *outf)
 {
    depth = depth;
-   fprintf (outf, "str[%s]", (char *)atom->data);
+   fprintf (outf, "str[%s]", string_chars (atom));
 }
 
 static void a_pr_symbol (const atom_t *atom, size_t depth, FILE *outf)
@@ -191,13 +1559,13 @@ static void a_pr_symbol (const atom_t *atom, size_t depth, FILE *outf)
 static void a_pr_int (const atom_t *atom, size_t depth, FILE *outf)
 {
    depth = depth;
-   fprintf (outf, "int[%" PRIi64 "]", *(int64_t *)atom->data);
+   fprintf (outf, "int[%" PRIi64 "]", atom->ival);
 }
 
 static void a_pr_float (const atom_t *atom, size_t depth, FILE *outf)
 {
    depth = depth;
-   fprintf (outf, "flt[%f]", *(double *)atom->data);
+   fprintf (outf, "flt[%f]", atom->fval);
 }
 
 static void a_pr_ffi (const atom_t *atom, size_t depth, FILE *outf)
@@ -210,11 +1578,11 @@ static void a_pr_buffer (const atom_t *atom, size_t depth, FILE *outf)
 {
    depth = depth;
 
-   size_t nbytes = *(size_t *)atom->data;
+   const buffer_view_t *view = BUFFER (atom);
 
    fprintf (outf, "buf[");
-   uint8_t *b = atom->data;
-   for (size_t i=sizeof (size_t); i<nbytes + sizeof (size_t); i++) {
+   const uint8_t *b = buffer_bytes (view);
+   for (size_t i=0; i<view->length; i++) {
       fprintf (outf, "0x%02x-", b[i]);
    }
    fprintf (outf, "]");
@@ -228,215 +1596,492 @@ static void a_pr_native (const atom_t *atom, size_t depth, FILE *outf)
 
 static atom_t *a_dup_list (atom_t *dst, const atom_t *src)
 {
-   bool error = true;
-   void **tmp = ll_new ();
-   void **stmp = src->data;
+   atom_list_t *list = LIST (src);
 
-   size_t len = ll_length (stmp);
+   // Long-lived atoms must not share a payload that references arena
+   // atoms, so those get a copy.
+   if (list->arena && !g_arena) {
+      dst->data = list_copy (list);
+      return dst->data ? dst : NULL;
+   }
 
-   for (size_t i=0; i<len; i++) {
+   list->refs++;
+   dst->data = list;
+
+   return dst;
+}
 
-      atom_t *ea = ll_index (stmp, i);
+static atom_t *a_dup_string (atom_t *dst, const atom_t *src)
+{
+   if (!src->slen && !src->data)
+      return dst;
 
-      atom_t *na = atom_dup (ea);
-      if (!na)
-         goto errorexit;
+   return string_set (dst, string_chars (src), atom_string_length (src));
+}
 
-      if (!(ll_ins_tail (&tmp, na)))
-         goto errorexit;
+static atom_t *a_dup_int (atom_t *dst, const atom_t *src)
+{
+   dst->ival = src->ival;
+
+   return dst;
+}
+
+static atom_t *a_dup_float (atom_t *dst, const atom_t *src)
+{
+   dst->fval = src->fval;
+
+   return dst;
+}
+
+static atom_t *a_dup_fptr (atom_t *dst, const atom_t *src)
+{
+   dst->data = src->data;
+
+   return dst;
+}
+
+static atom_t *a_dup_buffer (atom_t *dst, const atom_t *src)
+{
+   BUFFER (src)->refs++;
+   dst->data = src->data;
+
+   return dst;
+}
+
+static int a_cmp_list (const atom_t *lhs, const atom_t *rhs)
+{
+   size_t lhs_len = atom_list_length (lhs),
+          rhs_len = atom_list_length (rhs);
+
+   for (size_t i=0; i<lhs_len && i<rhs_len; i++) {
+      const atom_t *lhs_child = atom_list_index (lhs, i),
+                   *rhs_child = atom_list_index (rhs, i);
+
+      int tmp = atom_cmp (lhs_child, rhs_child);
+      if (tmp) {
+         return tmp;
+      }
    }
 
-   dst->data = tmp;
+   if (lhs_len < rhs_len)
+      return -1;
+
+   if (lhs_len > rhs_len)
+      return 1;
 
-   error = false;
+   return 0;
+}
 
-errorexit:
-   if (error) {
-      ll_iterate (tmp, (void (*) (void *))atom_del);
-      ll_del (tmp);
+// Orders like strcmp(), without having to look for the terminators
+static int a_cmp_string (const atom_t *lhs, const atom_t *rhs)
+{
+   size_t lhs_len = atom_string_length (lhs),
+          rhs_len = atom_string_length (rhs);
+
+   int ret = 0;
+   if (lhs_len && rhs_len) {
+      ret = memcmp (string_chars (lhs), string_chars (rhs),
+                    lhs_len < rhs_len ? lhs_len : rhs_len);
+   }
+
+   return ret ? ret : (lhs_len > rhs_len) - (lhs_len < rhs_len);
+}
+
+static int a_cmp_symbol (const atom_t *lhs, const atom_t *rhs)
+{
+   if (lhs->data == rhs->data)
+      return 0;
+
+   return a_cmp_string (lhs, rhs);
+}
+
+static int a_cmp_int (const atom_t *lhs, const atom_t *rhs)
+{
+   int64_t lhs_i = lhs->ival,
+           rhs_i = rhs->ival;
+
+   if (lhs_i < rhs_i)      return -1;
+   if (lhs_i > rhs_i)      return 1;
+
+   return 0;
+}
+
+static int a_cmp_float (const atom_t *lhs, const atom_t *rhs)
+{
+   double lhs_f = lhs->fval,
+          rhs_f = rhs->fval;
+
+   if (lhs_f < rhs_f)      return -1;
+   if (lhs_f > rhs_f)      return 1;
+
+   return 0;
+}
+
+static int a_cmp_fptr (const atom_t *lhs, const atom_t *rhs)
+{
+   return lhs->data - rhs->data;
+}
+
+static int a_cmp_buffer (const atom_t *lhs, const atom_t *rhs)
+{
+   size_t nblhs = BUFFER (lhs)->length,
+          nbrhs = BUFFER (rhs)->length;
+
+   size_t nbytes = nblhs < nbrhs ? nblhs : nbrhs;
+
+   int ret = memcmp (buffer_bytes (BUFFER (lhs)), buffer_bytes (BUFFER (rhs)), nbytes);
+
+   return ret ? ret : (nblhs > nbrhs) - (nblhs < nbrhs);
+}
+
+typedef struct atom_dispatch_t atom_dispatch_t;
+struct atom_dispatch_t {
+   const char       *name;
+   atom_newfunc_t   *new_fptr;
+   atom_delfunc_t   *del_fptr;
+   atom_prnfunc_t   *prn_fptr;
+   atom_dupfunc_t   *dup_fptr;
+   atom_cmpfunc_t   *cmp_fptr;
+};
+
+#define ATOM_DISPATCH(type, new_fptr, del_fptr, prn_fptr, dup_fptr, cmp_fptr) \
+   [atom_##type] = { #type, new_fptr, del_fptr, prn_fptr, dup_fptr, cmp_fptr },
+
+static const atom_dispatch_t g_funcs[] = {
+   ATOM_TYPES (ATOM_DISPATCH)
+};
+
+#undef ATOM_DISPATCH
+
+static const atom_dispatch_t *atom_find_funcs (enum atom_type_t type)
+{
+   return (size_t)type < sizeof g_funcs/sizeof g_funcs[0] ? &g_funcs[type] : NULL;
+}
+
+const char *atom_type_name (enum atom_type_t type)
+{
+   const atom_dispatch_t *funcs = atom_find_funcs (type);
+   if (type==atom_ENDL)
+      return "ENDL";
+
+   return funcs ? funcs->name : "INVALID";
+}
+
+void atom_del_generic (atom_t *atom)
+{
+   if (!atom || atom->storage==ATOM_STORAGE_STATIC)
+      return;
+
+   const atom_dispatch_t *funcs = atom_find_funcs (atom->type);
+   if (funcs && funcs->del_fptr) {
+      funcs->del_fptr (atom);
+   }
+
+   atom_free_node (atom);
+}
+
+static void arena_atom_del (void *atom)
+{
+   if (((atom_t *)atom)->type!=atom_UNKNOWN)
+      atom_del (atom);
+}
+
+void atom_arena_reset (arena_t *arena)
+{
+   arena_iterate (arena, arena_atom_del);
+   arena_reset (arena);
+}
+
+bool atom_in_arena (const atom_t *atom)
+{
+   return atom && atom->storage==ATOM_STORAGE_ARENA;
+}
+
+atom_t *atom_promote (atom_t *atom)
+{
+   if (!atom_in_arena (atom))
+      return atom;
+
+   arena_t *prev_arena = atom_set_arena (NULL);
+   atom_t *ret = atom_dup (atom);
+   atom_set_arena (prev_arena);
+
+   if (ret && ret->storage!=ATOM_STORAGE_STATIC)
+      ret->origin = atom->origin;
+
+   if (ret)
+      atom_del (atom);
+
+   return ret;
+}
+
+#define GC_ROOT         (1 << 0)
+#define GC_ITEM         (1 << 1)
+#define GC_EXTERN       (1 << 2)
+
+static THREAD_LOCAL void **g_gc_garbage = NULL;
+static THREAD_LOCAL bool g_gc_oom = false;
+
+void atom_gc_extern (atom_t *atom)
+{
+   if (atom && atom->storage==ATOM_STORAGE_POOL)
+      atom->gcbits |= GC_EXTERN;
+}
+
+void atom_gc_release (atom_t *atom)
+{
+   if (atom && atom->storage==ATOM_STORAGE_POOL)
+      atom->gcbits &= ~GC_EXTERN;
+}
+
+static void gc_mark_items (void *obj)
+{
+   atom_list_t *list = obj;
+
+   // The items of a view are those of its bases, which are visited too,
+   // and numbers kept in place may not have their items built yet.
+   if (list->segs)
+      return;
+
+   size_t len = list_length (list);
+   for (size_t i=0; i<len; i++) {
+      atom_t *item = list->nums ? list->boxes[i] : list_index (list, i);
+      if (item && item->storage==ATOM_STORAGE_POOL)
+         item->gcbits |= GC_ITEM;
    }
-   return error ? NULL : dst;
 }
 
-static atom_t *a_dup_string (atom_t *dst, const atom_t *src)
+static void gc_sweep_atom (void *obj)
 {
-   char *tmp = xstr_dup ((char *)src->data);
-
-   if (!tmp && src->data)
-      return NULL;
+   atom_t *atom = obj;
 
-   dst->data = tmp;
+   if (!(atom->gcbits & (GC_ROOT | GC_ITEM | GC_EXTERN)) &&
+       !ll_ins_tail (&g_gc_garbage, atom)) {
+      g_gc_oom = true;
+   }
 
-   return dst;
+   atom->gcbits &= GC_EXTERN;
 }
 
-static atom_t *a_dup_int (atom_t *dst, const atom_t *src)
+// Every payload owns its items, so reachability only has to be decided
+// for the atoms that are not items: deleting the unreachable ones
+// releases everything below them through the usual reference counts.
+int64_t atom_gc_collect (pool_t *pool, const atom_t **roots)
 {
-   int64_t *tmp = malloc (sizeof *tmp);
-   if (!tmp)
-      return NULL;
-
-   *tmp = *(int64_t *)src->data;
+   int64_t ret = -1;
 
-   dst->data = tmp;
+   if (!pool || !(g_gc_garbage = ll_new ()))
+      return -1;
 
-   return dst;
-}
+   g_gc_oom = false;
 
-static atom_t *a_dup_float (atom_t *dst, const atom_t *src)
-{
-   double *tmp = malloc (sizeof *tmp);
-   if (!tmp)
-      return NULL;
+   for (size_t i=0; roots && roots[i]; i++) {
+      if (roots[i]->storage==ATOM_STORAGE_POOL)
+         ((atom_t *)roots[i])->gcbits |= GC_ROOT;
+   }
 
-   *tmp = *(double *)src->data;
+   // Marks left behind by a failed pass only keep atoms alive until the
+   // next collection, so there is nothing to undo.
+   if (!pool_iterate_kind (pool, sizeof (atom_list_t), POOL_KIND_LIST,
+                           gc_mark_items) ||
+       !pool_iterate_kind (pool, sizeof (atom_t), POOL_KIND_ATOM,
+                           gc_sweep_atom) ||
+       g_gc_oom) {
+      goto errorexit;
+   }
 
-   dst->data = tmp;
+   ret = ll_length (g_gc_garbage);
+   ll_iterate (g_gc_garbage, (void (*) (void *))atom_del);
 
-   return dst;
-}
+errorexit:
 
-static atom_t *a_dup_fptr (atom_t *dst, const atom_t *src)
-{
-   dst->data = src->data;
+   ll_del (g_gc_garbage);
+   g_gc_garbage = NULL;
 
-   return dst;
+   return ret;
 }
 
-static atom_t *a_dup_buffer (atom_t *dst, const atom_t *src)
-{
-   size_t nbytes = *(size_t *)src->data;
+// Origins are numbered from 1 in order of registration; 0 is unknown.
+static const char **g_origin_names = NULL;
+static size_t g_norigins = 0;
+#ifndef PLATFORM_WINDOWS
+static pthread_mutex_t g_origin_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
-   dst->data = malloc (nbytes + sizeof (size_t));
-   if (!dst->data)
-      return NULL;
+typedef struct census_row_t census_row_t;
+struct census_row_t {
+   size_t natoms;
+   size_t nbytes;
+};
 
-   memcpy (dst->data, src->data, nbytes + sizeof (size_t));
-   return dst;
-}
+// Filled in by the census running on this thread, for the origins that
+// were registered when it started
+static THREAD_LOCAL census_row_t g_census_types[atom_ENDL];
+static THREAD_LOCAL census_row_t *g_census_origins = NULL;
+static THREAD_LOCAL size_t g_census_norigins = 0;
 
-static int a_cmp_list (const atom_t *lhs, const atom_t *rhs)
+#define ATOM_NAME(type, ...)     #type,
+static const char *g_type_names[] = { ATOM_TYPES (ATOM_NAME) };
+#undef ATOM_NAME
+
+uint16_t atom_census_origin (const char *name)
 {
-   size_t lhs_len = atom_list_length (lhs),
-          rhs_len = atom_list_length (rhs);
+   uint16_t ret = 0;
 
-   for (size_t i=0; i<lhs_len && i<rhs_len; i++) {
-      const atom_t *lhs_child = atom_list_index (lhs, i),
-                   *rhs_child = atom_list_index (rhs, i);
+   if (!name || !(name = atom_intern (name)))
+      return 0;
 
-      int tmp = atom_cmp (lhs_child, rhs_child);
-      if (tmp) {
-         return tmp;
+   TABLE_LOCK (g_origin_lock);
+
+   for (size_t i=0; i<g_norigins; i++) {
+      if (g_origin_names[i] == name) {
+         ret = i + 1;
+         goto errorexit;
       }
    }
 
-   if (lhs_len < rhs_len)
-      return -1;
+   if (g_norigins == UINT16_MAX)
+      goto errorexit;
 
-   if (lhs_len > rhs_len)
-      return 1;
+   const char **tmp = mem_realloc (g_origin_names,
+                                   sizeof *tmp * (g_norigins + 1));
+   if (!tmp)
+      goto errorexit;
 
-   return 0;
+   g_origin_names = tmp;
+   g_origin_names[g_norigins++] = name;
+
+   ret = g_norigins;
+
+errorexit:
+   TABLE_UNLOCK (g_origin_lock);
+
+   return ret;
 }
 
-static int a_cmp_string (const atom_t *lhs, const atom_t *rhs)
+uint16_t atom_census_set_origin (uint16_t origin)
 {
-   const char *lhs_s = atom_to_string (lhs),
-              *rhs_s = atom_to_string (rhs);
-   return strcmp (lhs_s, rhs_s);
+   uint16_t ret = g_origin;
+   g_origin = origin;
+   return ret;
 }
 
-static int a_cmp_int (const atom_t *lhs, const atom_t *rhs)
+// Payloads shared by several atoms are split between them
+static size_t census_payload_nbytes (const atom_t *atom)
 {
-   int64_t lhs_i = *(int64_t *)lhs->data,
-           rhs_i = *(int64_t *)rhs->data;
-
-   if (lhs_i < rhs_i)      return -1;
-   if (lhs_i > rhs_i)      return 1;
+   switch (atom->type) {
+      case atom_LIST:
+         return (sizeof (atom_list_t) + LIST (atom)->nbytes) /
+                  LIST (atom)->refs;
+
+      case atom_QUOTE:
+      case atom_STRING:
+         return atom->slen || !atom->data ? 0 :
+                  sizeof (string_t) + STRING_HDR (atom->data)->length + 1;
+
+      case atom_BUFFER: {
+         const buffer_view_t *view = BUFFER (atom);
+         size_t nstore = sizeof *view->store +
+                         pool_block_size (view->store->bytes);
+         return (sizeof *view + nstore / view->store->refs) / view->refs;
+      }
 
-   return 0;
+      default:
+         return 0;
+   }
 }
 
-static int a_cmp_float (const atom_t *lhs, const atom_t *rhs)
+static void census_count (void *obj)
 {
-   double lhs_f = *(double *)lhs->data,
-          rhs_f = *(double *)rhs->data;
+   const atom_t *atom = obj;
 
-   if (lhs_f < rhs_f)      return -1;
-   if (lhs_f > rhs_f)      return 1;
+   // Arena atoms that were deleted are only marked as such
+   if (atom->storage==ATOM_STORAGE_ARENA && atom->type==atom_UNKNOWN)
+      return;
 
-   return 0;
-}
+   size_t nbytes = sizeof *atom + census_payload_nbytes (atom);
+   size_t origin = atom->origin <= g_census_norigins ? atom->origin : 0;
 
-static int a_cmp_fptr (const atom_t *lhs, const atom_t *rhs)
-{
-   return lhs->data - rhs->data;
+   g_census_types[atom->type].natoms++;
+   g_census_types[atom->type].nbytes += nbytes;
+   g_census_origins[origin].natoms++;
+   g_census_origins[origin].nbytes += nbytes;
 }
 
-static int a_cmp_buffer (const atom_t *lhs, const atom_t *rhs)
+bool atom_census_print (pool_t *pool, arena_t *arena, FILE *outf)
 {
-   size_t nblhs = *(size_t *)lhs->data,
-          nbrhs = *(size_t *)rhs->data;
+   bool error = true;
 
-   size_t nbytes = nblhs < nbrhs ? nblhs : nbrhs;
+   if (!outf)
+      outf = stdout;
 
-   return memcmp (lhs->data, rhs->data, nbytes);
-}
+   TABLE_LOCK (g_origin_lock);
+   g_census_norigins = g_norigins;
+   TABLE_UNLOCK (g_origin_lock);
 
-typedef struct atom_dispatch_t atom_dispatch_t;
-struct atom_dispatch_t {
-   enum atom_type_t  type;
-   atom_newfunc_t   *new_fptr;
-   atom_delfunc_t   *del_fptr;
-   atom_prnfunc_t   *prn_fptr;
-   atom_dupfunc_t   *dup_fptr;
-   atom_cmpfunc_t   *cmp_fptr;
-};
+   memset (g_census_types, 0, sizeof g_census_types);
+   if (!(g_census_origins = mem_calloc (g_census_norigins + 1,
+                                        sizeof *g_census_origins)))
+      goto errorexit;
 
-static const atom_dispatch_t *atom_find_funcs (enum atom_type_t type)
-{
-   static const atom_dispatch_t funcs[] = {
-{ atom_NIL,    a_new_list,   a_del_list,    a_pr_list,   a_dup_list,   a_cmp_list   },
-{ atom_LIST,   a_new_list,   a_del_list,    a_pr_list,   a_dup_list,   a_cmp_list   },
-{ atom_QUOTE,  a_new_string, a_del_nonlist, a_pr_quote,  a_dup_string, a_cmp_string },
-{ atom_STRING, a_new_string, a_del_nonlist, a_pr_string, a_dup_string, a_cmp_string },
-{ atom_SYMBOL, a_new_string, a_del_nonlist, a_pr_symbol, a_dup_string, a_cmp_string },
-{ atom_INT,    a_new_int,    a_del_nonlist, a_pr_int,    a_dup_int,    a_cmp_int    },
-{ atom_FLOAT,  a_new_float,  a_del_nonlist, a_pr_float,  a_dup_float,  a_cmp_float  },
-{ atom_FFI,    a_new_fptr,   NULL,          a_pr_ffi,    a_dup_fptr,   a_cmp_fptr   },
-{ atom_BUFFER, a_new_buffer, a_del_nonlist, a_pr_buffer, a_dup_buffer, a_cmp_buffer },
-{ atom_NATIVE, a_new_fptr,   NULL,          a_pr_native, a_dup_fptr,   a_cmp_fptr   },
-{ atom_UNKNOWN, NULL,        NULL,          NULL,        NULL,         NULL         },
-   };
+   if (pool && !pool_iterate_kind (pool, sizeof (atom_t), POOL_KIND_ATOM,
+                                   census_count))
+      goto errorexit;
+
+   arena_iterate (arena, census_count);
 
-   for (size_t i=0; i<sizeof funcs/sizeof funcs[0]; i++) {
-      if (funcs[i].type == type)
-         return &funcs[i];
+   census_row_t total = { 0, 0 };
+   for (size_t i=0; i<atom_ENDL; i++) {
+      total.natoms += g_census_types[i].natoms;
+      total.nbytes += g_census_types[i].nbytes;
    }
 
-   return NULL;
-}
+   fprintf (outf, "CENSUS: %zu live atoms, %zu bytes\n", total.natoms,
+                                                         total.nbytes);
 
-void atom_del (atom_t *atom)
-{
-   if (!atom)
-      return;
+   for (size_t i=0; i<atom_ENDL; i++) {
+      if (g_census_types[i].natoms) {
+         fprintf (outf, "   type   %-24s %8zu atoms %10zu bytes\n",
+                        g_type_names[i], g_census_types[i].natoms,
+                        g_census_types[i].nbytes);
+      }
+   }
 
-   const atom_dispatch_t *funcs = atom_find_funcs (atom->type);
-   if (funcs && funcs->del_fptr) {
-      funcs->del_fptr (atom);
+   TABLE_LOCK (g_origin_lock);
+   for (size_t i=0; i<=g_census_norigins; i++) {
+      if (g_census_origins[i].natoms) {
+         fprintf (outf, "   origin %-24s %8zu atoms %10zu bytes\n",
+                        i ? g_origin_names[i - 1] : "(unknown)",
+                        g_census_origins[i].natoms,
+                        g_census_origins[i].nbytes);
+      }
    }
+   TABLE_UNLOCK (g_origin_lock);
+
+   error = false;
 
-   free (atom);
+errorexit:
+
+   mem_free (g_census_origins);
+   g_census_origins = NULL;
+
+   return !error;
 }
 
 atom_t *atom_new (enum atom_type_t type, const char *string)
 {
    bool error = true;
-   const atom_dispatch_t *funcs = atom_find_funcs (type);
+   const atom_dispatch_t *funcs = NULL;
    atom_t *ret = NULL;
 
-   if (!(ret = calloc (1, sizeof *ret)))
+   // Parsed atoms get their source position written into them, so only
+   // string-less nil can be shared.
+   if (type==atom_NIL && !string)
+      return &g_nil;
+
+   funcs = atom_find_funcs (type);
+
+   if (!(ret = atom_alloc ()))
       goto errorexit;
 
    if (funcs && funcs->new_fptr) {
@@ -458,7 +2103,7 @@ errorexit:
    return ret;
 }
 
-atom_t *atom_dup (const atom_t *atom)
+atom_t *atom_dup_generic (const atom_t *atom)
 {
    bool error = true;
    atom_t *ret = NULL;
@@ -466,15 +2111,23 @@ atom_t *atom_dup (const atom_t *atom)
    if (!atom)
       return NULL;
 
+   if (atom->flags==0) {
+      if (atom->type==atom_NIL)
+         return &g_nil;
+
+      if (atom->type==atom_INT && (ret = smallint_find (atom->ival)))
+         return ret;
+   }
+
    const atom_dispatch_t *funcs = atom_find_funcs (atom->type);
 
    if (!funcs)
       return NULL;
 
-   if (!(ret = calloc (1, sizeof *ret)))
+   if (!(ret = atom_alloc ()))
       goto errorexit;
 
-   memcpy (ret->buffer, atom->buffer, sizeof ret->buffer);
+   ret->srcloc = atom_srcloc_dup (atom->srcloc);
    if (funcs->dup_fptr && !(funcs->dup_fptr (ret, atom)))
       goto errorexit;
 
@@ -493,30 +2146,68 @@ errorexit:
    return ret;
 }
 
-atom_t *atom_concatenate (const atom_t *a, ...)
+atom_t *atom_dup_flagged (const atom_t *atom, uint8_t flags)
 {
-   bool error = true;
-   atom_t *ret = NULL;
-   va_list ap;
+   atom_t *ret = atom_dup (atom);
 
+   // Singletons are shared, so one that is flagged gets a node of its own
+   if (ret && ret->storage==ATOM_STORAGE_STATIC && flags) {
+      atom_t *tmp = atom_alloc ();
+      if (!tmp)
+         return NULL;
 
-   va_start (ap, a);
+      tmp->type = ret->type;
+      tmp->ival = ret->ival;
+      ret = tmp;
+   }
+
+   if (ret && ret->storage!=ATOM_STORAGE_STATIC)
+      ret->flags = flags;
+
+   return ret;
+}
+
+atom_t *atom_concatenate_a (const atom_t **atoms)
+{
+   bool error = true;
+   atom_t *ret = NULL;
+   size_t total = 0;
+   bool copy = false;
 
    if (!(ret = atom_list_new ()))
       goto errorexit;
 
-   while (a) {
+   for (size_t i=0; atoms && atoms[i]; i++) {
+      if (atoms[i]->type!=atom_LIST)
+         continue;
+
+      total += list_length (LIST (atoms[i]));
+      copy = copy || (LIST (atoms[i])->arena && !g_arena);
+   }
+
+   // Small results are cheaper to copy than to keep their sources alive
+   copy = copy || total <= LIST_NINLINE;
+
+   for (size_t i=0; atoms && atoms[i]; i++) {
+      if (atoms[i]->type!=atom_LIST)
+         continue;
+
+      atom_list_t *src = LIST (atoms[i]);
+      size_t len = list_length (src);
 
-      size_t len = atom_list_length (a);
+      if (!copy) {
+         if (!view_add (LIST (ret), src, 0, len))
+            goto errorexit;
+         continue;
+      }
 
-      for (size_t i=0; i<len; i++) {
-         atom_t *tmp = atom_dup (atom_list_index (a, i));
+      for (size_t j=0; j<len; j++) {
+         atom_t *tmp = atom_dup (list_index (src, j));
          if (!(atom_list_ins_tail (ret, tmp))) {
+            atom_del (tmp);
             goto errorexit;
          }
       }
-
-      a = va_arg (ap, const atom_t *);
    }
 
    error = false;
@@ -528,8 +2219,71 @@ errorexit:
       ret = NULL;
    }
 
+   return ret;
+}
+
+atom_t *atom_concatenate (const atom_t *a, ...)
+{
+   atom_t *ret = NULL;
+   const atom_t **atoms = NULL;
+   size_t natoms = 0;
+   va_list ap;
+
+   va_start (ap, a);
+   for (const atom_t *tmp = a; tmp; tmp = va_arg (ap, const atom_t *))
+      natoms++;
+   va_end (ap);
+
+   if (!(atoms = mem_malloc (sizeof *atoms * (natoms + 1))))
+      return NULL;
+
+   va_start (ap, a);
+   for (size_t i=0; i<natoms; i++)
+      atoms[i] = i ? va_arg (ap, const atom_t *) : a;
+   atoms[natoms] = NULL;
    va_end (ap);
 
+   ret = atom_concatenate_a (atoms);
+
+   mem_free (atoms);
+
+   return ret;
+}
+
+atom_t *atom_list_slice (const atom_t *atom, size_t from, size_t to)
+{
+   if (!atom || atom->type!=atom_LIST)
+      return NULL;
+
+   atom_list_t *src = LIST (atom);
+   size_t len = list_length (src);
+
+   if (to > len)
+      to = len;
+   if (from > to)
+      from = to;
+
+   atom_t *ret = atom_list_new ();
+   if (!ret)
+      return NULL;
+
+   if (to - from > LIST_NINLINE && !(src->arena && !g_arena)) {
+      if (!view_add (LIST (ret), src, from, to)) {
+         atom_del (ret);
+         return NULL;
+      }
+      return ret;
+   }
+
+   for (size_t i=from; i<to; i++) {
+      atom_t *tmp = atom_dup (list_index (src, i));
+      if (!(atom_list_ins_tail (ret, tmp))) {
+         atom_del (tmp);
+         atom_del (ret);
+         return NULL;
+      }
+   }
+
    return ret;
 }
 
@@ -601,13 +2355,16 @@ void atom_print (const atom_t *atom, size_t depth, FILE *outf)
 
    if (funcs && funcs->prn_fptr) {
 #if 0 // This is irritating, taking it out for now
-      if (atom->buffer[0]) {
-         fprintf (outf, "[%s ", atom->buffer);
+      const char *fname;
+      size_t line, charpos;
+      bool has_loc = atom_srcloc (atom, &fname, &line, &charpos);
+      if (has_loc) {
+         fprintf (outf, "[%s:%zu:%zu ", fname, line, charpos);
       }
 #endif
       funcs->prn_fptr (atom, depth, outf);
 #if 0 // This is irritating, taking it out for now
-      if (atom->buffer[0]) {
+      if (has_loc) {
          fprintf (outf, "] ");
       }
 #endif
@@ -621,8 +2378,8 @@ int atom_fltint_cmp (const atom_t *lhs, const atom_t *rhs)
 {
    if (lhs->type == atom_INT) {
 
-      int64_t ilhs = *(int64_t *)lhs->data;
-      double drhs = *(double *)rhs->data;
+      int64_t ilhs = lhs->ival;
+      double drhs = rhs->fval;
 
       if (ilhs < drhs)  return -1;
       if (ilhs > drhs)  return 1;
@@ -630,8 +2387,8 @@ int atom_fltint_cmp (const atom_t *lhs, const atom_t *rhs)
 
    } else {
 
-      double dlhs = *(double *)lhs->data;
-      int64_t irhs = *(int64_t *)rhs->data;
+      double dlhs = lhs->fval;
+      int64_t irhs = rhs->ival;
 
       if (dlhs < irhs)  return -1;
       if (dlhs > irhs)  return 1;
@@ -642,7 +2399,7 @@ int atom_fltint_cmp (const atom_t *lhs, const atom_t *rhs)
    return -1;
 }
 
-int atom_cmp (const atom_t *lhs, const atom_t *rhs)
+int atom_cmp_generic (const atom_t *lhs, const atom_t *rhs)
 {
    if ( (lhs->type == atom_INT && rhs->type == atom_FLOAT) ||
         (lhs->type == atom_FLOAT && rhs->type ==atom_INT)) {
@@ -654,7 +2411,7 @@ int atom_cmp (const atom_t *lhs, const atom_t *rhs)
 
    int ret = -1;
 
-   if (func_lhs != func_rhs)
+   if (!func_lhs || func_lhs != func_rhs)
       return -1;
 
    if (func_lhs->cmp_fptr) {
@@ -669,8 +2426,7 @@ size_t atom_list_length (const atom_t *atom)
    if (atom->type!=atom_LIST)
       return 0;
 
-   void **tmp = atom->data;
-   return ll_length (tmp);
+   return list_length (LIST (atom));
 }
 
 const atom_t *atom_list_index (const atom_t *atom, size_t index)
@@ -679,41 +2435,107 @@ const atom_t *atom_list_index (const atom_t *atom, size_t index)
    if (atom->type!=atom_LIST)
       return NULL;
 
-   return ll_index (atom->data, index);
+   return list_index (LIST (atom), index);
+}
+
+bool atom_list_find_key (const atom_t *atom, const atom_t *key,
+                         size_t *index)
+{
+   if (!atom || !key || atom->type!=atom_LIST)
+      return false;
+
+   const atom_list_t *list = LIST (atom);
+   const char *name = atom_to_string (key);
+
+   // Numbers are never entries
+   if (list->nums || !name)
+      return false;
+
+   list_keys_t *keys = list_keys (list);
+
+   if (keys && !keys->nother) {
+      if (key->type!=atom_SYMBOL && !(name = atom_intern_find (name)))
+         return false;
+
+      list_key_t *slot = keys_slot (keys, INTERN_NAME (name)->id);
+      if (slot->id==ATOM_SYMBOL_NOID)
+         return false;
+
+      *index = slot->index;
+      return true;
+   }
+
+   size_t len = list_length (list);
+
+   for (size_t i=0; i<len; i++) {
+      const atom_t *entry = list_index (list, i);
+      const atom_t *n = entry->type==atom_LIST ?
+                           list_index (LIST (entry), 0) : NULL;
+      if (!n) {
+         continue;
+      } else if (key->type==atom_SYMBOL && n->type==atom_SYMBOL) {
+         if (n->data != key->data)
+            continue;
+      } else if (!atom_to_string (n) || strcmp (atom_to_string (n), name)!=0) {
+         continue;
+      }
+      *index = i;
+      return true;
+   }
+
+   return false;
 }
 
 atom_t *atom_list_remove (atom_t *atom, size_t index)
 {
-   if (atom->type!=atom_LIST)
+   if (atom->type!=atom_LIST || !list_unshare (atom))
       return NULL;
 
-   return ll_remove ((void ***)&atom->data, index);
+   return list_remove (LIST (atom), index);
 }
 
 atom_t *atom_list_ins_tail (atom_t *atom, void *el)
 {
-   if (atom->type!=atom_LIST)
+   if (atom->type!=atom_LIST || !list_unshare (atom))
       return NULL;
 
-   return ll_ins_tail ((void ***)&atom->data, el);
+   bool arena = atom_in_arena (el);
+   atom_t *ret = list_ins_tail (LIST (atom), el);
+   if (ret)
+      LIST (atom)->arena |= arena && ret==el;
+
+   return ret;
 }
 
 atom_t *atom_list_ins_head (atom_t *atom, void *el)
 {
-   if (atom->type!=atom_LIST)
+   if (atom->type!=atom_LIST || !list_unshare (atom))
       return NULL;
 
-   return ll_ins_head ((void ***)&atom->data, el);
+   bool arena = atom_in_arena (el);
+   atom_t *ret = list_ins_head (LIST (atom), el);
+   if (ret)
+      LIST (atom)->arena |= arena && ret==el;
+
+   return ret;
 }
 
 atom_t *atom_list_remove_tail (atom_t *atom)
 {
-   return ll_remove_tail ((void ***)&atom->data);
+   if (atom->type!=atom_LIST || !list_unshare (atom))
+      return NULL;
+
+   size_t len = list_length (LIST (atom));
+
+   return len ? list_remove (LIST (atom), len - 1) : NULL;
 }
 
 atom_t *atom_list_remove_head (atom_t *atom)
 {
-   return ll_remove_head ((void ***)&atom->data);
+   if (atom->type!=atom_LIST || !list_unshare (atom))
+      return NULL;
+
+   return list_remove (LIST (atom), 0);
 }
 
 atom_t *atom_string_new (const char *s)
@@ -721,6 +2543,21 @@ atom_t *atom_string_new (const char *s)
    return atom_new (atom_STRING, s);
 }
 
+atom_t *atom_string_new_len (const char *s, size_t len)
+{
+   atom_t *ret = atom_alloc ();
+   if (!ret)
+      return NULL;
+
+   if (!string_set (ret, s, len)) {
+      atom_del (ret);
+      return NULL;
+   }
+
+   ret->type = atom_STRING;
+   return ret;
+}
+
 atom_t *atom_symbol_new (const char *s)
 {
    return atom_new (atom_SYMBOL, s);
@@ -728,18 +2565,29 @@ atom_t *atom_symbol_new (const char *s)
 
 atom_t *atom_int_new (int64_t i)
 {
-   char tmps[18];
+   atom_t *ret = smallint_find (i);
+   if (ret)
+      return ret;
+
+   if (!(ret = atom_new (atom_UNKNOWN, NULL)))
+      return NULL;
 
-   sprintf (tmps, "%" PRIi64, i);
-   return atom_new (atom_INT, tmps);
+   ret->type = atom_INT;
+   ret->ival = i;
+
+   return ret;
 }
 
 atom_t *atom_float_new (double d)
 {
-   char tmps[18];
+   atom_t *ret = atom_new (atom_UNKNOWN, NULL);
+   if (!ret)
+      return NULL;
 
-   sprintf (tmps, "%5.5lf", d);
-   return atom_new (atom_FLOAT, tmps);
+   ret->type = atom_FLOAT;
+   ret->fval = d;
+
+   return ret;
 }
 
 atom_t *atom_buffer_new (void *buf, size_t len)
@@ -747,41 +2595,77 @@ atom_t *atom_buffer_new (void *buf, size_t len)
    if (len==0)
       return NULL;
 
-   atom_t *ret = malloc (sizeof *ret);
+   atom_t *ret = atom_alloc ();
    if (!ret)
       return NULL;
 
-   memset (ret, 0, sizeof *ret);
-
    ret->type = atom_BUFFER;
-   ret->data = malloc (len + sizeof len);
 
-   if (!ret->data) {
-      free (ret);
+   if (!(ret->data = buffer_new (buf, len))) {
+      atom_free_node (ret);
       return NULL;
    }
 
-   *(size_t *)ret->data = len;
-   uint8_t *b = ret->data;
-   b = &b[sizeof len];
+   return ret;
+}
+
+atom_t *atom_buffer_slice (const atom_t *atom, size_t from, size_t to)
+{
+   if (!atom || atom->type!=atom_BUFFER)
+      return NULL;
+
+   buffer_view_t *src = BUFFER (atom);
 
-   if (buf) {
-      memcpy (b, buf, len);
-   } else {
-      memset (b, 0, len);
+   if (to > src->length)
+      to = src->length;
+   if (from > to)
+      from = to;
+
+   atom_t *ret = atom_alloc ();
+   if (!ret)
+      return NULL;
+
+   src->store->refs++;
+   if (!(ret->data = view_new (src->store, src->offset + from, to - from))) {
+      store_del (src->store);
+      atom_free_node (ret);
+      return NULL;
    }
 
+   ret->type = atom_BUFFER;
+
    return ret;
 }
 
+size_t atom_buffer_length (const atom_t *atom)
+{
+   return atom && atom->type==atom_BUFFER ? BUFFER (atom)->length : 0;
+}
+
+const void *atom_buffer_data (const atom_t *atom)
+{
+   return atom && atom->type==atom_BUFFER ? buffer_bytes (BUFFER (atom)) : NULL;
+}
+
+// Writers get a view and store of their own, holding only the bytes
+// that the atom can see.
 void *atom_buffer_offset (atom_t *atom, size_t offs)
 {
-   if (!atom || atom->type!=atom_BUFFER)
+   if (!atom || atom->type!=atom_BUFFER || offs > BUFFER (atom)->length)
       return NULL;
 
-   uint8_t *b = atom->data;
-   b = &b[sizeof (size_t) + offs];
-   return b;
+   buffer_view_t *view = BUFFER (atom);
+
+   if (view->refs > 1 || view->store->refs > 1) {
+      buffer_view_t *tmp = buffer_new (buffer_bytes (view), view->length);
+      if (!tmp)
+         return NULL;
+
+      view_del (view);
+      atom->data = view = tmp;
+   }
+
+   return &view->store->bytes[view->offset + offs];
 }
 
 const char *atom_to_string (const atom_t *atom)
@@ -791,20 +2675,43 @@ const char *atom_to_string (const atom_t *atom)
    }
 
    if (atom->type==atom_STRING || atom->type==atom_SYMBOL) {
-      return (char *)atom->data;
+      return string_chars (atom);
    }
 
-   memset ((char *)atom->buffer, 0, sizeof atom->buffer);
+   // Numbers are formatted into a small ring of buffers, so the result
+   // is only valid until a few more numbers have been converted.
+   static char buffers[8][48];
+   static size_t next = 0;
+
+   char *ret = buffers[next++ % (sizeof buffers / sizeof buffers[0])];
+   ret[0] = 0;
 
    if (atom->type==atom_INT) {
-      sprintf ((char *)atom->buffer, "%" PRIi64, *(int64_t *)atom->data);
+      snprintf (ret, sizeof buffers[0], "%" PRIi64, atom->ival);
    }
 
-   if (atom->type==atom_INT) {
-      sprintf ((char *)atom->buffer, "%.5lf", *(double *)atom->data);
+   if (atom->type==atom_FLOAT) {
+      snprintf (ret, sizeof buffers[0], "%.5lf", atom->fval);
    }
 
-   return atom->buffer;
+   return ret;
+}
+
+size_t atom_string_length (const atom_t *atom)
+{
+   switch (atom->type) {
+      case atom_QUOTE:
+      case atom_STRING:
+         if (atom->slen)
+            return atom->slen - 1;
+         return atom->data ? STRING_HDR (atom->data)->length : 0;
+
+      case atom_SYMBOL:
+         return atom->data ? INTERN_NAME (atom->data)->length : 0;
+
+      default:
+         return 0;
+   }
 }
 
 atom_t **atom_array_dup (const atom_t **atoms)
@@ -819,7 +2726,7 @@ atom_t **atom_array_dup (const atom_t **atoms)
    for (size_t i=0; atoms[i]; i++)
       natoms++;
 
-   ret = malloc (sizeof *ret * (natoms + 1));
+   ret = mem_malloc (sizeof *ret * (natoms + 1));
    if (!ret)
       goto errorexit;
    memset (ret, 0, sizeof *ret * (natoms + 1));
@@ -848,6 +2755,6 @@ void atom_array_del (atom_t **atoms)
       atom_del (atoms[i]);
    }
 
-   free (atoms);
+   mem_free (atoms);
 }
 
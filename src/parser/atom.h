@@ -4,61 +4,190 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "pool/pool.h"
 
 #define ATOM_FLAG_FUNC        (1 << 0)
 #define ATOM_FLAG_QUOTE       (1 << 1)
 #define ATOM_FLAG_FFI         (1 << 2)
 
+// Every atom type, in enum order, with the functions in atom.c that
+// create, delete, print, duplicate and compare it. The enum and the
+// dispatch table are both generated from this list.
+#define ATOM_TYPES(X) \
+   X (UNKNOWN, NULL,         NULL,          NULL,        NULL,         NULL         ) \
+   X (NIL,     NULL,         NULL,          a_pr_list,   NULL,         a_cmp_list   ) \
+   X (LIST,    a_new_list,   a_del_list,    a_pr_list,   a_dup_list,   a_cmp_list   ) \
+   X (QUOTE,   a_new_string, a_del_string,  a_pr_quote,  a_dup_string, a_cmp_string ) \
+   X (STRING,  a_new_string, a_del_string,  a_pr_string, a_dup_string, a_cmp_string ) \
+   X (SYMBOL,  a_new_symbol, NULL,          a_pr_symbol, a_dup_fptr,   a_cmp_symbol ) \
+   X (INT,     a_new_int,    NULL,          a_pr_int,    a_dup_int,    a_cmp_int    ) \
+   X (FLOAT,   a_new_float,  NULL,          a_pr_float,  a_dup_float,  a_cmp_float  ) \
+   X (NATIVE,  a_new_fptr,   NULL,          a_pr_native, a_dup_fptr,   a_cmp_fptr   ) \
+   X (FFI,     a_new_fptr,   NULL,          a_pr_ffi,    a_dup_fptr,   a_cmp_fptr   ) \
+   X (BUFFER,  a_new_buffer, a_del_buffer,  a_pr_buffer, a_dup_buffer, a_cmp_buffer )
+
+#define ATOM_ENUM(type, ...)     atom_##type,
+
 enum atom_type_t {
-   atom_UNKNOWN = 0,
-   atom_NIL,
-   atom_LIST,
-   atom_QUOTE,
-   atom_STRING,
-   atom_SYMBOL,
-   atom_INT,
-   atom_FLOAT,
-   atom_NATIVE,
-   atom_FFI,
-   atom_BUFFER,
+   ATOM_TYPES (ATOM_ENUM)
    atom_ENDL
 };
 
+#undef ATOM_ENUM
+
+// How the atom_t node itself was obtained. Static atoms are shared
+// singletons that must never be freed or modified.
+#define ATOM_STORAGE_HEAP        (0)
+#define ATOM_STORAGE_STATIC      (1)
+#define ATOM_STORAGE_POOL        (2)
+#define ATOM_STORAGE_ARENA       (3)
+
+#define ATOM_SYMBOL_NOID      (UINT32_MAX)
+
+// Strings and quotes of up to this many bytes are kept in the node
+#define ATOM_SSO_MAX          (7)
+
 typedef struct atom_t atom_t;
 struct atom_t {
    // Tells us what type of data we are dealing with
    enum atom_type_t type;
 
-   // We could use a union here (getting strong type guarantees) but it
-   // means more onerous dispatching for functions on that data. This way
-   // we have to cast, but at least we can keep the functions to call in a
-   // lookup table.
-   void *data;
+   // Index of the source position of a parsed atom, 0 if it has none.
+   uint32_t srcloc;
+
+   // Scalars are stored inline so that numeric values never need a
+   // separate payload allocation, and so are short strings and quotes,
+   // which must therefore be read with atom_to_string(). All other types
+   // keep their payload behind 'data' and we cast, so that the functions
+   // to call can still be kept in a lookup table.
+   union {
+      void    *data;
+      int64_t  ival;     // atom_INT
+      double   fval;     // atom_FLOAT
+      char     sso[ATOM_SSO_MAX + 1];
+   };
 
    // Reserved for internal use, do not access
-   char buffer[48];
    uint8_t flags;
+   uint8_t storage;
+   uint8_t gcbits;
+   uint8_t slen;        // Length plus one of a string kept in sso
+   uint16_t origin;
 };
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-   void atom_del (atom_t *atom);
+   // Atoms created on this thread after this call have their nodes
+   // allocated from the given pool (NULL for the heap). Returns the
+   // previously used pool. Each thread has its own current pool, arena
+   // and census origin, but a pool, an arena and the atoms allocated from
+   // them must only be used by one thread at a time. Everything else in
+   // this module (interned names, source positions and census origins)
+   // is shared by all threads and may be used from any of them.
+   pool_t *atom_set_pool (pool_t *pool);
+
+   // While an arena is set, atom nodes come from the arena instead and
+   // atom_del() only releases their payload. Such atoms must not be
+   // stored anywhere that outlives the next atom_arena_reset(), which
+   // deletes whatever is still live in the arena and then resets it.
+   // Returns the previously used arena.
+   arena_t *atom_set_arena (arena_t *arena);
+   void atom_arena_reset (arena_t *arena);
+   bool atom_in_arena (const atom_t *atom);
+
+   // Moves an arena atom (and its children) to long-lived storage; the
+   // original is deleted. Any other atom is returned unchanged.
+   atom_t *atom_promote (atom_t *atom);
+
+   // Atoms whose nodes came from a pool are kept alive by their owners
+   // as usual, but those that were dropped without being deleted can be
+   // found and deleted by atom_gc_collect(). Every pool atom that is not
+   // an item of some list, not in the NULL-terminated roots, and was not
+   // handed to atom_gc_extern() is considered unreachable, until it is
+   // handed to atom_gc_release(). Returns the number of atoms deleted
+   // (not counting their children), or -1 if out of memory, in which case
+   // nothing was deleted.
+   void atom_gc_extern (atom_t *atom);
+   void atom_gc_release (atom_t *atom);
+   int64_t atom_gc_collect (pool_t *pool, const atom_t **roots);
+
+   // The census counts the live atoms of a pool and an arena (either may
+   // be NULL), with the bytes of their nodes and payloads, by type and by
+   // origin. Every new atom is tagged with the origin current when it is
+   // created; origins are registered by name and numbered from 1, with 0
+   // standing for an unknown origin. Returns false if out of memory.
+   uint16_t atom_census_origin (const char *name);
+   uint16_t atom_census_set_origin (uint16_t origin);
+   bool atom_census_print (pool_t *pool, arena_t *arena, FILE *outf);
+
+   // Returns the single copy of name shared by all symbols of that
+   // name; atom_intern_find() returns NULL if no such symbol was ever
+   // created. Symbols are equal if their data pointers are equal.
+   const char *atom_intern (const char *name);
+   const char *atom_intern_find (const char *name);
+   uint32_t atom_symbol_id (const atom_t *atom);
+
+   // Source positions are kept in a side table and only turned into
+   // text when someone asks. atom_srcloc() returns false for atoms that
+   // were not parsed from source.
+   //
+   // Each index returned by atom_srcloc_add() or atom_srcloc_dup() is a
+   // reference that the atom holding it gives back with atom_srcloc_del()
+   // when its node is freed. atom_srcloc_count() is the number of
+   // positions still referenced.
+   uint32_t atom_srcloc_add (const char *fname, size_t line, size_t charpos);
+   uint32_t atom_srcloc_dup (uint32_t srcloc);
+   void atom_srcloc_del (uint32_t srcloc);
+   size_t atom_srcloc_count (void);
+   bool atom_srcloc (const atom_t *atom, const char **fname,
+                                         size_t *line, size_t *charpos);
+
+   // Positions added in fname while a group of fname is set on the same
+   // thread belong to it, and atom_srcloc_move() moves all of them by a
+   // number of lines at once. Group 0 is no group. The owner of a group gives it back with
+   // atom_srcloc_group_del(); it is reused once its positions are gone
+   // too. atom_srcloc_group_count() is the number of groups in use.
+   uint32_t atom_srcloc_group (const char *fname);
+   void atom_srcloc_group_del (uint32_t group);
+   size_t atom_srcloc_group_count (void);
+   uint32_t atom_srcloc_set_group (uint32_t group);
+   void atom_srcloc_move (uint32_t group, int64_t lines);
+
+   // Out-of-line halves of atom_del(), atom_dup() and atom_cmp() below,
+   // which handle scalars inline and leave everything else to these.
+   void atom_del_generic (atom_t *atom);
+   atom_t *atom_dup_generic (const atom_t *atom);
+   int atom_cmp_generic (const atom_t *lhs, const atom_t *rhs);
+   void atom_free_node (atom_t *atom);
 
    // These functions all return an atom that must be deleted by the
    // caller.
    atom_t *atom_new (enum atom_type_t type, const char *string);
-   atom_t *atom_dup (const atom_t *atom);
+   // A copy of atom with its flags replaced, which is never a singleton
+   // unless flags is 0. Flags must only ever be set on such a copy.
+   atom_t *atom_dup_flagged (const atom_t *atom, uint8_t flags);
+   // Lists built by these share the items of their sources where that
+   // is cheaper than copying them; this is not visible to the caller.
    atom_t *atom_concatenate (const atom_t *a, ...);
+   atom_t *atom_concatenate_a (const atom_t **atoms);
+   atom_t *atom_list_slice (const atom_t *atom, size_t from, size_t to);
    atom_t *atom_list_new (void);
    atom_t *atom_list_pair (const atom_t *lnames, const atom_t *lvalues);
 
    void atom_print (const atom_t *atom, size_t depth, FILE *outf);
-   int atom_cmp (const atom_t *lhs, const atom_t *rhs);
 
    size_t atom_list_length (const atom_t *atom);
    const atom_t *atom_list_index (const atom_t *atom, size_t index);
+   // Finds the first entry, a list, whose first item has the name of key.
+   // Symbols are matched by their interned ID, through an index that the
+   // list keeps once it is long enough, so that lookups in symbol tables
+   // do not have to compare every entry.
+   bool atom_list_find_key (const atom_t *atom, const atom_t *key,
+                            size_t *index);
    atom_t *atom_list_remove (atom_t *atom, size_t index);
    atom_t *atom_list_ins_tail (atom_t *atom, void *el);
    atom_t *atom_list_ins_head (atom_t *atom, void *el);
@@ -66,22 +195,83 @@ extern "C" {
    atom_t *atom_list_remove_head (atom_t *atom);
 
    atom_t *atom_string_new (const char *s);
+   // Takes len bytes of s, unquoted, which need not be terminated.
+   atom_t *atom_string_new_len (const char *s, size_t len);
    atom_t *atom_symbol_new (const char *s);
    atom_t *atom_int_new (int64_t i);
    atom_t *atom_float_new (double d);
    atom_t *atom_buffer_new (void *buf, size_t len);
+   // Shares the bytes of the original; [from, to) is clipped to it.
+   atom_t *atom_buffer_slice (const atom_t *atom, size_t from, size_t to);
+   size_t atom_buffer_length (const atom_t *atom);
+   const void *atom_buffer_data (const atom_t *atom);
 
+   // Returns a writable pointer, copying the bytes first if they are
+   // shared with any other atom.
    void *atom_buffer_offset (atom_t *atom, size_t offs);
 
+   // Strings and quotes carry their length, so atom_string_length() never
+   // has to scan them; it also works for symbols and returns 0 for any
+   // other type.
    const char *atom_to_string (const atom_t *atom);
+   size_t atom_string_length (const atom_t *atom);
 
    atom_t **atom_array_dup (const atom_t **atoms);
    void atom_array_del (atom_t **atoms);
 
+   const char *atom_type_name (enum atom_type_t type);
+
 #ifdef __cplusplus
 }
 #endif
 
+static inline void atom_del (atom_t *atom)
+{
+   if (!atom || atom->storage==ATOM_STORAGE_STATIC)
+      return;
+
+   if (atom->type==atom_INT || atom->type==atom_FLOAT) {
+      atom_free_node (atom);
+   } else {
+      atom_del_generic (atom);
+   }
+}
+
+// These functions all return an atom that must be deleted by the caller.
+static inline atom_t *atom_dup (const atom_t *atom)
+{
+   atom_t *ret = NULL;
+
+   if (!atom || atom->flags)
+      return atom_dup_generic (atom);
+
+   switch (atom->type) {
+      case atom_NIL:    return atom_new (atom_NIL, NULL);
+      case atom_INT:    ret = atom_int_new (atom->ival);      break;
+      case atom_FLOAT:  ret = atom_float_new (atom->fval);    break;
+      default:          return atom_dup_generic (atom);
+   }
+
+   if (ret && ret->storage!=ATOM_STORAGE_STATIC && atom->srcloc)
+      ret->srcloc = atom_srcloc_dup (atom->srcloc);
+
+   return ret;
+}
+
+static inline int atom_cmp (const atom_t *lhs, const atom_t *rhs)
+{
+   if (lhs->type==atom_INT && rhs->type==atom_INT)
+      return (lhs->ival > rhs->ival) - (lhs->ival < rhs->ival);
+
+   if (lhs->type==atom_FLOAT && rhs->type==atom_FLOAT)
+      return (lhs->fval > rhs->fval) - (lhs->fval < rhs->fval);
+
+   if (lhs->type==atom_NIL && rhs->type==atom_NIL)
+      return 0;
+
+   return atom_cmp_generic (lhs, rhs);
+}
+
 
 #endif
 
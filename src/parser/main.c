@@ -2,6 +2,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
 
 #include "parser/parser.h"
 
@@ -10,6 +13,559 @@
 
 #define TESTFILE     ("token/test_input.csl")
 
+#define BENCH_ITERATIONS   (2000000)
+
+#define KEYED_ENTRIES      (100)
+#define KEYED_NAMES        (90)
+
+// Times a dup/cmp/del round trip on atoms of each type. Scalars should
+// be much cheaper than the list, which still goes through the table.
+static bool benchmark (void)
+{
+   bool error = true;
+   pool_t *pool = pool_new ();
+   pool_t *prev_pool = atom_set_pool (pool);
+
+   struct {
+      const char *name;
+      atom_t *atom;
+   } values[] = {
+      { "small int",    atom_int_new (7)           },
+      { "large int",    atom_int_new (1000000)     },
+      { "float",        atom_float_new (2.5)       },
+      { "nil",          atom_new (atom_NIL, NULL)  },
+      { "list",         atom_list_new ()           },
+   };
+
+   for (size_t i=0; i<sizeof values/sizeof values[0]; i++) {
+      if (!values[i].atom)
+         goto errorexit;
+   }
+
+   printf ("\n");
+   for (size_t i=0; i<sizeof values/sizeof values[0]; i++) {
+      clock_t start = clock ();
+
+      for (size_t j=0; j<BENCH_ITERATIONS; j++) {
+         atom_t *tmp = atom_dup (values[i].atom);
+         if (!tmp || atom_cmp (tmp, values[i].atom)) {
+            XERROR ("Duplicate of %s differs\n", values[i].name);
+            atom_del (tmp);
+            goto errorexit;
+         }
+         atom_del (tmp);
+      }
+
+      double nsecs = (double)(clock () - start) * 1e9 / CLOCKS_PER_SEC;
+      printf ("BENCHMARK %-10s dup+cmp+del: %6.1f ns\n", values[i].name,
+               nsecs / BENCH_ITERATIONS);
+   }
+
+   error = false;
+
+errorexit:
+   for (size_t i=0; i<sizeof values/sizeof values[0]; i++) {
+      atom_del (values[i].atom);
+   }
+   atom_set_pool (prev_pool);
+   pool_del (pool);
+
+   return !error;
+}
+
+#define BENCH_ROWS         (20000)
+
+// Numbers read by the lexer must have the values the parser used to read
+// from their text: floats as strtod() reads them, integers as "%i" does.
+static bool numbers (void)
+{
+   static const struct {
+      const char *text;
+      enum atom_type_t type;
+      int64_t ival;
+   } values[] = {
+      { "0",                     atom_INT,   0                 },
+      { "7",                     atom_INT,   7                 },
+      { "010",                   atom_INT,   8                 },
+      { "0x1F",                  atom_INT,   31                },
+      { "0Xff",                  atom_INT,   255               },
+      { "9223372036854775807",   atom_INT,   INT64_MAX         },
+      { "12abc",                 atom_INT,   12                },
+      { "2.5",                   atom_FLOAT, 0                 },
+      { "1e3",                   atom_FLOAT, 0                 },
+      { "1.5E2",                 atom_FLOAT, 0                 },
+      { "0.1",                   atom_FLOAT, 0                 },
+      { "3.14159265358979",      atom_FLOAT, 0                 },
+      { "1.7976931348623157e308", atom_FLOAT, 0                },
+      { "1e400",                 atom_FLOAT, 0                 },
+      { "123456789012345678901234.5", atom_FLOAT, 0            },
+   };
+   size_t nvalues = sizeof values / sizeof values[0];
+
+   char text[512] = "(";
+   for (size_t i=0; i<nvalues; i++) {
+      strcat (text, " ");
+      strcat (text, values[i].text);
+   }
+   strcat (text, ")");
+
+   char *tmp = text;
+   token_t **tokens = token_read_string (&tmp, "numbers");
+   size_t index = 0;
+   atom_t *list = tokens ? parser_parse (tokens, &index) : NULL;
+
+   bool ok = list && atom_list_length (list) == nvalues;
+   if (!ok)
+      XERROR ("Unable to read [%s]\n", text);
+   for (size_t i=0; ok && i<nvalues; i++) {
+      const atom_t *atom = atom_list_index (list, i);
+      ok = atom->type == values[i].type &&
+           (atom->type == atom_INT ? atom->ival == values[i].ival
+                                   : atom->fval == strtod (values[i].text, NULL));
+      if (!ok)
+         XERROR ("[%s] was read wrongly\n", values[i].text);
+   }
+
+   printf ("Read %zu numbers\n", nvalues);
+
+   atom_del (list);
+   token_array_del (tokens);
+
+   return ok;
+}
+
+// Positions are given back when the last atom holding them goes, so
+// parsing the same text over and over needs no more of them
+static bool positions (void)
+{
+   size_t before = atom_srcloc_count ();
+   bool ok = true;
+
+   for (size_t i=0; ok && i<100; i++) {
+      char text[] = "(define (f x) (list x \"s\" (+ x 1.5))\n"
+                    "  (1001 1002 1003 1004 1005 1006 1007 1008))";
+      char *tmp = text;
+      token_t **tokens = token_read_string (&tmp, "positions");
+      size_t index = 0;
+      atom_t *form = tokens ? parser_parse (tokens, &index) : NULL;
+      token_array_del (tokens);
+
+      // Numbers moved in and out of a list keep their positions
+      size_t line = 0, charpos = 0, nline = 0, ncharpos = 0;
+      atom_t *nums = form ? atom_dup (atom_list_index (form, 3)) : NULL;
+      atom_srcloc (atom_list_index (nums, 0), NULL, &line, &charpos);
+      atom_t *copy = atom_dup (nums);
+      atom_t *first = atom_list_remove (copy, 0);
+      atom_t *keep = atom_dup (atom_list_index (form, 0));
+
+      atom_del (form);
+      atom_del (nums);
+
+      ok = first && atom_srcloc (first, NULL, &nline, &ncharpos) &&
+           nline == line && ncharpos == charpos && line == 2 &&
+           atom_srcloc (keep, NULL, NULL, NULL) &&
+           atom_srcloc_count () > before;
+
+      atom_del (first);
+      atom_del (copy);
+      atom_del (keep);
+
+      ok = ok && atom_srcloc_count () == before;
+   }
+
+   if (!ok)
+      XERROR ("Source positions were lost or never given back\n");
+
+   printf ("Positions held after 100 parses: %zu\n",
+           atom_srcloc_count () - before);
+
+   return ok;
+}
+
+// The collector deletes dropped atoms, but must leave alone any other
+// object of the same size in the pool
+static bool collect (void)
+{
+   pool_t *pool = pool_new ();
+   pool_t *prev_pool = atom_set_pool (pool);
+
+   atom_t *root = atom_new (atom_LIST, NULL);
+   atom_list_ins_tail (root, atom_string_new ("an item that stays alive"));
+   atom_string_new ("a dropped string that is collected");
+   void *other = pool_alloc (pool, sizeof (atom_t));
+
+   const atom_t *roots[] = { root, NULL };
+   int64_t ncollected = atom_gc_collect (pool, roots);
+   size_t nlive = pool_nlive (pool);
+   bool ok = other && ncollected == 1;
+
+   atom_del (root);
+   pool_free (other);
+   atom_set_pool (prev_pool);
+   pool_del (pool);
+
+   printf ("Collected %" PRIi64 " atoms, %zu objects left\n",
+           ncollected, nlive);
+
+   if (!ok) {
+      XERROR ("Collected other objects than the dropped atom\n");
+      return false;
+   }
+
+   return true;
+}
+
+#define STREAM_FORMS       (20000)
+#define STREAM_FORM_ATOMS  (11)
+
+// A long stream of forms, each deleted once read, must hold no more
+// source positions at any time than its largest form has atoms
+static bool streaming (void)
+{
+   size_t before = atom_srcloc_count ();
+   size_t nforms = 0, most = 0;
+
+   FILE *inf = tmpfile ();
+   bool ok = inf != NULL;
+   for (size_t i=0; ok && i<STREAM_FORMS; i++) {
+      ok = fprintf (inf, "(define v%zu (list %zu \"x\" (+ 1 2)))\n", i, i) > 0;
+   }
+   ok = ok && !fseek (inf, 0, SEEK_SET);
+
+   token_stream_t *ts = ok ? token_stream_new (inf, "streaming", 4096) : NULL;
+   atom_t *form;
+   while (ts && (form = parser_stream_next (ts))) {
+      size_t held = atom_srcloc_count () - before;
+      if (held > most)
+         most = held;
+      nforms++;
+      atom_del (form);
+   }
+
+   ok = ts && !token_stream_error (ts) && nforms == STREAM_FORMS &&
+        most == STREAM_FORM_ATOMS && atom_srcloc_count () == before;
+
+   token_stream_del (ts);
+   if (inf)
+      fclose (inf);
+
+   printf ("Streamed %zu forms, at most %zu positions held\n", nforms, most);
+
+   if (!ok)
+      XERROR ("Streaming %d forms held %zu positions\n", STREAM_FORMS, most);
+
+   return ok;
+}
+
+// Parses a generated table of numbers, five to a row
+static bool benchmark_numbers (void)
+{
+   bool error = true;
+   char *table = malloc (BENCH_ROWS * 64);
+   token_t **tokens = NULL;
+   if (!table)
+      return false;
+
+   char *tmp = table;
+   for (size_t i=0; i<BENCH_ROWS; i++) {
+      tmp += sprintf (tmp, "(row %zu %zu.%03zu %zue%zu 0x%zx %zu)\n",
+                      i, i, i % 1000, i % 90, i % 7, i, i * 7919);
+   }
+
+   clock_t start = clock ();
+
+   tmp = table;
+   if (!(tokens = token_read_string (&tmp, "table")))
+      goto errorexit;
+
+   size_t index = 0, nrows = 0;
+   atom_t *row;
+   while ((row = parser_parse (tokens, &index))) {
+      nrows += atom_list_length (row) == 6;
+      atom_del (row);
+   }
+
+   double nsecs = (double)(clock () - start) * 1e9 / CLOCKS_PER_SEC;
+   if (nrows != BENCH_ROWS) {
+      XERROR ("Parsed %zu of %i rows\n", nrows, BENCH_ROWS);
+      goto errorexit;
+   }
+
+   printf ("BENCHMARK read and parse, per number: %6.1f ns\n",
+            nsecs / (BENCH_ROWS * 5));
+
+   error = false;
+
+errorexit:
+   token_array_del (tokens);
+   free (table);
+
+   return !error;
+}
+
+#define SCRIPT_LINES       (50000)
+#define TREE_LINES         (5000)
+#define SCRIPT_NAME        ("incremental.csl")
+#define SCRIPT_EDITS       (20)
+#define SCRIPT_RELOADS     (5)
+
+// Types, values and positions must all be those of a full read
+static bool same_positions (const atom_t *lhs, const atom_t *rhs)
+{
+   size_t lline = 0, lcharpos = 0, rline = 0, rcharpos = 0;
+
+   if (!lhs || !rhs || lhs->type != rhs->type ||
+       (lhs->type != atom_LIST && atom_cmp (lhs, rhs)))
+      return false;
+
+   atom_srcloc (lhs, NULL, &lline, &lcharpos);
+   atom_srcloc (rhs, NULL, &rline, &rcharpos);
+   if (lline != rline || lcharpos != rcharpos ||
+       atom_list_length (lhs) != atom_list_length (rhs))
+      return false;
+
+   for (size_t i=0; i<atom_list_length (lhs); i++) {
+      if (!same_positions (atom_list_index (lhs, i),
+                           atom_list_index (rhs, i)))
+         return false;
+   }
+
+   return true;
+}
+
+static bool tree_matches (const parser_tree_t *tree, const char *source)
+{
+   char *tmp = (char *)source;
+   token_t **tokens = token_read_string (&tmp, SCRIPT_NAME);
+
+   size_t index = 0, nforms = 0;
+   bool ret = tokens != NULL;
+   while (ret && tokens[index]) {
+      atom_t *form = parser_parse (tokens, &index);
+      ret = same_positions (parser_tree_form (tree, nforms++), form);
+      atom_del (form);
+   }
+
+   token_array_del (tokens);
+
+   return ret && nforms == parser_tree_length (tree);
+}
+
+static size_t tree_nchanged (const parser_tree_t *tree)
+{
+   size_t ret = 0;
+   for (size_t i=0; i<parser_tree_length (tree); i++) {
+      ret += parser_tree_changed (tree, i);
+   }
+   return ret;
+}
+
+// Replaces the first match of what in the script with text
+static char *script_edit (char *script, const char *what, const char *text)
+{
+   char *at = strstr (script, what);
+   if (!at)
+      return script;
+
+   size_t nscript = strlen (script), nwhat = strlen (what),
+          ntext = strlen (text);
+   char *ret = malloc (nscript - nwhat + ntext + 1);
+   if (ret) {
+      memcpy (ret, script, at - script);
+      memcpy (&ret[at - script], text, ntext);
+      strcpy (&ret[at - script + ntext], &at[nwhat]);
+   }
+
+   free (script);
+   return ret;
+}
+
+static char *script_new (size_t nlines, size_t *nforms)
+{
+   char *ret = malloc (nlines * 64);
+   if (!ret)
+      return NULL;
+
+   char *tmp = ret;
+   *nforms = 0;
+   for (size_t line=0; line<nlines; (*nforms)++) {
+      if (*nforms % 10 == 0) {
+         tmp += sprintf (tmp, "; rule group %zu\n", *nforms / 10);
+         line++;
+      }
+      if (*nforms % 100 == 0) {
+         tmp += sprintf (tmp, "(doc r%zu \"first line\nsecond line\")\n",
+                         *nforms);
+         line += 2;
+         continue;
+      }
+      tmp += sprintf (tmp, "(rule r%zu (when (> x %zu) \"note\") 0x%zx %zu.5)\n",
+                      *nforms, *nforms, *nforms, *nforms % 1000);
+      line++;
+   }
+
+   return ret;
+}
+
+// After each edit the tree must read as the whole script does, with only
+// the forms the edit touched marked as changed
+static bool incremental (void)
+{
+   static const struct {
+      const char *what;
+      const char *text;
+      size_t nchanged;
+   } edits[] = {
+      { "",                "",                                       0 },
+      { "(> x 2511)",      "(> x 2512)",                             1 },
+      { "(rule r3011 ",    "(added\n  form)\n(rule r3011 ",          1 },
+      { "(rule r10 ",      "\n\n(rule r10 ",                          0 },
+      { "(rule r11 (when (> x 11) \"note\") 0xb 11.5)\n", "",        0 },
+      { "(rule r2011 ",    "((rule r2011 ",                   SIZE_MAX },
+      { "((rule r2011 ",   "(rule r2011 ",                    SIZE_MAX },
+      { "; rule group 0",  "(first) ; rule group 0",                 1 },
+      { "(doc r300 ",      "; (doc r300)\n(doc r300 ",                0 },
+      { "(rule r4011 ",    "(rule  r4011 ",                          0 },
+      { "(rule r4211 ",    "(x)\n(rule r4212 ",                      2 },
+   };
+   bool error = true;
+   size_t nforms = 0;
+   size_t ngroups = atom_srcloc_group_count (),
+          nlocs = atom_srcloc_count ();
+   char *script = script_new (TREE_LINES, &nforms);
+   parser_tree_t *tree = parser_tree_new (SCRIPT_NAME);
+   token_t **tokens = NULL;
+
+   if (!script || !tree)
+      goto errorexit;
+
+   if (!parser_tree_update (tree, script, strlen (script)) ||
+       parser_tree_length (tree) != nforms ||
+       tree_nchanged (tree) != nforms || !tree_matches (tree, script)) {
+      XERROR ("Tree of %zu forms was not read\n", nforms);
+      goto errorexit;
+   }
+
+   for (size_t i=0; i<sizeof edits / sizeof edits[0]; i++) {
+      if (!(script = script_edit (script, edits[i].what, edits[i].text)))
+         goto errorexit;
+
+      if (!parser_tree_update (tree, script, strlen (script)) ||
+          !tree_matches (tree, script) ||
+          (edits[i].nchanged != SIZE_MAX &&
+           tree_nchanged (tree) != edits[i].nchanged)) {
+         XERROR ("Edit %zu left %zu forms changed\n", i, tree_nchanged (tree));
+         goto errorexit;
+      }
+   }
+
+   // Reloads give back the groups and positions of the forms they
+   // replace, also when everything is read all over
+   size_t tree_groups = atom_srcloc_group_count (),
+          tree_locs = atom_srcloc_count ();
+   for (size_t i=0; i<SCRIPT_RELOADS; i++) {
+      static const char *reloads[][2] = {
+         { "(rule r2011 ",    "((rule r2011 " },
+         { "((rule r2011 ",   "(rule r2011 "  },
+         { "(> x 3511)",      "(> x 3512)"    },
+         { "(> x 3512)",      "(> x 3511)"    },
+      };
+      bool reloaded = true;
+      for (size_t e=0; reloaded && e<sizeof reloads / sizeof reloads[0]; e++) {
+         script = script_edit (script, reloads[e][0], reloads[e][1]);
+         reloaded = script && parser_tree_update (tree, script, strlen (script)) &&
+                    tree_nchanged (tree) > 0;
+      }
+      if (!reloaded || atom_srcloc_group_count () != tree_groups ||
+          atom_srcloc_count () != tree_locs) {
+         XERROR ("Reload %zu holds %zu groups and %zu positions, not %zu and %zu\n",
+                  i, atom_srcloc_group_count (), atom_srcloc_count (),
+                  tree_groups, tree_locs);
+         goto errorexit;
+      }
+   }
+
+   // Forms of a loaded file stay where they were loaded
+   static const char *loading =
+      "(a 1)\n#load \"token/test5_input.csl\"\n(b 2)\n(c 3)\n";
+   free (script);
+   if ((script = malloc (strlen (loading) + 1)))
+      strcpy (script, loading);
+   if (!script || !parser_tree_update (tree, script, strlen (script)) ||
+       !tree_matches (tree, script) || parser_tree_length (tree) != 4) {
+      XERROR ("Tree with a #load was not read\n");
+      goto errorexit;
+   }
+
+   script = script_edit (script, "(c 3)", "(c 4)");
+   bool loads = script && parser_tree_update (tree, script, strlen (script)) &&
+                tree_matches (tree, script) && tree_nchanged (tree) == 1 &&
+                parser_tree_changed (tree, 3);
+   script = loads ? script_edit (script, "test5", "test4") : script;
+   loads = loads && script &&
+           parser_tree_update (tree, script, strlen (script)) &&
+           tree_matches (tree, script);
+   if (!loads) {
+      XERROR ("Edits around a #load were not read\n");
+      goto errorexit;
+   }
+
+   printf ("Tree updated by %zu edits\n", sizeof edits / sizeof edits[0] + 3);
+
+   // A reload after an edit should cost what the edit does, not what the
+   // whole script does
+   parser_tree_del (tree);
+   free (script);
+   if (!(script = script_new (SCRIPT_LINES, &nforms)) ||
+       !(tree = parser_tree_new (SCRIPT_NAME)) ||
+       !parser_tree_update (tree, script, strlen (script)))
+      goto errorexit;
+
+   clock_t start = clock ();
+   char *tmp = script;
+   if (!(tokens = token_read_string (&tmp, SCRIPT_NAME)))
+      goto errorexit;
+   for (size_t index=0; tokens[index]; ) {
+      atom_del (parser_parse (tokens, &index));
+   }
+   double full = (double)(clock () - start) * 1e9 / CLOCKS_PER_SEC;
+
+   start = clock ();
+   for (size_t i=0; i<SCRIPT_EDITS; i++) {
+      char *at = strstr (script, "(> x 25011)");
+      at = at ? at : strstr (script, "(> x 25012)");
+      at[9] = at[9]=='1' ? '2' : '1';
+      if (!parser_tree_update (tree, script, strlen (script)) ||
+          tree_nchanged (tree) != 1) {
+         XERROR ("Update %zu changed %zu forms\n", i, tree_nchanged (tree));
+         goto errorexit;
+      }
+   }
+   double update = (double)(clock () - start) * 1e9 / CLOCKS_PER_SEC;
+
+   printf ("BENCHMARK read of %i lines, whole: %12.1f ns\n",
+            SCRIPT_LINES, full);
+   printf ("BENCHMARK read of %i lines, one form edited: %12.1f ns\n",
+            SCRIPT_LINES, update / SCRIPT_EDITS);
+
+   error = false;
+
+errorexit:
+   token_array_del (tokens);
+   parser_tree_del (tree);
+   free (script);
+
+   if (!error && (atom_srcloc_group_count () != ngroups ||
+                  atom_srcloc_count () != nlocs)) {
+      XERROR ("Deleted trees left %zu groups and %zu positions\n",
+               atom_srcloc_group_count () - ngroups,
+               atom_srcloc_count () - nlocs);
+      error = true;
+   }
+
+   return !error;
+}
+
 int main (void)
 {
    int ret = EXIT_FAILURE;
@@ -31,17 +587,270 @@ int main (void)
       atom_t *atom = parser_parse (tokens, &index);
       printf ("[%zu]: ", index);
       atom_print (atom, 0, stdout);
+
+      if (atom && !atom_srcloc (atom, NULL, NULL, NULL)) {
+         XERROR ("Parsed atom has no source position\n");
+         atom_del (atom);
+         goto errorexit;
+      }
+
+      // Writing to a duplicate must leave the original untouched
+      atom_t *copy = atom_dup (atom);
+      if (atom && atom->type==atom_LIST) {
+         size_t len = atom_list_length (atom);
+         atom_list_ins_tail (copy, atom_int_new (1000));
+         if (atom_list_length (atom)!=len ||
+             atom_list_length (copy)!=len + 1) {
+            XERROR ("Modified duplicate changed the original list\n");
+            atom_del (copy);
+            atom_del (atom);
+            goto errorexit;
+         }
+      }
+      atom_del (copy);
+
       atom_del (atom);
    }
 
+   // Symbols of the same name share the interned string and ID
+   atom_t *s1 = atom_symbol_new ("interned-symbol"),
+          *s2 = atom_symbol_new ("interned-symbol"),
+          *s3 = atom_symbol_new ("other-symbol");
+   bool interned = s1 && s2 && s3 &&
+                   s1->data == s2->data &&
+                   atom_symbol_id (s1) == atom_symbol_id (s2) &&
+                   atom_symbol_id (s1) != atom_symbol_id (s3) &&
+                   atom_cmp (s1, s2) == 0 && atom_cmp (s1, s3) != 0;
+   atom_del (s1);
+   atom_del (s2);
+   atom_del (s3);
+   if (!interned) {
+      XERROR ("Symbols were not interned\n");
+      goto errorexit;
+   }
+
+   // Entries are found by the ID of their key, the first of a name wins,
+   // and the index follows the list as it changes
+   atom_t *table = atom_list_new ();
+   bool keyed = table != NULL;
+   for (size_t i=0; keyed && i<KEYED_ENTRIES; i++) {
+      char name[32];
+      snprintf (name, sizeof name, "keyed-%zu", i % KEYED_NAMES);
+      atom_t *entry = atom_list_new ();
+      keyed = entry && atom_list_ins_tail (entry, atom_symbol_new (name)) &&
+              atom_list_ins_tail (entry, atom_int_new ((int64_t)i)) &&
+              atom_list_ins_tail (table, entry);
+   }
+   size_t found = 0;
+   atom_t *k7 = atom_symbol_new ("keyed-7"),
+          *k5 = atom_string_new ("keyed-5"),
+          *knone = atom_symbol_new ("keyed-none");
+   keyed = keyed && k7 && k5 && knone &&
+           atom_list_find_key (table, k7, &found) && found == 7 &&
+           atom_list_find_key (table, k5, &found) && found == 5 &&
+           !atom_list_find_key (table, knone, &found);
+   atom_del (keyed ? atom_list_remove (table, 7) : NULL);
+   keyed = keyed && atom_list_find_key (table, k7, &found) &&
+           found == KEYED_NAMES + 7 - 1 &&
+           atom_list_find_key (table, k5, &found) && found == 5;
+   atom_del (k7);
+   atom_del (k5);
+   atom_del (knone);
+   atom_del (table);
+   if (!keyed) {
+      XERROR ("Entries were not found by their key\n");
+      goto errorexit;
+   }
+
+   // Short strings live in the atom itself, all carry their length
+   atom_t *shortstr = atom_string_new ("\"short\""),
+          *longstr = atom_string_new ("a string too long to be kept inline"),
+          *longdup = atom_dup (longstr),
+          *prefix = atom_string_new ("a string");
+   bool lengths = shortstr && longstr && longdup && prefix &&
+                  strcmp (atom_to_string (shortstr), "short")==0 &&
+                  atom_string_length (shortstr) == 5 &&
+                  atom_to_string (shortstr) == (const char *)shortstr->sso &&
+                  atom_string_length (longdup) == 35 &&
+                  atom_to_string (longdup) != atom_to_string (longstr) &&
+                  atom_cmp (longdup, longstr)==0 &&
+                  atom_cmp (prefix, longstr) < 0 &&
+                  atom_cmp (longstr, prefix) > 0 &&
+                  atom_cmp (shortstr, prefix) > 0;
+   atom_del (prefix);
+   atom_del (longdup);
+   atom_del (longstr);
+   atom_del (shortstr);
+   if (!lengths) {
+      XERROR ("Strings lost their contents or length\n");
+      goto errorexit;
+   }
+
+   // Lists keep their order when growing past the inline items
+   atom_t *list = atom_list_new ();
+   bool ordered = list != NULL;
+   for (int64_t i=1; ordered && i<10; i++) {
+      ordered = atom_list_ins_tail (list, atom_int_new (i)) != NULL;
+   }
+   ordered = ordered && atom_list_ins_head (list, atom_int_new (0));
+   atom_del (atom_list_remove (list, 5));
+   atom_del (atom_list_remove_tail (list));
+   for (size_t i=0; ordered && i<atom_list_length (list); i++) {
+      int64_t expected = i < 5 ? (int64_t)i : (int64_t)i + 1;
+      ordered = atom_list_index (list, i)->ival == expected;
+   }
+   ordered = ordered && atom_list_length (list)==8;
+   atom_del (list);
+   if (!ordered) {
+      XERROR ("List lost its order when spilling\n");
+      goto errorexit;
+   }
+
+   // Slices and concatenations share items, yet read and write like copies
+   atom_t *whole = atom_list_new ();
+   bool shared = whole != NULL;
+   for (int64_t i=0; shared && i<20; i++) {
+      shared = atom_list_ins_tail (whole, atom_int_new (i)) != NULL;
+   }
+   atom_t *slice = atom_list_slice (whole, 3, 15);
+   atom_t *joined = atom_concatenate (slice, whole, slice, NULL);
+   atom_t *inner = atom_list_slice (joined, 10, 30);
+   shared = shared && slice && joined && inner &&
+            atom_list_length (slice)==12 &&
+            atom_list_length (joined)==44 &&
+            atom_list_length (inner)==20;
+   for (size_t i=0; shared && i<20; i++) {
+      size_t j = i + 10;
+      int64_t expected = j < 12 ? (int64_t)j + 3
+                       : j < 32 ? (int64_t)j - 12 : (int64_t)j - 32 + 3;
+      shared = atom_list_index (inner, i)->ival == expected;
+   }
+   atom_del (atom_list_remove (inner, 0));
+   atom_list_ins_tail (inner, atom_int_new (-1));
+   shared = shared && atom_list_length (inner)==20 &&
+            atom_list_index (inner, 19)->ival == -1 &&
+            atom_list_index (joined, 10)->ival == 13 &&
+            atom_list_length (joined)==44;
+   atom_del (inner);
+   atom_del (joined);
+   atom_del (slice);
+   atom_del (whole);
+   if (!shared) {
+      XERROR ("Slice or concatenation does not match a copy\n");
+      goto errorexit;
+   }
+
+   // Buffer duplicates and slices share bytes until written to
+   uint8_t bytes[64];
+   for (size_t i=0; i<sizeof bytes; i++) {
+      bytes[i] = i;
+   }
+   atom_t *buf = atom_buffer_new (bytes, sizeof bytes);
+   atom_t *bufdup = atom_dup (buf);
+   atom_t *bufslice = atom_buffer_slice (buf, 16, 48);
+   const uint8_t *sliced = atom_buffer_data (bufslice);
+   bool viewed = buf && bufdup && bufslice &&
+                 atom_buffer_data (bufdup) == atom_buffer_data (buf) &&
+                 sliced == (const uint8_t *)atom_buffer_data (buf) + 16 &&
+                 atom_buffer_length (bufslice) == 32 && sliced[0] == 16;
+   uint8_t *written = viewed ? atom_buffer_offset (bufslice, 1) : NULL;
+   viewed = viewed && written && (*written = 0xff) &&
+            ((const uint8_t *)atom_buffer_data (buf))[17] == 17 &&
+            ((const uint8_t *)atom_buffer_data (bufslice))[1] == 0xff &&
+            atom_buffer_offset (bufslice, 0) == written - 1;
+   atom_del (bufslice);
+   atom_del (bufdup);
+   atom_del (buf);
+   if (!viewed) {
+      XERROR ("Buffer views were copied or shared writes\n");
+      goto errorexit;
+   }
+
+   // Long lists of numbers of one type keep them in place, until an item
+   // of another type is added
+   atom_t *nums = atom_list_new ();
+   atom_t *floats = atom_list_new ();
+   bool unboxed = nums && floats;
+   for (int64_t i=0; unboxed && i<1000; i++) {
+      unboxed = atom_list_ins_tail (nums, atom_int_new (i * 7)) &&
+                atom_list_ins_tail (floats, atom_float_new (i / 4.0));
+   }
+   atom_t *numdup = atom_dup (nums);
+   unboxed = unboxed && atom_list_ins_head (nums, atom_int_new (-1)) &&
+             atom_list_index (floats, 10)->fval == 2.5 &&
+             atom_list_index (numdup, 999)->ival == 999 * 7;
+   atom_t *removed = unboxed ? atom_list_remove (nums, 500) : NULL;
+   unboxed = unboxed && removed && removed->ival == 499 * 7 &&
+             atom_list_ins_tail (floats, atom_int_new (1)) &&
+             atom_list_ins_tail (nums, atom_string_new ("boxed"));
+   for (size_t i=0; unboxed && i<999; i++) {
+      int64_t expected = i < 499 ? (int64_t)i * 7 : (int64_t)(i + 1) * 7;
+      unboxed = atom_list_index (nums, i + 1)->ival == expected &&
+                atom_list_index (numdup, i)->ival == (int64_t)i * 7 &&
+                atom_list_index (floats, i)->fval == i / 4.0;
+   }
+   unboxed = unboxed && atom_list_length (nums) == 1001 &&
+             atom_list_index (nums, 1000)->type == atom_STRING &&
+             atom_list_index (floats, 1000)->type == atom_INT &&
+             atom_cmp (atom_list_index (nums, 1), atom_list_index (numdup, 0))==0;
+   atom_del (removed);
+   atom_del (numdup);
+   atom_del (floats);
+   atom_del (nums);
+   if (!unboxed) {
+      XERROR ("Numbers kept in place were lost or reordered\n");
+      goto errorexit;
+   }
+
+   // Their items are the atoms inserted, which neither move nor go away
+   // while the list grows, is copied or is changed
+   atom_t *big = atom_int_new (INT64_C (1) << 40);
+   atom_t *held = atom_list_new ();
+   bool kept = held && big && atom_list_ins_tail (held, big) == big;
+   for (int64_t i=0; kept && i<100; i++)
+      kept = atom_list_ins_head (held, atom_int_new (i << 40)) != NULL;
+   atom_t *heldcopy = kept ? atom_dup (held) : NULL;
+   kept = kept && heldcopy && atom_list_index (held, 100) == big &&
+          atom_list_ins_tail (heldcopy, atom_int_new (1)) &&
+          atom_list_index (heldcopy, 100) != big &&
+          atom_list_index (heldcopy, 100)->ival == big->ival &&
+          atom_list_index (heldcopy, 100) == atom_list_index (heldcopy, 100);
+   atom_t *out = kept ? atom_list_remove (held, 100) : NULL;
+   kept = kept && out == big && atom_list_length (held) == 100;
+   atom_del (out);
+   atom_del (heldcopy);
+   atom_del (held);
+   if (!kept) {
+      XERROR ("Numbers kept in place lost the identity of their items\n");
+      goto errorexit;
+   }
+
+   // Flags are set on copies of their own, never on singletons
+   atom_t *flagged = atom_dup_flagged (atom_int_new (7), ATOM_FLAG_FUNC);
+   atom_t *fnil = atom_dup_flagged (atom_new (atom_NIL, NULL), ATOM_FLAG_FFI);
+   bool own = flagged && fnil && flagged != atom_int_new (7) &&
+              flagged->ival == 7 && flagged->flags == ATOM_FLAG_FUNC &&
+              fnil->type == atom_NIL && fnil != atom_new (atom_NIL, NULL) &&
+              atom_int_new (7)->flags == 0 && atom_new (atom_NIL, NULL)->flags == 0;
+   atom_del (flagged);
+   atom_del (fnil);
+   if (!own) {
+      XERROR ("Flags were set on a shared singleton\n");
+      goto errorexit;
+   }
+
+   if (!numbers () || !positions () || !collect () || !streaming () ||
+       !incremental ())
+      goto errorexit;
+
+   if (!benchmark () || !benchmark_numbers ())
+      goto errorexit;
+
    ret = EXIT_SUCCESS;
 
 errorexit:
 
-   for (size_t i=0; tokens[i]; i++) {
-      token_del (tokens[i]);
-   }
-   free (tokens);
+   token_array_del (tokens);
 
    xerror_set_logfile (NULL);
 
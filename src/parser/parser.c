@@ -1,3 +1,4 @@
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -9,6 +10,7 @@
 
 
 #include "ll/ll.h"
+#include "mem/mem.h"
 #include "xstring/xstring.h"
 #include "xerror/xerror.h"
 
@@ -22,8 +24,11 @@ static atom_t *rparser (token_t **tokens, size_t *index)
       return NULL;
    }
 
-   const char *string = token_string (tokens[(*index)]);
+   token_t *token = tokens[(*index)];
+   const char *string = token_string (token);
    enum atom_type_t type = atom_UNKNOWN;
+   int64_t ival = 0;
+   double fval = 0;
 
    switch (token_type (tokens[(*index)])) {
       case token_INT:      type = atom_INT;     break;
@@ -50,15 +55,32 @@ static atom_t *rparser (token_t **tokens, size_t *index)
       return NULL;
    }
 
-   if (!(ret = atom_new (type, string))) {
+   // String bytes go from the token to the atom without a scan for the
+   // closing quote
+   if (type==atom_STRING) {
+      ret = atom_string_new_len (&string[1], token_string_length (token) - 2);
+   } else if (token_int_value (token, &ival) ||
+              token_float_value (token, &fval)) {
+      // Not atom_int_new(), as small ints are shared and this atom gets
+      // a source position of its own
+      if ((ret = atom_new (atom_UNKNOWN, NULL))) {
+         ret->type = type;
+         if (type==atom_INT)
+            ret->ival = ival;
+         else
+            ret->fval = fval;
+      }
+   } else {
+      ret = atom_new (type, string);
+   }
+
+   if (!ret) {
       return NULL;
    }
 
-   memset (ret->buffer, 0, sizeof ret->buffer);
-   snprintf (ret->buffer, sizeof ret->buffer -1, "%s:%zu:%zu",
-                          token_fname (tokens[(*index)]),
-                          token_line (tokens[(*index)]),
-                          token_charpos (tokens[(*index)]));
+   ret->srcloc = atom_srcloc_add (token_fname (token),
+                                  token_line (token),
+                                  token_charpos (token));
 
    if (type==atom_LIST) {
       atom_t *child;
@@ -82,9 +104,15 @@ errorexit:
 
 atom_t *parser_parse (token_t **tokens, size_t *index)
 {
+   static uint16_t origin = 0;
    bool error = true;
    atom_t *ret = NULL;
 
+   if (!origin)
+      origin = atom_census_origin ("parser");
+
+   uint16_t prev_origin = atom_census_set_origin (origin);
+
    if (!(ret = rparser (tokens, index)))
       goto errorexit;
 
@@ -92,6 +120,8 @@ atom_t *parser_parse (token_t **tokens, size_t *index)
 
 errorexit:
 
+   atom_census_set_origin (prev_origin);
+
    if (error) {
       atom_del (ret);
       ret = NULL;
@@ -100,3 +130,470 @@ errorexit:
    return ret;
 }
 
+atom_t *parser_stream_next (token_stream_t *ts)
+{
+   token_t **tokens = token_stream_form (ts);
+   size_t index = 0;
+
+   atom_t *ret = tokens ? parser_parse (tokens, &index) : NULL;
+
+   token_array_del (tokens);
+
+   return ret;
+}
+
+// A top-level form of a tree, at the position of its first token. A form
+// with tokens of a file loaded by the script is foreign, and a part that
+// is read again never starts or stops at one; it takes the offset of the
+// form before it, so that the offsets of forms never go down.
+typedef struct tree_form_t tree_form_t;
+struct tree_form_t {
+   atom_t  *atom;
+   size_t   offset;
+   size_t   line;
+   size_t   charpos;
+   uint32_t group;      // Of the positions of the form's atoms
+   bool     foreign;
+};
+
+// The forms changed by the last update are those from first up to last
+struct parser_tree_t {
+   char        *fname;
+   const char  *tokfname;     // As token_fname() has it, once seen
+   char        *source;
+   size_t       len;
+
+   tree_form_t *forms;
+   size_t       nforms;
+   size_t       forms_len;
+
+   size_t       first;
+   size_t       last;
+};
+
+// Sources are compared this many bytes at a time
+#define TREE_BLOCK      (256)
+
+static char *tree_source (const char *fname, size_t *len)
+{
+   bool error = true;
+   char *ret = NULL;
+   long flen = 0;
+
+   FILE *inf = fopen (fname, "rb");
+   if (!inf) {
+      XERROR ("Unable to read [%s]: %m\n", fname);
+      return NULL;
+   }
+
+   if (fseek (inf, 0, SEEK_END) || (flen = ftell (inf)) < 0 ||
+       fseek (inf, 0, SEEK_SET))
+      goto errorexit;
+
+   if (!(ret = mem_malloc (flen + 1)))
+      goto errorexit;
+
+   if (fread (ret, 1, flen, inf) != (size_t)flen)
+      goto errorexit;
+
+   ret[flen] = 0;
+   *len = flen;
+
+   error = false;
+
+errorexit:
+
+   fclose (inf);
+
+   if (error) {
+      mem_free (ret);
+      ret = NULL;
+   }
+
+   return ret;
+}
+
+static size_t common_prefix (const char *lhs, const char *rhs, size_t max)
+{
+   size_t ret = 0;
+
+   while (ret + TREE_BLOCK <= max &&
+          memcmp (&lhs[ret], &rhs[ret], TREE_BLOCK)==0)
+      ret += TREE_BLOCK;
+
+   while (ret < max && lhs[ret]==rhs[ret])
+      ret++;
+
+   return ret;
+}
+
+// Compares backwards from the ends of lhs and rhs
+static size_t common_suffix (const char *lhs, const char *rhs, size_t max)
+{
+   size_t ret = 0;
+
+   while (ret + TREE_BLOCK <= max &&
+          memcmp (lhs - ret - TREE_BLOCK, rhs - ret - TREE_BLOCK,
+                  TREE_BLOCK)==0)
+      ret += TREE_BLOCK;
+
+   while (ret < max && lhs[-(ptrdiff_t)ret - 1]==rhs[-(ptrdiff_t)ret - 1])
+      ret++;
+
+   return ret;
+}
+
+static size_t count_lines (const char *str, size_t len)
+{
+   size_t ret = 0;
+   for (const char *eol=str; (eol = memchr (eol, '\n', &str[len] - eol));
+                             eol++) {
+      ret++;
+   }
+   return ret;
+}
+
+// Forms are the same if they evaluate the same: unlike for atom_cmp(),
+// an INT is not the same as a FLOAT of equal value.
+static bool same_form (const atom_t *lhs, const atom_t *rhs)
+{
+   if (lhs->type != rhs->type)
+      return false;
+
+   if (lhs->type != atom_LIST)
+      return atom_cmp (lhs, rhs)==0;
+
+   size_t len = atom_list_length (lhs);
+   if (len != atom_list_length (rhs))
+      return false;
+
+   for (size_t i=0; i<len; i++) {
+      if (!same_form (atom_list_index (lhs, i), atom_list_index (rhs, i)))
+         return false;
+   }
+
+   return true;
+}
+
+static bool tree_own_token (parser_tree_t *tree, token_t *token)
+{
+   const char *fname = token_fname (token);
+   if (fname == tree->tokfname)
+      return true;
+
+   if (strcmp (fname, tree->fname))
+      return false;
+
+   tree->tokfname = fname;
+   return true;
+}
+
+static void tree_form_del (tree_form_t *form)
+{
+   atom_del (form->atom);
+   atom_srcloc_group_del (form->group);
+}
+
+static void tree_forms_del (tree_form_t *forms, size_t nforms)
+{
+   for (size_t i=0; i<nforms; i++) {
+      tree_form_del (&forms[i]);
+   }
+   mem_free (forms);
+}
+
+// Parses source from start to end into forms, each with a group of its
+// own for the positions of its atoms. clean is cleared if the part does
+// not end between two forms, or has tokens of a loaded file. Returns
+// false if the part cannot be read.
+static bool tree_read (parser_tree_t *tree, const char *source,
+                       size_t start, size_t end, size_t line, size_t charpos,
+                       tree_form_t **forms, size_t *nforms, bool *clean)
+{
+   bool error = true;
+   size_t forms_len = 0, depth = 0;
+
+   *forms = NULL;
+   *nforms = 0;
+   *clean = true;
+
+   token_t **tokens = token_read_part (source, start, end, tree->fname,
+                                       line, charpos);
+   if (!tokens) {
+      *clean = false;
+      return source[end] != 0;
+   }
+
+   size_t index = 0;
+   while (tokens[index]) {
+      token_t *first = tokens[index];
+      size_t from = index;
+
+      if (*nforms >= forms_len) {
+         size_t newlen = forms_len ? forms_len * 2 : 16;
+         tree_form_t *tmp = mem_realloc (*forms, sizeof *tmp * newlen);
+         if (!tmp)
+            goto errorexit;
+         *forms = tmp;
+         forms_len = newlen;
+      }
+
+      tree_form_t *form = &(*forms)[*nforms];
+      form->group = atom_srcloc_group (tree->fname);
+
+      uint32_t prev_group = atom_srcloc_set_group (form->group);
+      form->atom = parser_parse (tokens, &index);
+      atom_srcloc_set_group (prev_group);
+
+      if (!form->atom) {
+         atom_srcloc_group_del (form->group);
+         // A stray closing parenthesis is no form
+         if (token_type (first)==token_ENDL)
+            continue;
+         goto errorexit;
+      }
+
+      form->foreign = false;
+      for (size_t i=from; i<index; i++) {
+         if (token_type (tokens[i])==token_STARTL)
+            depth++;
+         if (token_type (tokens[i])==token_ENDL && depth)
+            depth--;
+         if (!tree_own_token (tree, tokens[i]))
+            form->foreign = true;
+      }
+
+      if (form->foreign) {
+         *clean = false;
+      }
+
+      if (form->foreign && !tree_own_token (tree, first)) {
+         form->offset = *nforms ? (*forms)[*nforms - 1].offset : start;
+         form->line = form->charpos = 0;
+      } else {
+         form->offset = token_offset (first);
+         form->line = token_line (first);
+         form->charpos = token_charpos (first);
+      }
+
+      (*nforms)++;
+   }
+
+   if (depth)
+      *clean = false;
+
+   error = false;
+
+errorexit:
+
+   token_array_del (tokens);
+
+   if (error) {
+      tree_forms_del (*forms, *nforms);
+      *forms = NULL;
+      *nforms = 0;
+   }
+
+   return !error;
+}
+
+parser_tree_t *parser_tree_new (const char *fname)
+{
+   parser_tree_t *ret = mem_calloc (1, sizeof *ret);
+   if (!ret)
+      return NULL;
+
+   if (!(ret->fname = mem_strdup (fname))) {
+      mem_free (ret);
+      return NULL;
+   }
+
+   return ret;
+}
+
+void parser_tree_del (parser_tree_t *tree)
+{
+   if (!tree)
+      return;
+
+   tree_forms_del (tree->forms, tree->nforms);
+   mem_free (tree->source);
+   mem_free (tree->fname);
+   mem_free (tree);
+}
+
+// The part read again runs from the last form that starts before the
+// edit, to the first form that starts a line after it. The forms after
+// that are kept, moved by as many bytes and lines as the edit added.
+bool parser_tree_update (parser_tree_t *tree, const char *source,
+                                              size_t len)
+{
+   bool error = true;
+   char *copy = NULL;
+   tree_form_t *forms = NULL;
+   size_t nforms = 0;
+
+   if (!tree)
+      return false;
+
+   if (source && (copy = mem_malloc (len + 1))) {
+      memcpy (copy, source, len);
+      copy[len] = 0;
+   } else if (!source) {
+      copy = tree_source (tree->fname, &len);
+   }
+
+   if (!copy)
+      goto errorexit;
+
+   const char *old = tree->source ? tree->source : "";
+   size_t oldlen = tree->len,
+          max = oldlen < len ? oldlen : len;
+
+   size_t prefix = common_prefix (old, copy, max),
+          suffix = common_suffix (&old[oldlen], &copy[len], max - prefix);
+
+   size_t oldend = oldlen - suffix,
+          newend = len - suffix;
+
+   if (prefix==oldlen && prefix==len) {
+      mem_free (copy);
+      tree->first = tree->last = 0;
+      return true;
+   }
+
+   size_t lo = 0, hi = tree->nforms;
+   while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (tree->forms[mid].offset < prefix)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   size_t j = lo;
+   while (j && tree->forms[j - 1].foreign)
+      j--;
+
+   size_t start = 0, line = 1, charpos = 1;
+   if (j) {
+      j--;
+      start = tree->forms[j].offset;
+      line = tree->forms[j].line;
+      charpos = tree->forms[j].charpos;
+   }
+
+   size_t k = lo;
+   while (k < tree->nforms &&
+          (tree->forms[k].foreign ||
+           tree->forms[k].offset < oldend + tree->forms[k].charpos))
+      k++;
+
+   bool foreign = false;
+   for (size_t i=j; i<k; i++) {
+      foreign = foreign || tree->forms[i].foreign;
+   }
+
+   size_t end = k < tree->nforms ? tree->forms[k].offset - oldend + newend
+                                 : len;
+
+   bool clean = false;
+   if (!foreign && !tree_read (tree, copy, start, end, line, charpos,
+                               &forms, &nforms, &clean))
+      goto errorexit;
+
+   // Anything that reads differently from the part is read all over
+   if (!clean) {
+      tree_forms_del (forms, nforms);
+      j = 0;
+      k = tree->nforms;
+      if (!tree_read (tree, copy, 0, len, 1, 1, &forms, &nforms, &clean))
+         goto errorexit;
+   }
+
+   size_t nold = k - j,
+          total = tree->nforms - nold + nforms;
+
+   if (total > tree->forms_len) {
+      size_t newlen = tree->forms_len ? tree->forms_len * 2 : 64;
+      while (newlen < total)
+         newlen *= 2;
+
+      tree_form_t *tmp = mem_realloc (tree->forms, sizeof *tmp * newlen);
+      if (!tmp)
+         goto errorexit;
+
+      tree->forms = tmp;
+      tree->forms_len = newlen;
+   }
+
+   // Forms read again that are the same as before are not changed
+   size_t same_head = 0, same_tail = 0;
+   while (same_head < nold && same_head < nforms &&
+          same_form (tree->forms[j + same_head].atom,
+                     forms[same_head].atom))
+      same_head++;
+
+   while (same_tail < nold - same_head && same_tail < nforms - same_head &&
+          same_form (tree->forms[k - same_tail - 1].atom,
+                     forms[nforms - same_tail - 1].atom))
+      same_tail++;
+
+   size_t oldlines = count_lines (&old[prefix], oldend - prefix),
+          newlines = count_lines (&copy[prefix], newend - prefix);
+
+   for (size_t i=k; i<tree->nforms; i++) {
+      tree_form_t *form = &tree->forms[i];
+      form->offset = form->offset - oldend + newend;
+      if (oldlines != newlines) {
+         form->line = form->line ? form->line - oldlines + newlines : 0;
+         atom_srcloc_move (form->group, (int64_t)newlines - (int64_t)oldlines);
+      }
+   }
+
+   for (size_t i=j; i<k; i++) {
+      tree_form_del (&tree->forms[i]);
+   }
+
+   memmove (&tree->forms[j + nforms], &tree->forms[k],
+            sizeof *tree->forms * (tree->nforms - k));
+   if (nforms)
+      memcpy (&tree->forms[j], forms, sizeof *forms * nforms);
+
+   tree->nforms = total;
+   tree->first = j + same_head;
+   tree->last = j + nforms - same_tail;
+
+   mem_free (tree->source);
+   tree->source = copy;
+   tree->len = len;
+
+   mem_free (forms);
+   forms = NULL;
+   nforms = 0;
+   copy = NULL;
+
+   error = false;
+
+errorexit:
+
+   tree_forms_del (forms, nforms);
+   mem_free (copy);
+
+   return !error;
+}
+
+size_t parser_tree_length (const parser_tree_t *tree)
+{
+   return tree ? tree->nforms : 0;
+}
+
+atom_t *parser_tree_form (const parser_tree_t *tree, size_t index)
+{
+   return tree && index < tree->nforms ? tree->forms[index].atom : NULL;
+}
+
+bool parser_tree_changed (const parser_tree_t *tree, size_t index)
+{
+   return tree && index >= tree->first && index < tree->last;
+}
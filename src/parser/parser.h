@@ -16,6 +16,29 @@ extern "C" {
 
    atom_t *parser_parse (token_t **tokens, size_t *index);
 
+   // Parses the next top-level form of the stream, NULL once it is empty.
+   // The source positions of a form are given back when it is deleted,
+   // so a stream whose forms are deleted as they are evaluated holds no
+   // more of them than its largest form has atoms.
+   atom_t *parser_stream_next (token_stream_t *ts);
+
+   // A tree keeps the top-level forms of a script along with its source,
+   // so that after an edit only the forms around the edit are tokenized
+   // and parsed again. parser_tree_update() takes the new source, or
+   // reads the file again if source is NULL; the forms that differ from
+   // those before it are then marked as changed, and only they need to be
+   // evaluated again. A new tree is empty, so that its first update
+   // changes every form. Files named by #load are only read again if the
+   // part of the script around their #load is. The forms belong to the
+   // tree.
+   parser_tree_t *parser_tree_new (const char *fname);
+   void parser_tree_del (parser_tree_t *tree);
+   bool parser_tree_update (parser_tree_t *tree, const char *source,
+                                                 size_t len);
+   size_t parser_tree_length (const parser_tree_t *tree);
+   atom_t *parser_tree_form (const parser_tree_t *tree, size_t index);
+   bool parser_tree_changed (const parser_tree_t *tree, size_t index);
+
 #ifdef __cplusplus
 };
 #endif
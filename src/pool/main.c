@@ -0,0 +1,224 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pool/pool.h"
+
+#include "xerror/xerror.h"
+
+#define NOBJS     (10000)
+
+static size_t g_ncalls;
+static void count_obj (void *obj)
+{
+   if (*(size_t *)obj == g_ncalls + 1)
+      g_ncalls++;
+}
+
+static size_t g_nlive;
+static void count_live (void *obj)
+{
+   if (((uint8_t *)obj)[71] == 0xa5)
+      g_nlive++;
+}
+
+static bool pool_alloc_ok (pool_t *pool, size_t size)
+{
+   void *obj = pool_alloc (pool, size);
+   pool_free (obj);
+   return obj != NULL;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   static void *objs[NOBJS];
+   arena_t *arena = NULL;
+   size_t nchunks = 0;
+
+   pool_t *pool = pool_new ();
+   if (!pool) {
+      XERROR ("Unable to create pool\n");
+      goto errorexit;
+   }
+
+   for (size_t i=0; i<NOBJS; i++) {
+      size_t size = (i % 3) ? 72 : 24;
+      if (!(objs[i] = pool_alloc (pool, size))) {
+         XERROR ("Failed to allocate object %zu of %zu bytes\n", i, size);
+         goto errorexit;
+      }
+      for (size_t j=0; j<size; j++) {
+         if (((uint8_t *)objs[i])[j]) {
+            XERROR ("Object %zu was not zeroed\n", i);
+            goto errorexit;
+         }
+      }
+      ((uint8_t *)objs[i])[size - 1] = 0xa5;
+   }
+
+   pool_print (pool, stdout);
+
+   if (pool_alloc (pool, POOL_MAX_OBJSIZE + 1)) {
+      XERROR ("Oversized allocation was not refused\n");
+      goto errorexit;
+   }
+
+   // Allocations and charges beyond the limit are refused
+   size_t nbytes = pool_nbytes (pool);
+   pool_set_limit (pool, nbytes + 100);
+   bool limited = pool_charge (pool, 60) && !pool_alloc (pool, 48) &&
+                  pool_nrefused (pool) == 1 && pool_alloc_ok (pool, 24);
+   pool_uncharge (pool, 60);
+   pool_set_limit (pool, 0);
+   if (!limited || pool_nbytes (pool) != nbytes) {
+      XERROR ("Pool limit was not enforced\n");
+      goto errorexit;
+   }
+
+   // Freed blocks are cached and reused by the next block of their class;
+   // large blocks are mapped and come back zeroed
+   uint8_t *block = pool_block_alloc (pool, 3000, true);
+   if (block)
+      block[0] = 0xa5;
+   pool_block_free (block);
+   uint8_t *reused = pool_block_alloc (pool, 4000, false);
+   uint8_t *zeroed = pool_block_alloc (pool, 4000, true);
+   uint8_t *mapped = pool_block_alloc (pool, POOL_BLOCK_MAX + 1, false);
+   pool_block_stats_t bstats;
+   pool_block_stats (pool, &bstats);
+#ifdef POOL_USE_MALLOC
+   // Nothing is cached, so that ASan sees each block
+   bool cached = block && bstats.nreused == 0;
+#else
+   bool cached = block && reused==block && bstats.nreused == 1;
+#endif
+   cached = cached && reused && zeroed && !zeroed[3999] &&
+            mapped && !mapped[POOL_BLOCK_MAX] &&
+            pool_block_size (reused) == 4096 &&
+            bstats.nmapped == 1 && bstats.nlive == 3;
+   pool_block_free (mapped);
+   pool_block_free (zeroed);
+   pool_block_free (reused);
+   if (!cached || pool_nbytes (pool) != nbytes) {
+      XERROR ("Pool blocks were not cached or not released\n");
+      goto errorexit;
+   }
+
+   // Freed objects must be recycled before any new slab is created
+   size_t nslabs = pool_nslabs (pool);
+   for (size_t i=0; i<NOBJS; i+=2) {
+      pool_free (objs[i]);
+   }
+   for (size_t i=0; i<NOBJS; i+=2) {
+      size_t size = (i % 3) ? 72 : 24;
+      if (!(objs[i] = pool_alloc (pool, size))) {
+         XERROR ("Failed to reallocate object %zu\n", i);
+         goto errorexit;
+      }
+   }
+
+   printf ("Slabs before recycling: %zu, after: %zu, live objects: %zu\n",
+            nslabs, pool_nslabs (pool), pool_nlive (pool));
+
+   if (pool_nslabs (pool) != nslabs) {
+      XERROR ("Free list was not used\n");
+      goto errorexit;
+   }
+
+   // Only the live objects of the requested size are iterated
+   for (size_t i=0; i<NOBJS; i+=5) {
+      pool_free (objs[i]);
+      objs[i] = NULL;
+   }
+   size_t expected = 0;
+   for (size_t i=0; i<NOBJS; i++) {
+      if (objs[i] && (i % 3)) {
+         ((uint8_t *)objs[i])[71] = 0xa5;
+         expected++;
+      }
+   }
+   if (!pool_iterate (pool, 72, count_live) || g_nlive != expected) {
+      XERROR ("Iterated %zu of %zu live objects\n", g_nlive, expected);
+      goto errorexit;
+   }
+
+   // Objects of another kind are neither visited with these nor mixed up
+   // with them
+   uint8_t *other = pool_alloc_kind (pool, 72, 1);
+   if (other)
+      other[71] = 0xa5;
+   g_nlive = 0;
+   if (!other || !pool_iterate (pool, 72, count_live) || g_nlive != expected) {
+      XERROR ("Iterated %zu of %zu live objects of kind 0\n", g_nlive, expected);
+      pool_free (other);
+      goto errorexit;
+   }
+   g_nlive = 0;
+   if (!pool_iterate_kind (pool, 72, 1, count_live) || g_nlive != 1) {
+      XERROR ("Iterated %zu of 1 live objects of kind 1\n", g_nlive);
+      pool_free (other);
+      goto errorexit;
+   }
+   pool_free (other);
+
+   // Objects outlive the pool; the last free releases the slabs.
+   pool_del (pool);
+   pool = NULL;
+
+   for (size_t i=0; i<NOBJS; i++) {
+      pool_free (objs[i]);
+   }
+
+   // Arena chunks are reused after a reset rather than reallocated
+   if (!(arena = arena_new (40))) {
+      XERROR ("Unable to create arena\n");
+      goto errorexit;
+   }
+
+   for (size_t pass=0; pass<3; pass++) {
+      for (size_t i=0; i<NOBJS; i++) {
+         size_t *obj = arena_alloc (arena);
+         if (!obj || *obj) {
+            XERROR ("Arena object %zu was not allocated or not zeroed\n", i);
+            goto errorexit;
+         }
+         *obj = i + 1;
+      }
+
+      g_ncalls = 0;
+      arena_iterate (arena, count_obj);
+      if (g_ncalls != NOBJS || arena_nobjs (arena) != NOBJS) {
+         XERROR ("Arena iterated %zu of %i objects\n", g_ncalls, NOBJS);
+         goto errorexit;
+      }
+
+      if (pass == 0)
+         nchunks = arena_nchunks (arena);
+
+      arena_reset (arena);
+   }
+
+   printf ("Arena chunks after first pass: %zu, after third: %zu\n",
+            nchunks, arena_nchunks (arena));
+
+   if (arena_nchunks (arena) != nchunks) {
+      XERROR ("Arena chunks were not reused\n");
+      goto errorexit;
+   }
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+
+   pool_del (pool);
+   arena_del (arena);
+
+   xerror_set_logfile (NULL);
+
+   return ret;
+}
+
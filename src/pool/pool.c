@@ -0,0 +1,841 @@
+
+#ifndef PLATFORM_WINDOWS
+#define _POSIX_C_SOURCE    200112L
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS      MAP_ANON
+#endif
+#endif
+
+#include "pool/pool.h"
+#include "mem/mem.h"
+
+// Slabs are aligned on their own size, so the slab (and from there the
+// owning pool) of any object is found by masking the object's address.
+#define SLAB_SIZE          ((size_t)1 << 16)
+#define CACHE_LINE         (64)
+#define CLASS_GRAIN        (8)
+#define NCLASSES           (POOL_MAX_OBJSIZE / CLASS_GRAIN)
+
+// Classes are indexed by kind, then by size
+#define CLASS_INDEX(kind, size)   ((kind) * NCLASSES + ((size) - 1) / CLASS_GRAIN)
+
+typedef struct slab_t slab_t;
+struct slab_t {
+   pool_t  *pool;
+   slab_t  *next;
+   size_t   objsize;
+   unsigned kind;
+   size_t   nobjs;      // Capacity of this slab
+   size_t   ncarved;    // Objects handed out at least once
+};
+
+#define SLAB_HEADER        ((sizeof (slab_t) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1))
+
+struct pool_class_t {
+   void     *freelist;
+   slab_t   *slabs;
+};
+
+// Blocks are preceded by a header naming the pool that they are charged
+// to and their class size (or mapped length, for large blocks). Free
+// blocks are cached per class, linked through their first word.
+#define BLOCK_MIN_SHIFT    (6)
+#define BLOCK_MAX_SHIFT    (17)
+#define NBLOCKCLASSES      (BLOCK_MAX_SHIFT - BLOCK_MIN_SHIFT + 1)
+#define BLOCK_PAGE         ((size_t)4096)
+
+#ifdef POOL_USE_MALLOC
+#define BLOCK_CACHE_BYTES  ((size_t)0)
+#else
+#define BLOCK_CACHE_BYTES  ((size_t)1 << 20)
+#endif
+
+typedef struct block_t block_t;
+struct block_t {
+   pool_t  *pool;
+   size_t   size;
+};
+
+#ifdef POOL_USE_MALLOC
+// Each object is preceded by a header that links it into its pool, so
+// that pool_iterate() can still find the live objects.
+typedef struct pool_obj_t pool_obj_t;
+struct pool_obj_t {
+   pool_t     *pool;
+   pool_obj_t *prev;
+   pool_obj_t *next;
+   size_t      objsize;
+   unsigned    kind;
+};
+#endif
+
+struct pool_t {
+   struct pool_class_t classes[POOL_NKINDS * NCLASSES];
+   size_t nlive;
+   size_t nslabs;
+   bool   dead;
+
+   size_t nbytes;       // Live objects plus everything charged
+   size_t nbytes_high;
+   size_t limit;        // 0 when unlimited
+   size_t nrefused;
+
+   block_t *blocks[NBLOCKCLASSES];
+   pool_block_stats_t bstats;
+#ifdef POOL_USE_MALLOC
+   pool_obj_t *objs;
+#endif
+};
+
+static void pool_release (pool_t *pool)
+{
+   for (size_t i=0; i<POOL_NKINDS * NCLASSES; i++) {
+      slab_t *slab = pool->classes[i].slabs;
+      while (slab) {
+         slab_t *next = slab->next;
+         mem_aligned_free (slab);
+         slab = next;
+      }
+   }
+
+   for (size_t i=0; i<NBLOCKCLASSES; i++) {
+      block_t *block = pool->blocks[i];
+      while (block) {
+         block_t *next = *(block_t **)&block[1];
+         mem_free (block);
+         block = next;
+      }
+   }
+
+   mem_free (pool);
+}
+
+static bool pool_reserve (pool_t *pool, size_t nbytes)
+{
+   if (pool->limit && pool->nbytes + nbytes > pool->limit) {
+      pool->nrefused++;
+      return false;
+   }
+
+   pool->nbytes += nbytes;
+   if (pool->nbytes > pool->nbytes_high)
+      pool->nbytes_high = pool->nbytes;
+
+   return true;
+}
+
+static void pool_unreserve (pool_t *pool, size_t nbytes)
+{
+   pool->nbytes = nbytes < pool->nbytes ? pool->nbytes - nbytes : 0;
+}
+
+pool_t *pool_new (void)
+{
+   return mem_calloc (1, sizeof (pool_t));
+}
+
+void pool_del (pool_t *pool)
+{
+   if (!pool)
+      return;
+
+   if (pool->nlive || pool->bstats.nlive) {
+      pool->dead = true;
+      return;
+   }
+
+   pool_release (pool);
+}
+
+void *pool_alloc (pool_t *pool, size_t size)
+{
+   return pool_alloc_kind (pool, size, 0);
+}
+
+bool pool_iterate (pool_t *pool, size_t size, void (*fptr) (void *))
+{
+   return pool_iterate_kind (pool, size, 0, fptr);
+}
+
+#ifdef POOL_USE_MALLOC
+
+void *pool_alloc_kind (pool_t *pool, size_t size, unsigned kind)
+{
+   if (!pool || !size || size > POOL_MAX_OBJSIZE || kind >= POOL_NKINDS)
+      return NULL;
+
+   size_t objsize = (size + CLASS_GRAIN - 1) & ~(size_t)(CLASS_GRAIN - 1);
+
+   if (!pool_reserve (pool, objsize))
+      return NULL;
+
+   pool_obj_t *ret = mem_calloc (1, sizeof *ret + objsize);
+   if (!ret) {
+      pool_unreserve (pool, objsize);
+      return NULL;
+   }
+
+   ret->pool = pool;
+   ret->objsize = objsize;
+   ret->kind = kind;
+   ret->next = pool->objs;
+   if (pool->objs)
+      pool->objs->prev = ret;
+   pool->objs = ret;
+
+   pool->nlive++;
+
+   return &ret[1];
+}
+
+void pool_free (void *obj)
+{
+   if (!obj)
+      return;
+
+   pool_obj_t *hdr = &((pool_obj_t *)obj)[-1];
+   pool_t *pool = hdr->pool;
+
+   pool_unreserve (pool, hdr->objsize);
+
+   if (hdr->prev) {
+      hdr->prev->next = hdr->next;
+   } else {
+      pool->objs = hdr->next;
+   }
+   if (hdr->next)
+      hdr->next->prev = hdr->prev;
+
+   mem_free (hdr);
+
+   pool->nlive--;
+   if (pool->dead && !pool->nlive && !pool->bstats.nlive)
+      pool_release (pool);
+}
+
+pool_t *pool_owner (void *obj)
+{
+   return obj ? ((pool_obj_t *)obj)[-1].pool : NULL;
+}
+
+bool pool_iterate_kind (pool_t *pool, size_t size, unsigned kind,
+                        void (*fptr) (void *))
+{
+   if (!pool || !fptr || !size || size > POOL_MAX_OBJSIZE ||
+       kind >= POOL_NKINDS)
+      return false;
+
+   size_t objsize = (size + CLASS_GRAIN - 1) & ~(size_t)(CLASS_GRAIN - 1);
+
+   for (pool_obj_t *hdr = pool->objs; hdr; hdr = hdr->next) {
+      if (hdr->objsize == objsize && hdr->kind == kind)
+         fptr (&hdr[1]);
+   }
+
+   return true;
+}
+
+#else
+
+static slab_t *slab_new (pool_t *pool, size_t objsize, unsigned kind)
+{
+   slab_t *ret = mem_memalign (SLAB_SIZE, SLAB_SIZE);
+   if (!ret)
+      return NULL;
+
+   ret->pool = pool;
+   ret->next = NULL;
+   ret->objsize = objsize;
+   ret->kind = kind;
+   ret->nobjs = (SLAB_SIZE - SLAB_HEADER) / objsize;
+   ret->ncarved = 0;
+
+   pool->nslabs++;
+
+   return ret;
+}
+
+void *pool_alloc_kind (pool_t *pool, size_t size, unsigned kind)
+{
+   void *ret = NULL;
+
+   if (!pool || !size || size > POOL_MAX_OBJSIZE || kind >= POOL_NKINDS)
+      return NULL;
+
+   struct pool_class_t *class = &pool->classes[CLASS_INDEX (kind, size)];
+   size_t objsize = ((size - 1) / CLASS_GRAIN + 1) * CLASS_GRAIN;
+
+   if (!pool_reserve (pool, objsize))
+      return NULL;
+
+   if (class->freelist) {
+
+      ret = class->freelist;
+      class->freelist = *(void **)ret;
+
+   } else {
+
+      slab_t *slab = class->slabs;
+      if (!slab || slab->ncarved == slab->nobjs) {
+         if (!(slab = slab_new (pool, objsize, kind))) {
+            pool_unreserve (pool, objsize);
+            return NULL;
+         }
+         slab->next = class->slabs;
+         class->slabs = slab;
+      }
+
+      uint8_t *base = (uint8_t *)slab + SLAB_HEADER;
+      ret = &base[slab->ncarved++ * objsize];
+   }
+
+   memset (ret, 0, objsize);
+   pool->nlive++;
+
+   return ret;
+}
+
+void pool_free (void *obj)
+{
+   if (!obj)
+      return;
+
+   slab_t *slab = (slab_t *)((uintptr_t)obj & ~(uintptr_t)(SLAB_SIZE - 1));
+   pool_t *pool = slab->pool;
+   struct pool_class_t *class =
+      &pool->classes[CLASS_INDEX (slab->kind, slab->objsize)];
+
+   *(void **)obj = class->freelist;
+   class->freelist = obj;
+
+   pool_unreserve (pool, slab->objsize);
+   pool->nlive--;
+   if (pool->dead && !pool->nlive && !pool->bstats.nlive)
+      pool_release (pool);
+}
+
+pool_t *pool_owner (void *obj)
+{
+   if (!obj)
+      return NULL;
+
+   return ((slab_t *)((uintptr_t)obj & ~(uintptr_t)(SLAB_SIZE - 1)))->pool;
+}
+
+static int ptr_cmp (const void *lhs, const void *rhs)
+{
+   uintptr_t l = (uintptr_t)*(void * const *)lhs,
+             r = (uintptr_t)*(void * const *)rhs;
+   return (l > r) - (l < r);
+}
+
+bool pool_iterate_kind (pool_t *pool, size_t size, unsigned kind,
+                        void (*fptr) (void *))
+{
+   if (!pool || !fptr || !size || size > POOL_MAX_OBJSIZE ||
+       kind >= POOL_NKINDS)
+      return false;
+
+   struct pool_class_t *class = &pool->classes[CLASS_INDEX (kind, size)];
+   size_t objsize = ((size - 1) / CLASS_GRAIN + 1) * CLASS_GRAIN;
+
+   // Objects on the free list are not live; collect them so that the
+   // carved objects can be checked against them.
+   size_t nfree = 0;
+   for (void *obj = class->freelist; obj; obj = *(void **)obj)
+      nfree++;
+
+   void **freed = NULL;
+   if (nfree) {
+      if (!(freed = mem_malloc (nfree * sizeof *freed)))
+         return false;
+
+      size_t i = 0;
+      for (void *obj = class->freelist; obj; obj = *(void **)obj)
+         freed[i++] = obj;
+
+      qsort (freed, nfree, sizeof *freed, ptr_cmp);
+   }
+
+   for (slab_t *slab = class->slabs; slab; slab = slab->next) {
+      uint8_t *base = (uint8_t *)slab + SLAB_HEADER;
+      for (size_t i=0; i<slab->ncarved; i++) {
+         void *obj = &base[i * objsize];
+         if (!nfree || !bsearch (&obj, freed, nfree, sizeof *freed, ptr_cmp))
+            fptr (obj);
+      }
+   }
+
+   mem_free (freed);
+
+   return true;
+}
+
+#endif
+
+#ifdef POOL_USE_MALLOC
+
+struct arena_t {
+   size_t objsize;
+   void **objs;
+   size_t nobjs;
+   size_t nalloced;
+};
+
+arena_t *arena_new (size_t objsize)
+{
+   if (!objsize)
+      return NULL;
+
+   arena_t *ret = mem_calloc (1, sizeof *ret);
+   if (!ret)
+      return NULL;
+
+   ret->objsize = objsize;
+
+   return ret;
+}
+
+void arena_del (arena_t *arena)
+{
+   if (!arena)
+      return;
+
+   arena_reset (arena);
+   mem_free (arena->objs);
+   mem_free (arena);
+}
+
+void *arena_alloc (arena_t *arena)
+{
+   if (!arena)
+      return NULL;
+
+   if (arena->nobjs == arena->nalloced) {
+      size_t newsize = arena->nalloced ? arena->nalloced * 2 : 64;
+      void **tmp = mem_realloc (arena->objs, newsize * sizeof *tmp);
+      if (!tmp)
+         return NULL;
+      arena->objs = tmp;
+      arena->nalloced = newsize;
+   }
+
+   void *ret = mem_calloc (1, arena->objsize);
+   if (!ret)
+      return NULL;
+
+   arena->objs[arena->nobjs++] = ret;
+
+   return ret;
+}
+
+void arena_iterate (arena_t *arena, void (*fptr) (void *))
+{
+   if (!arena || !fptr)
+      return;
+
+   for (size_t i=0; i<arena->nobjs; i++) {
+      fptr (arena->objs[i]);
+   }
+}
+
+void arena_reset (arena_t *arena)
+{
+   if (!arena)
+      return;
+
+   for (size_t i=0; i<arena->nobjs; i++) {
+      mem_free (arena->objs[i]);
+   }
+   arena->nobjs = 0;
+}
+
+size_t arena_nchunks (const arena_t *arena)
+{
+   (void)arena;
+   return 0;
+}
+
+#else
+
+#define ARENA_CHUNK_SIZE   ((size_t)1 << 16)
+
+typedef struct arena_chunk_t arena_chunk_t;
+struct arena_chunk_t {
+   arena_chunk_t *next;
+   size_t         nobjs;
+};
+
+#define CHUNK_HEADER       ((sizeof (arena_chunk_t) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1))
+
+struct arena_t {
+   size_t objsize;
+   size_t perchunk;
+   arena_chunk_t *first;
+   arena_chunk_t *cur;
+   size_t nobjs;
+   size_t nchunks;
+};
+
+arena_t *arena_new (size_t objsize)
+{
+   objsize = (objsize + CLASS_GRAIN - 1) & ~(size_t)(CLASS_GRAIN - 1);
+
+   if (!objsize || objsize > ARENA_CHUNK_SIZE - CHUNK_HEADER)
+      return NULL;
+
+   arena_t *ret = mem_calloc (1, sizeof *ret);
+   if (!ret)
+      return NULL;
+
+   ret->objsize = objsize;
+   ret->perchunk = (ARENA_CHUNK_SIZE - CHUNK_HEADER) / objsize;
+
+   return ret;
+}
+
+void arena_del (arena_t *arena)
+{
+   if (!arena)
+      return;
+
+   arena_chunk_t *chunk = arena->first;
+   while (chunk) {
+      arena_chunk_t *next = chunk->next;
+      mem_free (chunk);
+      chunk = next;
+   }
+
+   mem_free (arena);
+}
+
+static arena_chunk_t *arena_chunk_new (arena_t *arena)
+{
+   arena_chunk_t *ret = mem_malloc (ARENA_CHUNK_SIZE);
+   if (!ret)
+      return NULL;
+
+   ret->next = NULL;
+   ret->nobjs = 0;
+
+   arena->nchunks++;
+
+   return ret;
+}
+
+void *arena_alloc (arena_t *arena)
+{
+   if (!arena)
+      return NULL;
+
+   if (!arena->cur) {
+      if (!arena->first && !(arena->first = arena_chunk_new (arena)))
+         return NULL;
+      arena->cur = arena->first;
+   }
+
+   if (arena->cur->nobjs == arena->perchunk) {
+      if (!arena->cur->next && !(arena->cur->next = arena_chunk_new (arena)))
+         return NULL;
+      arena->cur = arena->cur->next;
+      arena->cur->nobjs = 0;
+   }
+
+   uint8_t *base = (uint8_t *)arena->cur + CHUNK_HEADER;
+   void *ret = &base[arena->cur->nobjs++ * arena->objsize];
+
+   memset (ret, 0, arena->objsize);
+   arena->nobjs++;
+
+   return ret;
+}
+
+void arena_iterate (arena_t *arena, void (*fptr) (void *))
+{
+   if (!arena || !fptr || !arena->cur)
+      return;
+
+   for (arena_chunk_t *chunk = arena->first; chunk; chunk = chunk->next) {
+      uint8_t *base = (uint8_t *)chunk + CHUNK_HEADER;
+      for (size_t i=0; i<chunk->nobjs; i++) {
+         fptr (&base[i * arena->objsize]);
+      }
+      if (chunk == arena->cur)
+         break;
+   }
+}
+
+void arena_reset (arena_t *arena)
+{
+   if (!arena || !arena->cur)
+      return;
+
+   for (arena_chunk_t *chunk = arena->first; chunk; chunk = chunk->next) {
+      chunk->nobjs = 0;
+      if (chunk == arena->cur)
+         break;
+   }
+
+   arena->cur = NULL;
+   arena->nobjs = 0;
+}
+
+size_t arena_nchunks (const arena_t *arena)
+{
+   return arena ? arena->nchunks : 0;
+}
+
+#endif
+
+static size_t block_class (size_t size)
+{
+   size_t ret = 0;
+   while (((size_t)1 << (ret + BLOCK_MIN_SHIFT)) < size)
+      ret++;
+   return ret;
+}
+
+// A host allocator gets the large blocks too, so that it sees all of the
+// library's memory.
+static void *block_map (size_t size)
+{
+   if (mem_hooked ())
+      return mem_calloc (1, size);
+
+#if defined (POOL_USE_MALLOC)
+   return mem_calloc (1, size);
+#elif defined (PLATFORM_WINDOWS)
+   return VirtualAlloc (NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+   void *ret = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   return ret==MAP_FAILED ? NULL : ret;
+#endif
+}
+
+static void block_unmap (void *block, size_t size)
+{
+   if (mem_hooked ()) {
+      mem_free (block);
+      return;
+   }
+
+#if defined (POOL_USE_MALLOC)
+   size = size;
+   mem_free (block);
+#elif defined (PLATFORM_WINDOWS)
+   size = size;
+   VirtualFree (block, 0, MEM_RELEASE);
+#else
+   munmap (block, size);
+#endif
+}
+
+void *pool_block_alloc (pool_t *pool, size_t size, bool zero)
+{
+   block_t *block = NULL;
+
+   if (!size)
+      size = 1;
+
+   if (size > POOL_BLOCK_MAX) {
+
+      size = (sizeof *block + size + BLOCK_PAGE - 1) & ~(BLOCK_PAGE - 1);
+      if (pool && !pool_reserve (pool, size))
+         return NULL;
+
+      // Mapped memory is always zeroed
+      if (!(block = block_map (size))) {
+         pool_uncharge (pool, size);
+         return NULL;
+      }
+
+      if (pool)
+         pool->bstats.nmapped++;
+
+   } else {
+
+      size_t cindex = block_class (size);
+      size = (size_t)1 << (cindex + BLOCK_MIN_SHIFT);
+      if (pool && !pool_reserve (pool, size))
+         return NULL;
+
+      if (pool && (block = pool->blocks[cindex])) {
+         pool->blocks[cindex] = *(block_t **)&block[1];
+         pool->bstats.ncached--;
+         pool->bstats.ncached_bytes -= size;
+         pool->bstats.nreused++;
+         if (zero)
+            memset (&block[1], 0, size);
+      } else {
+         block = zero ? mem_calloc (1, sizeof *block + size)
+                      : mem_malloc (sizeof *block + size);
+         if (!block) {
+            pool_uncharge (pool, size);
+            return NULL;
+         }
+      }
+   }
+
+   block->pool = pool;
+   block->size = size;
+
+   if (pool) {
+      pool->bstats.nallocs++;
+      pool->bstats.nlive++;
+   }
+
+   return &block[1];
+}
+
+void pool_block_free (void *obj)
+{
+   if (!obj)
+      return;
+
+   block_t *block = &((block_t *)obj)[-1];
+   pool_t *pool = block->pool;
+   size_t size = block->size;
+
+   if (size > POOL_BLOCK_MAX) {
+      block_unmap (block, size);
+   } else if (pool && pool->bstats.ncached_bytes + size <= BLOCK_CACHE_BYTES
+                   && !pool->dead) {
+      size_t cindex = block_class (size);
+      *(block_t **)&block[1] = pool->blocks[cindex];
+      pool->blocks[cindex] = block;
+      pool->bstats.ncached++;
+      pool->bstats.ncached_bytes += size;
+   } else {
+      mem_free (block);
+   }
+
+   if (!pool)
+      return;
+
+   pool_unreserve (pool, size);
+   pool->bstats.nlive--;
+   if (pool->dead && !pool->nlive && !pool->bstats.nlive)
+      pool_release (pool);
+}
+
+size_t pool_block_size (const void *obj)
+{
+   if (!obj)
+      return 0;
+
+   const block_t *block = &((const block_t *)obj)[-1];
+   return block->size > POOL_BLOCK_MAX ? block->size - sizeof *block
+                                       : block->size;
+}
+
+void pool_block_stats (const pool_t *pool, pool_block_stats_t *stats)
+{
+   if (!stats)
+      return;
+
+   memset (stats, 0, sizeof *stats);
+   if (pool)
+      *stats = pool->bstats;
+}
+
+size_t arena_nobjs (const arena_t *arena)
+{
+   return arena ? arena->nobjs : 0;
+}
+
+size_t pool_nlive (const pool_t *pool)
+{
+   return pool ? pool->nlive : 0;
+}
+
+size_t pool_nslabs (const pool_t *pool)
+{
+   return pool ? pool->nslabs : 0;
+}
+
+bool pool_charge (pool_t *pool, size_t nbytes)
+{
+   return pool ? pool_reserve (pool, nbytes) : true;
+}
+
+void pool_uncharge (pool_t *pool, size_t nbytes)
+{
+   if (pool)
+      pool_unreserve (pool, nbytes);
+}
+
+size_t pool_set_limit (pool_t *pool, size_t nbytes)
+{
+   if (!pool)
+      return 0;
+
+   size_t ret = pool->limit;
+   pool->limit = nbytes;
+   return ret;
+}
+
+size_t pool_nbytes (const pool_t *pool)
+{
+   return pool ? pool->nbytes : 0;
+}
+
+size_t pool_nbytes_high (const pool_t *pool)
+{
+   return pool ? pool->nbytes_high : 0;
+}
+
+size_t pool_nrefused (const pool_t *pool)
+{
+   return pool ? pool->nrefused : 0;
+}
+
+void pool_print (const pool_t *pool, FILE *outf)
+{
+   if (!outf)
+      outf = stdout;
+
+   if (!pool) {
+      fprintf (outf, "NULL pool\n");
+      return;
+   }
+
+   fprintf (outf, "POOL: %zu live objects in %zu slabs of %zu bytes\n",
+                  pool->nlive, pool->nslabs, SLAB_SIZE);
+   fprintf (outf, "POOL: %zu live blocks, %zu cached (%zu bytes)\n",
+                  pool->bstats.nlive, pool->bstats.ncached,
+                  pool->bstats.ncached_bytes);
+
+   for (size_t i=0; i<POOL_NKINDS * NCLASSES; i++) {
+      const struct pool_class_t *class = &pool->classes[i];
+      size_t nslabs = 0, nfree = 0;
+
+      for (const slab_t *slab = class->slabs; slab; slab = slab->next)
+         nslabs++;
+
+      for (void *obj = class->freelist; obj; obj = *(void **)obj)
+         nfree++;
+
+      if (nslabs && i < NCLASSES) {
+         fprintf (outf, "   [%3zu bytes]: %zu slabs, %zu on free list\n",
+                        (i + 1) * CLASS_GRAIN, nslabs, nfree);
+      } else if (nslabs) {
+         fprintf (outf, "   [%3zu bytes, kind %zu]: %zu slabs, %zu on free list\n",
+                        (i % NCLASSES + 1) * CLASS_GRAIN, i / NCLASSES,
+                        nslabs, nfree);
+      }
+   }
+}
+
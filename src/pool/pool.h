@@ -0,0 +1,115 @@
+
+#ifndef H_POOL
+#define H_POOL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Small fixed-size objects are carved out of cache-line aligned slabs,
+// segregated by size, and recycled through per-size free lists. Requests
+// larger than POOL_MAX_OBJSIZE are refused (the caller must use malloc).
+//
+// Compile with -DPOOL_USE_MALLOC to route every allocation through plain
+// calloc()/free() instead, so that ASan and valgrind can see each object.
+#define POOL_MAX_OBJSIZE      (256)
+
+// Objects of each kind are carved from slabs of their own, so that
+// pool_iterate_kind() visits the objects of one kind only, however many
+// others share their size. pool_alloc() and pool_iterate() use kind 0.
+#define POOL_NKINDS           (4)
+
+// Variable-sized byte blocks (buffer payloads) are rounded up to a power
+// of two and, once freed, cached by the pool for reuse by the next block
+// of that size class. Blocks larger than POOL_BLOCK_MAX are mapped from
+// the OS directly and unmapped when freed.
+#define POOL_BLOCK_MAX        ((size_t)1 << 17)
+
+typedef struct pool_t pool_t;
+
+typedef struct pool_block_stats_t pool_block_stats_t;
+struct pool_block_stats_t {
+   size_t nallocs;      // Blocks handed out,
+   size_t nreused;      // ... of which came from the cache
+   size_t nmapped;      // ... and of which were mapped
+   size_t nlive;
+   size_t ncached;
+   size_t ncached_bytes;
+};
+
+// An arena hands out objects of a single size with a bump pointer and
+// never frees them individually; everything allocated since the last
+// reset is released at once by arena_reset(). The chunks are kept for
+// reuse, so an arena that is reset regularly stops calling malloc().
+typedef struct arena_t arena_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   pool_t *pool_new (void);
+
+   // Objects that are still live when the pool is deleted remain valid;
+   // the slabs are released when the last of those objects is freed.
+   void pool_del (pool_t *pool);
+
+   // Returned memory is zeroed and 8-byte aligned. Objects are freed to
+   // the pool that allocated them, so pool_free() does not need the pool.
+   void *pool_alloc (pool_t *pool, size_t size);
+   void *pool_alloc_kind (pool_t *pool, size_t size, unsigned kind);
+   void pool_free (void *obj);
+
+   // Calls fptr on every live object allocated with the given size (as
+   // rounded by pool_alloc()). fptr must not allocate from or free to
+   // the pool. Returns false, without calling fptr, if out of memory.
+   bool pool_iterate (pool_t *pool, size_t size, void (*fptr) (void *));
+   bool pool_iterate_kind (pool_t *pool, size_t size, unsigned kind,
+                           void (*fptr) (void *));
+
+   // Returns the pool that allocated obj.
+   pool_t *pool_owner (void *obj);
+
+   // Each pool counts the bytes of its live objects, plus any memory
+   // that was allocated elsewhere on behalf of those objects and charged
+   // to it. Once a limit is set (0 removes it), allocations and charges
+   // that would exceed it are refused and counted. pool_charge() and
+   // pool_uncharge() accept a NULL pool and then do nothing.
+   bool pool_charge (pool_t *pool, size_t nbytes);
+   void pool_uncharge (pool_t *pool, size_t nbytes);
+   size_t pool_set_limit (pool_t *pool, size_t nbytes);
+   size_t pool_nbytes (const pool_t *pool);
+   size_t pool_nbytes_high (const pool_t *pool);
+   size_t pool_nrefused (const pool_t *pool);
+
+   // Blocks are charged to the pool (which may be NULL, in which case
+   // nothing is cached or counted) and are zeroed only when asked to be.
+   // Returned memory is 16-byte aligned.
+   void *pool_block_alloc (pool_t *pool, size_t size, bool zero);
+   void pool_block_free (void *block);
+   size_t pool_block_size (const void *block);
+   void pool_block_stats (const pool_t *pool, pool_block_stats_t *stats);
+
+   size_t pool_nlive (const pool_t *pool);
+   size_t pool_nslabs (const pool_t *pool);
+   void pool_print (const pool_t *pool, FILE *outf);
+
+   arena_t *arena_new (size_t objsize);
+   void arena_del (arena_t *arena);
+
+   // Returned memory is zeroed and 8-byte aligned.
+   void *arena_alloc (arena_t *arena);
+
+   // Calls fptr on every object allocated since the last reset, in
+   // allocation order.
+   void arena_iterate (arena_t *arena, void (*fptr) (void *));
+   void arena_reset (arena_t *arena);
+
+   size_t arena_nobjs (const arena_t *arena);
+   size_t arena_nchunks (const arena_t *arena);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <string.h>
+#include <ctype.h>
 
 #include <inttypes.h>
 
@@ -9,8 +10,7 @@
 #include "rt/rt.h"
 #include "ll/ll.h"
 #include "token/token.h"
-
-#include "xstring/xstring.h"
+#include "mem/mem.h"
 
 #define WEXPECTED_LIST  ("Expected list expression")
 
@@ -127,7 +127,7 @@ static atom_t *eval_string (rt_t *rt, const atom_t *sym, const char *string)
    char *tmp = NULL,
         *copy = NULL;
 
-   if (!(copy = xstr_dup (string))) {
+   if (!(copy = mem_strdup (string))) {
       fprintf (stderr, "Out of memory\n");
       goto errorexit;
    }
@@ -159,14 +159,11 @@ static atom_t *eval_string (rt_t *rt, const atom_t *sym, const char *string)
    error = false;
 
 errorexit:
-   free (copy);
+   mem_free (copy);
 
    atom_del (expr);
 
-   for (size_t i=0; tokens[i]; i++) {
-      token_del (tokens[i]);
-   }
-   free (tokens);
+   token_array_del (tokens);
 
    if (error) {
       atom_del (ret);
@@ -334,10 +331,31 @@ static void *debug_find_cmd (const char *cmd)
    return NULL;
 }
 
+// Splits the line in place at every ':' into at most nfields - 1 fields,
+// followed by a NULL. Whitespace around the first field is removed.
+static void debug_split (char *line, char **fields, size_t nfields)
+{
+   size_t n = 0;
+
+   while (isspace ((unsigned char)*line))
+      line++;
+
+   while (line && n < nfields - 1) {
+      fields[n++] = line;
+      if ((line = strchr (line, ':')))
+         *line++ = 0;
+   }
+   fields[n] = NULL;
+
+   size_t len = strlen (fields[0]);
+   while (len && isspace ((unsigned char)fields[0][len - 1]))
+      fields[0][--len] = 0;
+}
+
 static atom_t *debugger (rt_t *rt, atom_t *sym, atom_t **args, size_t nargs)
 {
    char line[1024 + 3];
-   char **cmd = NULL;
+   char *cmd[64];
 
    nargs = nargs;
 
@@ -354,21 +372,13 @@ static atom_t *debugger (rt_t *rt, atom_t *sym, atom_t **args, size_t nargs)
       atom_del (ret);
       ret = NULL;
 
-      xstr_delarray (cmd); cmd = NULL;
-
       char *tmp = strchr (line, '\n');
       if (tmp)
          *tmp = 0;
 
-      cmd = xstr_split (line, ":");
-      if (!cmd) {
-         fprintf (stderr, "Command [%s] not understood\n", line);
-         continue;
-      }
+      debug_split (line, cmd, sizeof cmd / sizeof cmd[0]);
       atom_t *(*fptr) (rt_t *, atom_t *, atom_t **, char **);
 
-      xstr_trim (cmd[0]);
-
       fptr = debug_find_cmd (cmd[0]);
       if (!fptr) {
          fprintf (stderr, "\n> ");
@@ -381,8 +391,6 @@ static atom_t *debugger (rt_t *rt, atom_t *sym, atom_t **args, size_t nargs)
       fprintf (stderr, "\n> ");
    }
 
-   xstr_delarray (cmd); cmd = NULL;
-
    return ret;
 }
 
@@ -475,16 +483,12 @@ atom_t *builtins_REST (rt_t *rt, const atom_t *sym, const atom_t **args, size_t
       return atom_new (atom_NIL, NULL);
    }
 
-   atom_t *ret = atom_list_new ();
+   atom_t *ret = atom_list_slice (args[0], 1, len);
    if (!ret) {
       fprintf (stderr, "OOM\n");
       return NULL;
    }
 
-   for (size_t i=1; i<len; i++) {
-      atom_list_ins_tail (ret, atom_dup (atom_list_index (args[0], i)));
-   }
-
    return ret;
 }
 
@@ -503,12 +507,7 @@ atom_t *builtins_LENGTH (rt_t *rt, const atom_t *sym, const atom_t **args, size_
                                          NULL);
    }
 
-   int64_t len = atom_list_length (args[0]);
-   atom_t *ret = atom_new (atom_NIL, NULL);
-   ret->type = atom_INT;
-   *(int64_t *)ret->data = len;
-
-   return ret;
+   return atom_int_new (atom_list_length (args[0]));
 }
 
 atom_t *builtins_NAPPEND (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs)
@@ -523,15 +522,18 @@ atom_t *builtins_NAPPEND (rt_t *rt, const atom_t *sym, const atom_t **args, size
       return NULL;
 
    for (size_t i=1; args[i]; i++) {
-      if (!(atom_list_ins_tail ((atom_t *)args[0], atom_dup (args[i]))))
+      atom_t *tmp = atom_dup (args[i]);
+      if (!(atom_list_ins_tail ((atom_t *)args[0], tmp))) {
+         atom_del (tmp);
          goto errorexit;
+      }
    }
 
    error = false;
 
 errorexit:
 
-   return error ? NULL : (atom_t *)args[0];
+   return error ? NULL : atom_dup (args[0]);
 }
 
 atom_t *builtins_NALLOC (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs)
@@ -545,8 +547,7 @@ atom_t *builtins_NALLOC (rt_t *rt, const atom_t *sym, const atom_t **args, size_
                             atom_array_dup (args));
    }
 
-   int64_t tmp = *(int64_t *)args[0]->data;
-   size_t len = tmp;
+   size_t len = args[0]->ival;
 
    return atom_buffer_new (NULL, len);
 }
@@ -569,12 +570,103 @@ atom_t *builtins_NFREE (rt_t *rt, const atom_t *sym, const atom_t **args, size_t
                             atom_array_dup (args));
    }
 
-#warning TODO: We need a better way than this
-   atom_del ((atom_t *)args[0]);
-
+   // args[0] is our own copy of the buffer, and is deleted by the caller
+   // along with the rest of the arguments. The buffer itself is released
+   // once its last reference is deleted or collected.
    return atom_new (atom_NIL, NULL);
 }
 
+// (bi_nslice buffer from to) shares the bytes of the buffer; to is
+// optional and defaults to the end of the buffer.
+atom_t *builtins_NSLICE (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs)
+{
+   if (nargs!=2 && nargs!=3) {
+      return rt_trap_a (rt, (atom_t *)sym,
+                            atom_new (atom_SYMBOL, "TRAP_PARAMCOUNT"),
+                            (atom_t **)args,
+                            atom_array_dup (args));
+   }
+
+   if (args[0]->type != atom_BUFFER || args[1]->type != atom_INT ||
+       (nargs==3 && args[2]->type != atom_INT) ||
+       args[1]->ival < 0 || (nargs==3 && args[2]->ival < args[1]->ival)) {
+      return rt_trap_a (rt, (atom_t *)sym,
+                            atom_new (atom_SYMBOL, "TRAP_BADPARAM"),
+                            (atom_t **)args,
+                            atom_array_dup (args));
+   }
+
+   size_t to = nargs==3 ? (size_t)args[2]->ival : atom_buffer_length (args[0]);
+
+   return atom_buffer_slice (args[0], args[1]->ival, to);
+}
+
+atom_t *builtins_NLENGTH (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs)
+{
+   if (nargs!=1 || args[0]->type != atom_BUFFER) {
+      return rt_trap_a (rt, (atom_t *)sym,
+                            atom_new (atom_SYMBOL, "TRAP_BADPARAM"),
+                            (atom_t **)args,
+                            atom_array_dup (args));
+   }
+
+   return atom_int_new (atom_buffer_length (args[0]));
+}
+
+// Returns the buffer block statistics as a list of (name value) pairs
+atom_t *builtins_NSTATS (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs)
+{
+   bool error = true;
+   atom_t *ret = NULL;
+
+   if (nargs!=0) {
+      return rt_trap_a (rt, (atom_t *)sym,
+                            atom_new (atom_SYMBOL, "TRAP_PARAMCOUNT"),
+                            (atom_t **)args,
+                            atom_array_dup (args));
+   }
+
+   pool_block_stats_t stats;
+   rt_buffer_stats (rt, &stats);
+
+   const struct {
+      const char *name;
+      size_t value;
+   } fields[] = {
+      { "nallocs",         stats.nallocs        },
+      { "nreused",         stats.nreused        },
+      { "nmapped",         stats.nmapped        },
+      { "nlive",           stats.nlive          },
+      { "ncached",         stats.ncached        },
+      { "ncached_bytes",   stats.ncached_bytes  },
+   };
+
+   if (!(ret = atom_list_new ()))
+      goto errorexit;
+
+   for (size_t i=0; i<sizeof fields/sizeof fields[0]; i++) {
+      atom_t *pair = atom_list_new ();
+      if (!pair || !atom_list_ins_tail (ret, pair)) {
+         atom_del (pair);
+         goto errorexit;
+      }
+      if (!atom_list_ins_tail (pair, atom_new (atom_SYMBOL, fields[i].name)) ||
+          !atom_list_ins_tail (pair, atom_int_new (fields[i].value)))
+         goto errorexit;
+   }
+
+   error = false;
+
+errorexit:
+
+   if (error) {
+      atom_del (ret);
+      ret = NULL;
+   }
+
+   return ret;
+}
+
 atom_t *builtins_SET (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs)
 {
    atom_t *ret = NULL;
@@ -680,75 +772,62 @@ atom_t *builtins_CONCAT (rt_t *rt, const atom_t *sym, const atom_t **args, size_
    rt = rt;
    sym = sym;
 
-   bool error = true;
-   atom_t *ret = atom_list_new ();
-
-   for (size_t i=0; args[i]; i++) {
-      size_t len = atom_list_length (args[i]);
-      for (size_t j=0; j<len; j++) {
-         if (!atom_list_ins_tail (ret, atom_dup (atom_list_index (args[i], j))))
-            goto errorexit;
-      }
-   }
-
-   error = false;
-
-errorexit:
-   if (error) {
-      atom_del (ret);
-      ret = NULL;
-   }
-
-   return ret;
+   return atom_concatenate_a (args);
 }
 
 atom_t *builtins_LET (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs)
 {
    nargs = nargs;
 
-   atom_t *locals = atom_list_new ();
-   if (!locals)
-      return NULL;
+   atom_t *ret = NULL;
+   atom_t *locals = NULL;
+   atom_t *symbols = NULL;
+   atom_t *entry = NULL;
+   atom_t *val = NULL;
+
+   if (!(locals = atom_list_new ()))
+      goto errorexit;
 
    size_t len = atom_list_length (args[0]);
    for (size_t i=0; i<len; i++) {
-      atom_t *entry = atom_list_new ();
-      if (!entry)
-         return NULL;
+      if (!(entry = atom_list_new ()))
+         goto errorexit;
+
       atom_t *existing = (atom_t *)atom_list_index (args[0], i);
       atom_t *symbol = (atom_t *)atom_list_index (existing, 0);
-      atom_t *val = rt_eval (rt, sym, atom_list_index (existing, 1));
+      val = rt_eval (rt, sym, atom_list_index (existing, 1));
 
       if (!(atom_list_ins_tail (entry, atom_dup (symbol))))
-         return NULL;
-
-      if (!(atom_list_ins_tail (entry, atom_dup (val))))
-         return NULL;
+         goto errorexit;
 
-      if (!(atom_list_ins_tail (locals, atom_dup (entry))))
-         return NULL;
+      if (!(atom_list_ins_tail (entry, val)))
+         goto errorexit;
+      val = NULL;
 
-      atom_del (entry);
-      atom_del (val);
+      if (!(atom_list_ins_tail (locals, entry)))
+         goto errorexit;
+      entry = NULL;
    }
 
-   atom_t *symbols = sym ? atom_concatenate (sym, locals, NULL)
-                         : atom_dup (locals);
-
-   atom_t *ret = NULL;
+   symbols = sym ? atom_concatenate (sym, locals, NULL)
+                 : atom_dup (locals);
 
    for (size_t i=1; args[i]; i++) {
       atom_del (ret); ret = NULL;
       ret = rt_eval (rt, symbols, args[i]);
    }
 
-   atom_del (symbols);
-   atom_del (locals);
-
    if (!ret) {
       // TODO: issue a trap
    }
 
+errorexit:
+
+   atom_del (val);
+   atom_del (entry);
+   atom_del (symbols);
+   atom_del (locals);
+
    return ret;
 }
 
@@ -767,12 +846,11 @@ atom_t *builtins_DEFUN (rt_t *rt, const atom_t *sym, const atom_t **args, size_t
       return NULL;
    }
 
-   atom_t *fname = atom_dup (args[0]),
+   atom_t *fname = atom_dup_flagged (args[0], args[0]->flags | ATOM_FLAG_FUNC),
           *fval = atom_list_new ();
 
    atom_list_ins_tail (fval, atom_dup (args[1]));
    atom_list_ins_tail (fval, atom_dup (args[2]));
-   fname->flags |= ATOM_FLAG_FUNC;
 
    atom_t *ret = atom_dup (rt_symbol_add (rt->symbols, fname, fval));
 
@@ -791,16 +869,23 @@ atom_t *builtins_DEFEXT (rt_t *rt, const atom_t *sym, const atom_t **args, size_
                                          NULL);
    }
 
-   atom_t *tmp = (atom_t *)args[0];
-   tmp->flags |= ATOM_FLAG_FFI;
-
-   tmp = (atom_t *)args[1];
-   tmp->flags |= ATOM_FLAG_FFI;
+   // The arguments are flagged in copies: they, and the library name
+   // in the payload of the spec, may be shared with other atoms.
+   atom_t *name = atom_dup_flagged (args[0], args[0]->flags | ATOM_FLAG_FFI),
+          *spec = atom_dup_flagged (args[1], args[1]->flags | ATOM_FLAG_FFI),
+          *lib = spec ? atom_list_remove_head (spec) : NULL,
+          *ret = NULL;
 
-   tmp = (atom_t *)atom_list_index (args[1], 0);
-   tmp->flags |= ATOM_FLAG_FFI;
+   atom_t *tmp = lib ? atom_dup_flagged (lib, lib->flags | ATOM_FLAG_FFI) : NULL;
+   if (!tmp || !atom_list_ins_head (spec, tmp)) {
+      atom_del (tmp);
+   } else if (name) {
+      ret = atom_dup (rt_symbol_add (rt->symbols, name, spec));
+   }
 
-   atom_t *ret = atom_dup (rt_symbol_add (rt->symbols, args[0], args[1]));
+   atom_del (lib);
+   atom_del (spec);
+   atom_del (name);
 
    return ret;
 }
@@ -836,8 +921,8 @@ atom_t *builtins_DEFTYPE (rt_t *rt, const atom_t *sym, const atom_t **args, size
 
    const char *name = atom_to_string (a_name);
    int64_t type_id = rt_highest_type_id (),
-           size = *(int64_t *)a_size->data,
-           alignment = *(int64_t *)a_alignment->data;
+           size = a_size->ival,
+           alignment = a_alignment->ival;
 
    return atom_dup (rt_add_native_type (rt, name, type_id, size, alignment));
 }
@@ -929,8 +1014,8 @@ atom_t *builtins_NEWSTRUCT (rt_t *rt, const atom_t *sym, const atom_t **args, si
                                          NULL);
    }
 
-   int64_t *offsets = malloc ((sizeof *offsets) * (nfields + 1));
-   int64_t *lengths = malloc ((sizeof *lengths) * (nfields + 1));
+   int64_t *offsets = mem_malloc ((sizeof *offsets) * (nfields + 1));
+   int64_t *lengths = mem_malloc ((sizeof *lengths) * (nfields + 1));
    if (!offsets || !lengths) {
       fprintf (stderr, "OOM\n");
       return NULL;
@@ -945,8 +1030,8 @@ atom_t *builtins_NEWSTRUCT (rt_t *rt, const atom_t *sym, const atom_t **args, si
    for (size_t i=0; i<nfields; i++) {
       const atom_t *field = atom_list_index (sdef, i);
       const atom_t *field_entry = rt_eval (rt, sym, atom_list_index (field, 0));
-      int64_t field_length = *(int64_t *)(atom_list_index (field_entry, 1)->data);
-      int64_t field_align = *(int64_t *)(atom_list_index (field_entry, 2)->data);
+      int64_t field_length = atom_list_index (field_entry, 1)->ival;
+      int64_t field_align = atom_list_index (field_entry, 2)->ival;
 
       atom_del (field_entry);
 
@@ -970,18 +1055,45 @@ atom_t *builtins_NEWSTRUCT (rt_t *rt, const atom_t *sym, const atom_t **args, si
 
    offset = 0;
    for (size_t i=0; i<nfields; i++) {
-      memcpy (atom_buffer_offset (ret, offsets[i]),
-              atom_list_index (args[1], i)->data,
-              lengths[i]);
+      const atom_t *field = atom_list_index (args[1], i);
+      const void *src = NULL;
+      size_t srclen = 0;
+      if (field->type==atom_INT || field->type==atom_FLOAT) {
+         src = &field->ival;
+         srclen = sizeof field->ival;
+      }
+      if (field->type==atom_STRING) {
+         src = atom_to_string (field);
+         srclen = strlen (src) + 1;
+      }
+      // The bytes of a buffer are behind its view, and fields longer
+      // than the buffer are zero-filled
+      if (field->type==atom_BUFFER) {
+         src = atom_buffer_data (field);
+         srclen = atom_buffer_length (field);
+      }
+      if (srclen > (size_t)lengths[i])
+         srclen = lengths[i];
+
+      uint8_t *dst = atom_buffer_offset (ret, offsets[i]);
+      if (!dst) {
+         fprintf (stderr, "OOM\n");
+         atom_del (ret);
+         ret = NULL;
+         break;
+      }
+      if (srclen)
+         memcpy (dst, src, srclen);
+      memset (&dst[srclen], 0, lengths[i] - srclen);
 
       printf ("-------------------\n[%zu][%" PRIi64 "]\n", offsets[i], lengths[i]);
-      dumphex (atom_list_index (args[1], i)->data, lengths[i]);
+      dumphex (dst, lengths[i]);
    }
 
    printf ("===================== %" PRIi64 " =====================\n", total_length);
 
-   free (offsets);
-   free (lengths);
+   mem_free (offsets);
+   mem_free (lengths);
 
    atom_del (sdef);
 
@@ -1052,8 +1164,8 @@ static atom_t *builtins_opcalc (rt_t *rt, const atom_t *sym,
 
       bool is_int = args[i]->type==atom_INT;
 
-#define GETINT       (*(int64_t *)args[i]->data)
-#define GETFLOAT     (*(double *)args[i]->data)
+#define GETINT       (args[i]->ival)
+#define GETFLOAT     (args[i]->fval)
       if (i==0 && startval < 0) {
          final = is_int ? GETINT : GETFLOAT;
          i++;
@@ -1195,14 +1307,14 @@ static atom_t *builtins_opbits (rt_t *rt, const atom_t *sym,
    if (!args || !args[0] || args[0]->type!=atom_INT)
       goto errorexit;
 
-   int64_t final = *(int64_t *)args[0]->data;
+   int64_t final = args[0]->ival;
 
    for (size_t i=1; args[i]; i++) {
 
       if (args[i]->type!=atom_INT)
          goto errorexit;
 
-      int64_t val = *(int64_t *)args[i]->data;
+      int64_t val = args[i]->ival;
       switch (op) {
          case 'A': final = final & val;      break;
          case 'O': final = final | val;      break;
@@ -1308,8 +1420,8 @@ atom_t *builtins_IF (rt_t *rt, const atom_t *sym, const atom_t **args, size_t na
                 *iftrue = args[1],
                 *iffalse = args[2];
 
-   if (expr && ((expr->type==atom_INT && *(int64_t *)expr->data!=0) ||
-                (expr->type==atom_FLOAT && *(double *)expr->data!=0))) {
+   if (expr && ((expr->type==atom_INT && expr->ival!=0) ||
+                (expr->type==atom_FLOAT && expr->fval!=0))) {
       return rt_eval (rt, sym, iftrue);
    } else {
       return rt_eval (rt, sym, iffalse);
@@ -1352,7 +1464,7 @@ atom_t *builtins_WHILE (rt_t *rt, const atom_t *sym, const atom_t **args, size_t
 
    do {
       atom_t *tmp = rt_eval (rt, sym, expr_test);
-      int64_t expr_val = tmp ? *(int64_t *)tmp->data : 0;
+      int64_t expr_val = tmp ? tmp->ival : 0;
 
       atom_del (tmp);
       if (expr_val==0) {
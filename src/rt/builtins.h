@@ -24,6 +24,9 @@ atom_t *builtins_LENGTH (rt_t *rt, const atom_t *sym, const atom_t **args, size_
 atom_t *builtins_NAPPEND (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs);
 atom_t *builtins_NALLOC (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs);
 atom_t *builtins_NFREE (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs);
+atom_t *builtins_NSLICE (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs);
+atom_t *builtins_NLENGTH (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs);
+atom_t *builtins_NSTATS (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs);
 
 atom_t *builtins_SET (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs);
 atom_t *builtins_DEFINE (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs);
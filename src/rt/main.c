@@ -1,5 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifndef PLATFORM_WINDOWS
+#include <pthread.h>
+#endif
 
 #include "parser/parser.h"
 #include "parser/atom.h"
@@ -9,6 +14,80 @@
 
 
 #define TESTFILE     ("rt/test_input.csl")
+#define OOM_NITEMS   (50000)
+#define OOM_HEADROOM (64 * 1024)
+
+#define STREAM_INPUT ("(bi_define 'streamed \"a string longer than a chunk\")\n" \
+                      "; a comment that spans several chunks of input\n"  \
+                      "(bi_length (bi_list streamed 40 (+ 1 1)))\n")
+#define STREAM_CHUNK (8)
+
+// SHLIB_TEST_T is declared by TESTFILE; buf is 7 bytes at offset 24
+#define STRUCT_INPUT  ("(bi_newstruct 'SHLIB_TEST_T (bi_list 3 257 254 65537 " \
+                       "253 99999999999 |a1a2a3a4a5| 65539))")
+#define STRUCT_LENGTH (40)
+#define STRUCT_BUF    (24)
+#define STRUCT_FINAL  (32)
+
+// Runtimes on different threads share the interned names and source
+// positions, and nothing else
+#define THREADS         (4)
+#define THREAD_FORMS    (200)
+
+static size_t g_noom;
+static atom_t *count_oom (rt_t *rt, const atom_t *sym, const atom_t **args, size_t nargs)
+{
+   rt = rt;
+   sym = sym;
+   args = args;
+   nargs = nargs;
+
+   g_noom++;
+   return atom_new (atom_NIL, NULL);
+}
+
+#ifndef PLATFORM_WINDOWS
+static void *thread_eval (void *arg)
+{
+   size_t id = (size_t)arg;
+   rt_t *rt = rt_new ();
+   bool ok = rt != NULL;
+   char fname[32];
+
+   snprintf (fname, sizeof fname, "<thread-%zu>", id);
+
+   for (size_t i=0; ok && i<THREAD_FORMS; i++) {
+      char src[128];
+      snprintf (src, sizeof src, "(bi_define 'shared_%zu (bi_list %zu %zu))\n"
+                                 "(bi_length shared_%zu)", i, i, id, i);
+
+      char *tmp = src;
+      token_t **tokens = token_read_string (&tmp, fname);
+      size_t index = 0;
+      atom_t *result = NULL;
+
+      ok = tokens != NULL;
+      while (ok && tokens[index]) {
+         atom_t *form = parser_parse (tokens, &index);
+         const char *file = NULL;
+         ok = form && atom_srcloc (form, &file, NULL, NULL) &&
+              strcmp (file, fname)==0;
+         atom_del (result);
+         result = ok ? rt_eval (rt, NULL, form) : NULL;
+         ok = ok && result;
+         atom_del (form);
+      }
+
+      ok = ok && result->type == atom_INT && result->ival == 2;
+      atom_del (result);
+      token_array_del (tokens);
+   }
+
+   rt_del (rt);
+
+   return ok ? arg : NULL;
+}
+#endif
 
 int main (void)
 {
@@ -21,6 +100,9 @@ int main (void)
       goto errorexit;
    }
 
+   // Whatever is still live when the runtime is deleted gets reported
+   rt_census_enable (rt, stdout);
+
    token_t **tokens = token_read_file (TESTFILE);
    if (!tokens) {
       XERROR ("Unable to read tokens from [%s]\n", TESTFILE);
@@ -65,19 +147,163 @@ int main (void)
       result = NULL;
    }
 
+   // Buffer fields of a struct get the bytes of the buffer, zero-filled
+   // to the length of the field
+   char structsrc[] = STRUCT_INPUT;
+   char *tmp = structsrc;
+   token_t **stokens = token_read_string (&tmp, "<struct>");
+   size_t sindex = 0;
+   atom_t *sform = stokens ? parser_parse (stokens, &sindex) : NULL;
+   atom_t *sbuf = sform ? rt_eval (rt, NULL, sform) : NULL;
+   static const uint8_t expected_buf[] = { 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0, 0 };
+   int32_t final = 0;
+   const uint8_t *sbytes = atom_buffer_data (sbuf);
+   bool filled = sbytes && atom_buffer_length (sbuf) == STRUCT_LENGTH &&
+                 memcmp (&sbytes[STRUCT_BUF], expected_buf, sizeof expected_buf)==0;
+   if (filled)
+      memcpy (&final, &sbytes[STRUCT_FINAL], sizeof final);
+   filled = filled && final == 65539;
+   atom_del (sbuf);
+   atom_del (sform);
+   token_array_del (stokens);
+   if (!filled) {
+      XERROR ("Struct fields were not filled from their values\n");
+      goto errorexit;
+   }
+   printf ("STRUCT: buffer field filled\n");
+
+   // Atoms leaked into the runtime's pool are collected, held ones are not
+   pool_t *prev_pool = atom_set_pool (rt->pool);
+   atom_t *kept = atom_string_new ("kept");
+   atom_t *leaked = atom_list_new ();
+   atom_list_ins_tail (leaked, atom_string_new ("leaked"));
+   atom_set_pool (prev_pool);
+
+   const atom_t *roots[] = { kept, NULL };
+   size_t nlive = pool_nlive (rt->pool);
+   rt_gc_stats_t stats;
+
+   bool collected = rt_gc_collect (rt, roots);
+   rt_gc_stats (rt, &stats);
+   collected = collected && nlive - pool_nlive (rt->pool) >= 3 &&
+               stats.nmajor > 0 && strcmp (atom_to_string (kept), "kept")==0;
+   atom_del (kept);
+   if (!collected) {
+      XERROR ("Garbage collection failed\n");
+      goto errorexit;
+   }
+   printf ("GC: %zu minor, %zu major collections\n", stats.nminor, stats.nmajor);
+
+   // Top-level forms only start a collection once a threshold is set,
+   // and their results are kept until they are released
+   atom_t *strform = atom_string_new ("held");
+   size_t nmajor = stats.nmajor;
+   atom_t *held = strform ? rt_eval (rt, NULL, strform) : NULL;
+   rt_gc_stats (rt, &stats);
+   bool automatic = held && stats.nmajor == nmajor;
+   prev_pool = atom_set_pool (rt->pool);
+   atom_string_new ("dropped");
+   atom_set_pool (prev_pool);
+   rt_set_gc_threshold (rt, 1);
+   atom_t *again = automatic ? rt_eval (rt, NULL, strform) : NULL;
+   rt_set_gc_threshold (rt, 0);
+   rt_gc_stats (rt, &stats);
+   automatic = again && stats.nmajor == nmajor + 1 &&
+               strcmp (atom_to_string (held), "held")==0;
+   if (automatic) {
+      const atom_t *again_roots[] = { again, NULL };
+      nlive = pool_nlive (rt->pool);
+      atom_gc_release (held);
+      held = NULL;
+      automatic = rt_gc_collect (rt, again_roots) &&
+                  pool_nlive (rt->pool) == nlive - 1;
+   }
+   atom_del (held);
+   atom_del (again);
+   atom_del (strform);
+   if (!automatic) {
+      XERROR ("Results were collected before they were released\n");
+      goto errorexit;
+   }
+
+   // Running into the memory limit raises TRAP_OOM instead of aborting
+   atom_t *big = atom_list_new ();
+   bool limited = big && atom_list_ins_tail (big, atom_symbol_new ("bi_list"));
+   for (size_t i=0; limited && i<OOM_NITEMS; i++) {
+      limited = atom_list_ins_tail (big, atom_int_new (100000 + i)) != NULL;
+   }
+
+   size_t current = 0;
+   rt_memory_usage (rt, &current, NULL);
+   size_t limit = current + OOM_HEADROOM;
+   rt_set_native_trap (rt, "TRAP_OOM", count_oom);
+   rt_set_memory_limit (rt, limit);
+
+   atom_t *result = limited ? rt_eval (rt, NULL, big) : NULL;
+
+   rt_set_memory_limit (rt, 0);
+   rt_memory_usage (rt, &current, NULL);
+   limited = result && result->type==atom_NIL && g_noom==1 && current < limit;
+   atom_del (result);
+   atom_del (big);
+   if (!limited) {
+      XERROR ("Memory limit was not enforced (%zu traps)\n", g_noom);
+      goto errorexit;
+   }
+   printf ("OOM: %zu trap raised\n", g_noom);
+
+   // Forms are read a chunk at a time and evaluated as they complete
+   FILE *inf = tmpfile ();
+   token_stream_t *ts = NULL;
+   bool streamed = inf && fputs (STREAM_INPUT, inf) >= 0 && !fseek (inf, 0, SEEK_SET) &&
+                   (ts = token_stream_new (inf, "<stream>", STREAM_CHUNK));
+   result = streamed ? rt_eval_stream (rt, ts) : NULL;
+   streamed = result && result->type==atom_INT && result->ival==3 &&
+              !token_stream_error (ts);
+   atom_del (result);
+   token_stream_del (ts);
+   if (inf)
+      fclose (inf);
+   if (!streamed) {
+      XERROR ("Streamed forms were not evaluated\n");
+      goto errorexit;
+   }
+
+#ifndef PLATFORM_WINDOWS
+   pthread_t threads[THREADS];
+   size_t nthreads = 0;
+   bool threaded = true;
+   while (nthreads < THREADS &&
+          pthread_create (&threads[nthreads], NULL, thread_eval,
+                          (void *)(nthreads + 1))==0)
+      nthreads++;
+   for (size_t i=0; i<nthreads; i++) {
+      void *tret = NULL;
+      pthread_join (threads[i], &tret);
+      threaded = threaded && tret == (void *)(i + 1);
+   }
+   if (!threaded || nthreads < THREADS) {
+      XERROR ("Runtimes on %zu threads failed\n", nthreads);
+      goto errorexit;
+   }
+   printf ("THREADS: %zu runtimes evaluated at once\n", nthreads);
+#endif
+
    printf ("RUNTIME:\n");
    rt_print (rt, stdout);
 
+   if (!rt_census_print (rt, stdout)) {
+      XERROR ("Census of the runtime failed\n");
+      goto errorexit;
+   }
+
    ret = EXIT_SUCCESS;
 
 errorexit:
 
    rt_del (rt);
 
-   for (size_t i=0; tokens && tokens[i]; i++) {
-      token_del (tokens[i]);
-   }
-   free (tokens);
+   token_array_del (tokens);
 
    xerror_set_logfile (NULL);
 
@@ -1,18 +1,26 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
+
+#ifndef PLATFORM_WINDOWS
+#include <pthread.h>
+#endif
 
 #include "rt/rt.h"
 #include "rt/builtins.h"
 #include "shlib/shlib.h"
+#include "parser/parser.h"
 
 #include "ll/ll.h"
+#include "mem/mem.h"
 
 
 #include "xerror/xerror.h"
 
 #define FLAG_QUOTE         (1 << 0)
 
+
 static atom_t *rt_atom_native (rt_builtins_fptr_t *fptr)
 {
    atom_t *ret = atom_new (atom_UNKNOWN, NULL);
@@ -29,6 +37,7 @@ const atom_t *rt_symbol_add (atom_t *symbols, const atom_t *name, const atom_t *
 {
    bool error = true;
    const atom_t *ret = NULL;
+   atom_t *appended = NULL;
    const atom_t *tmp[] = {
       name, value, NULL,
    };
@@ -36,19 +45,32 @@ const atom_t *rt_symbol_add (atom_t *symbols, const atom_t *name, const atom_t *
    if (!symbols || !name || !value)
       return NULL;
 
-   atom_t *tlist = builtins_LIST (NULL, NULL, tmp, 2);
+   // Only symbol tables that are themselves temporaries may hold arena
+   // atoms, everything else gets a long-lived copy.
+   bool suspend = !atom_in_arena (symbols);
+   arena_t *prev_arena = suspend ? atom_set_arena (NULL) : NULL;
+
+   atom_t *tlist = atom_list_new ();
    if (!tlist) {
       goto errorexit;
    }
 
+   // The entry holds copies of its own to flag: the originals may be
+   // singletons or items of a payload that is shared.
+   for (size_t i=0; i<2; i++) {
+      atom_t *item = atom_dup_flagged (tmp[i], name->flags);
+      if (!atom_list_ins_tail (tlist, item)) {
+         atom_del (item);
+         goto errorexit;
+      }
+   }
+
    tlist->flags = name->flags;
-   ((atom_t *)atom_list_index (tlist, 0))->flags = name->flags;
-   ((atom_t *)atom_list_index (tlist, 1))->flags = name->flags;
 
    tmp[0] = symbols;
    tmp[1] = tlist;
 
-   if ((ret = builtins_NAPPEND (NULL, NULL, tmp, 2))==NULL)
+   if ((appended = builtins_NAPPEND (NULL, NULL, tmp, 2))==NULL)
       goto errorexit;
 
    error = false;
@@ -62,55 +84,37 @@ errorexit:
    }
 
    //atom_del (ret);
+   atom_del (appended);
    atom_del (tlist);
    //atom_del (name);
    //atom_del (value);
 
+   if (suspend)
+      atom_set_arena (prev_arena);
+
    return ret;
 }
 
 const atom_t *rt_symbol_find (const atom_t *symbols, const atom_t *name)
 {
-   const char *strname = NULL;
-
    if (!name || !symbols)
       return NULL;
 
-   size_t len = atom_list_length (symbols);
-
-   strname = atom_to_string (name);
-
-   for (size_t i=0; i<len; i++) {
-      const atom_t *nvpair = atom_list_index (symbols, i);
-      const char *n = atom_to_string (atom_list_index (nvpair, 0));
-      if (strcmp (n, strname)==0) {
-         // atom_del (name);
-         return nvpair;
-      }
-   }
+   size_t index;
 
-   return NULL;
+   return atom_list_find_key (symbols, name, &index) ?
+                  atom_list_index (symbols, index) : NULL;
 }
 
 atom_t *rt_symbol_remove (atom_t *symbols, const atom_t *name)
 {
-   const char *strname = NULL;
-   size_t len = atom_list_length (symbols);
-
    if (!symbols || !name)
       return NULL;
 
-   strname = atom_to_string (name);
+   size_t index;
 
-   for (size_t i=0; i<len; i++) {
-      const atom_t *nvpair = atom_list_index (symbols, i);
-      const char *n = atom_to_string (atom_list_index (nvpair, 0));
-      if (strcmp (n, strname)==0) {
-         return atom_list_remove (symbols, i);
-      }
-   }
-
-   return NULL;
+   return atom_list_find_key (symbols, name, &index) ?
+                  atom_list_remove (symbols, index) : NULL;
 }
 
 static const atom_t *add_native_func (atom_t *symbols,
@@ -141,6 +145,11 @@ const atom_t *rt_add_native_func (rt_t *rt, const char *name,
 const atom_t *rt_set_native_trap (rt_t *rt, const char *name,
                                             rt_builtins_fptr_t *fptr)
 {
+   // Replaces any handler already set, as only the first one is found
+   atom_t *sym = atom_new (atom_SYMBOL, name);
+   atom_del (rt_symbol_remove (rt->traps, sym));
+   atom_del (sym);
+
    return add_native_func (rt->traps, name, fptr);
 }
 
@@ -156,11 +165,11 @@ atom_t *rt_trap_a (rt_t *rt, atom_t *sym, atom_t *trap, atom_t **args, atom_t **
    for (size_t i=0; args && args[i]; i++)
       nargs++;
 
-   args_array = malloc (sizeof *args_array * (nargs + 2));
+   args_array = mem_malloc (sizeof *args_array * (nargs + 2));
    if (!args_array) {
       fprintf (stderr, "Out of memory handling trap [%s]\n",
                         (char *)trap->data);
-      exit (-1);
+      goto errorexit;
    }
    memset (args_array, 0, sizeof *args_array * (nargs + 2));
 
@@ -178,33 +187,40 @@ atom_t *rt_trap_a (rt_t *rt, atom_t *sym, atom_t *trap, atom_t **args, atom_t **
 
    ret = builtins_TRAP (rt, sym, (const atom_t **)args_array, nargs+1);
 
-   free (args_array);
+errorexit:
+
+   mem_free (args_array);
 
    atom_del (trap);
 
    for (size_t i=0; extra && extra[i]; i++) {
       atom_del (extra[i]);
    }
-   free (extra);
+   mem_free (extra);
 
    return ret;
 }
 
 atom_t *rt_trap_v (rt_t *rt, atom_t *sym, atom_t *trap, atom_t **args, va_list ap)
 {
-   bool error = true;
    size_t nargs = 0;
    atom_t **extra = NULL;
-   atom_t *ret = NULL;
    atom_t *arg = NULL;
 
    while ((arg = va_arg (ap, atom_t *))!=NULL) {
       nargs++;
-      atom_t **tmp = realloc (extra, sizeof *tmp * (nargs + 1));
+      atom_t **tmp = mem_realloc (extra, sizeof *tmp * (nargs + 1));
       if (!tmp) {
-         fprintf (stderr, "Fatal OOM error in trap handling\n");
-         atom_print (trap, 0, stderr);
-         exit (-1);
+         fprintf (stderr, "Out of memory handling trap [%s]\n",
+                           (char *)trap->data);
+         atom_del (arg);
+         while ((arg = va_arg (ap, atom_t *))!=NULL)
+            atom_del (arg);
+         for (size_t i=0; extra && extra[i]; i++)
+            atom_del (extra[i]);
+         mem_free (extra);
+         atom_del (trap);
+         return NULL;
       }
       extra = tmp;
 
@@ -212,23 +228,8 @@ atom_t *rt_trap_v (rt_t *rt, atom_t *sym, atom_t *trap, atom_t **args, va_list a
       extra[nargs] = 0;
    }
 
-   if (!(ret = rt_trap_a (rt, sym, trap, args, extra)))
-      goto errorexit;
-
-   error = false;
-
-errorexit:
-
-   for (size_t i=0; extra && extra[i]; i++) {
-      atom_del (extra[i]);
-   }
-
-   if (error) {
-      atom_del (ret);
-      ret = NULL;
-   }
-
-   return ret;
+   // The extra parameters now belong to rt_trap_a()
+   return rt_trap_a (rt, sym, trap, args, extra);
 }
 
 atom_t *rt_trap (rt_t *rt, atom_t *sym, atom_t *trap, atom_t **args, ...)
@@ -245,6 +246,22 @@ atom_t *rt_trap (rt_t *rt, atom_t *sym, atom_t *trap, atom_t **args, ...)
    return ret;
 }
 
+// Raises TRAP_OOM with the memory limit lifted, so that the handler can
+// still allocate.
+static atom_t *rt_trap_oom (rt_t *rt, const atom_t *sym)
+{
+   size_t limit = pool_set_limit (rt->pool, 0);
+
+   atom_t *ret = rt_trap (rt, (atom_t *)sym,
+                              atom_new (atom_SYMBOL, "TRAP_OOM"),
+                              NULL,
+                              NULL);
+
+   pool_set_limit (rt->pool, limit);
+
+   return ret;
+}
+
 void rt_warn_v (rt_t *rt, const atom_t *sym, atom_t *warning, va_list ap)
 {
    rt = rt;
@@ -310,11 +327,24 @@ static const struct {
    { shlib_S_LONG_LONG, "LONG_LONG"   },
 };
 
+// Shared by every runtime, which may be created on different threads
 static int64_t g_highest_type_id = 0;
 
+#ifndef PLATFORM_WINDOWS
+static pthread_mutex_t g_type_id_lock = PTHREAD_MUTEX_INITIALIZER;
+#define TYPE_ID_LOCK()     pthread_mutex_lock (&g_type_id_lock)
+#define TYPE_ID_UNLOCK()   pthread_mutex_unlock (&g_type_id_lock)
+#else
+#define TYPE_ID_LOCK()
+#define TYPE_ID_UNLOCK()
+#endif
+
 int64_t rt_highest_type_id (void)
 {
-   return g_highest_type_id;
+   TYPE_ID_LOCK ();
+   int64_t ret = g_highest_type_id;
+   TYPE_ID_UNLOCK ();
+   return ret;
 }
 
 const atom_t *rt_add_native_type (rt_t *rt,
@@ -343,8 +373,10 @@ const atom_t *rt_add_native_type (rt_t *rt,
 
    ret = rt_symbol_add (rt->symbols, sym, val);
 
+   TYPE_ID_LOCK ();
    g_highest_type_id = g_highest_type_id < type_id ?
                            type_id : g_highest_type_id;
+   TYPE_ID_UNLOCK ();
 
    error = false;
 
@@ -373,6 +405,9 @@ static struct {
    {  "bi_nappend",     builtins_NAPPEND     },
    {  "bi_nalloc",      builtins_NALLOC      },
    {  "bi_nfree",       builtins_NFREE       },
+   {  "bi_nslice",      builtins_NSLICE      },
+   {  "bi_nlength",     builtins_NLENGTH     },
+   {  "bi_nstats",      builtins_NSTATS      },
 
    {  "bi_set",         builtins_SET         },
    {  "bi_define",      builtins_DEFINE      },
@@ -460,16 +495,26 @@ static struct {
    "TRAP_EVALERR",
    "TRAP_BADPARAM",
    "TRAP_FFI",
+   "TRAP_OOM",
 };
 
 rt_t *rt_new (void)
 {
    bool error = true;
    rt_t *ret = NULL;
+   pool_t *prev_pool = NULL;
 
-   if (!(ret = calloc (1, sizeof *ret)))
+   if (!(ret = mem_calloc (1, sizeof *ret)))
       goto errorexit;
 
+   if (!(ret->pool = pool_new ()))
+      goto errorexit;
+
+   if (!(ret->arena = arena_new (sizeof (atom_t))))
+      goto errorexit;
+
+   prev_pool = atom_set_pool (ret->pool);
+
    ret->symbols = atom_list_new ();
    ret->stack = atom_list_new ();
    ret->traps = atom_list_new ();
@@ -507,6 +552,8 @@ rt_t *rt_new (void)
 
 errorexit:
 
+   atom_set_pool (prev_pool);
+
    if (error) {
       rt_del (ret);
       ret = NULL;
@@ -525,7 +572,13 @@ void rt_del (rt_t *rt)
    atom_del (rt->traps);
    shlib_del (rt->shlib);
 
-   free (rt);
+   if (rt->census)
+      rt_census_print (rt, rt->census);
+
+   pool_del (rt->pool);
+   arena_del (rt->arena);
+
+   mem_free (rt);
 }
 
 const atom_t *rt_eval_symbol (rt_t *rt, const atom_t *sym, const atom_t *atom)
@@ -599,8 +652,8 @@ static atom_t *rt_funcall_native (rt_t *rt, const atom_t *sym,
 
 static bool check_type_compatible (const atom_t *actual, const atom_t *expected)
 {
-   int64_t actual_type = *(int64_t *)actual->data,
-           expected_type = *(int64_t *)expected->data;
+   int64_t actual_type = actual->ival,
+           expected_type = expected->ival;
 
    if (actual_type == expected_type)
       return true;
@@ -626,7 +679,7 @@ static bool check_type_compatible (const atom_t *actual, const atom_t *expected)
 static shlib_type_t promote_atom_to_native_type (const atom_t *src)
 {
    if (src->type==atom_INT) {
-      int64_t type = *(int64_t *)src;
+      int64_t type = src->ival;
       return (shlib_type_t) type;
    }
 
@@ -649,69 +702,86 @@ static void *promote_atom_to_native_data (const atom_t *src,
                                                 uint8_t flags)
 {
    uint8_t *b = NULL;
-   size_t blen = 0, offset = 0;
-   void *ret = malloc (8);
+   size_t blen = 0;
+   void **tmp = NULL;
+   void *ret = mem_malloc (8);
    if (!ret)
       return NULL;
 
    switch (type) {
    case shlib_NONE:
    case shlib_VOID:
-   case shlib_NULL:        free (ret); ret = NULL;                             break;
-
-   case shlib_UINT8_T:     *(uint8_t *)ret = *(int64_t *)src->data;            break;
-   case shlib_UINT16_T:    *(uint16_t *)ret = *(int64_t *)src->data;           break;
-   case shlib_UINT32_T:    *(uint32_t *)ret = *(int64_t *)src->data;           break;
-   case shlib_UINT64_T:    *(uint64_t *)ret = *(int64_t *)src->data;           break;
-   case shlib_INT8_T:      *(int8_t *)ret = *(int64_t *)src->data;             break;
-   case shlib_INT16_T:     *(int16_t *)ret = *(int64_t *)src->data;            break;
-   case shlib_INT32_T:     *(int32_t *)ret = *(int64_t *)src->data;            break;
-   case shlib_INT64_T:     *(int64_t *)ret = *(int64_t *)src->data;            break;
-   case shlib_FLOAT:       *(float *)ret = *(float *)src->data;                break;
-   case shlib_DOUBLE:      *(double *)ret = *(double *)src->data;              break;
-   case shlib_SIZE_T:      *(size_t *)ret = *(int64_t *)src->data;             break;
-   case shlib_S_CHAR:      *(signed char *)ret = *(int64_t *)src->data;        break;
-   case shlib_S_SHORT:     *(signed short *)ret = *(int64_t *)src->data;       break;
-   case shlib_S_INT:       *(signed int *)ret = *(int64_t *)src->data;         break;
-   case shlib_S_LONG:      *(signed long *)ret = *(int64_t *)src->data;        break;
-   case shlib_S_LONG_LONG: *(signed long long *)ret = *(int64_t *)src->data;   break;
-   case shlib_U_CHAR:      *(unsigned char *)ret = *(int64_t *)src->data;      break;
-   case shlib_U_SHORT:     *(unsigned short *)ret = *(int64_t *)src->data;     break;
-   case shlib_U_INT:       *(unsigned int *)ret = *(int64_t *)src->data;       break;
-   case shlib_U_LONG:      *(unsigned long *)ret = *(int64_t *)src->data;      break;
-   case shlib_U_LONG_LONG: *(unsigned long long *)ret = *(int64_t *)src->data; break;
+   case shlib_NULL:        mem_free (ret); ret = NULL;                         break;
+
+   case shlib_UINT8_T:     *(uint8_t *)ret = src->ival;                        break;
+   case shlib_UINT16_T:    *(uint16_t *)ret = src->ival;                       break;
+   case shlib_UINT32_T:    *(uint32_t *)ret = src->ival;                       break;
+   case shlib_UINT64_T:    *(uint64_t *)ret = src->ival;                       break;
+   case shlib_INT8_T:      *(int8_t *)ret = src->ival;                         break;
+   case shlib_INT16_T:     *(int16_t *)ret = src->ival;                        break;
+   case shlib_INT32_T:     *(int32_t *)ret = src->ival;                        break;
+   case shlib_INT64_T:     *(int64_t *)ret = src->ival;                        break;
+   case shlib_FLOAT:       *(float *)ret = src->fval;                          break;
+   case shlib_DOUBLE:      *(double *)ret = src->fval;                         break;
+   case shlib_SIZE_T:      *(size_t *)ret = src->ival;                         break;
+   case shlib_S_CHAR:      *(signed char *)ret = src->ival;                    break;
+   case shlib_S_SHORT:     *(signed short *)ret = src->ival;                   break;
+   case shlib_S_INT:       *(signed int *)ret = src->ival;                     break;
+   case shlib_S_LONG:      *(signed long *)ret = src->ival;                    break;
+   case shlib_S_LONG_LONG: *(signed long long *)ret = src->ival;               break;
+   case shlib_U_CHAR:      *(unsigned char *)ret = src->ival;                  break;
+   case shlib_U_SHORT:     *(unsigned short *)ret = src->ival;                 break;
+   case shlib_U_INT:       *(unsigned int *)ret = src->ival;                   break;
+   case shlib_U_LONG:      *(unsigned long *)ret = src->ival;                  break;
+   case shlib_U_LONG_LONG: *(unsigned long long *)ret = src->ival;             break;
    case shlib_POINTER:     // Tricky
-                           blen = flags & FLAG_TREAT_AS_STRING ?
-                                    strlen (src->data) + 1 :
-                                    *(size_t *)src->data;
-                           offset = flags & FLAG_TREAT_AS_STRING ?
-                                    0 :
-                                    sizeof (size_t);
-                           b = src->data;
-                           b = &b[offset];
-
-                           void **tmp = NULL;
-                           if (!(tmp = malloc (sizeof *tmp))) {
+                           // tmp[0] is passed, tmp[1] is freed after the
+                           // call. src is our own result of the evaluation,
+                           // and its bytes are unshared first so that the
+                           // callee never writes to the store of another
+                           // dup or slice. That copies any buffer that is
+                           // still held elsewhere, such as one bound to a
+                           // variable: only a buffer that nothing else
+                           // holds is passed without copying.
+                           if (!(tmp = mem_calloc (2, sizeof *tmp))) {
                               fprintf (stderr, "OOM\n");
-                              exit (-1);
+                              mem_free (ret);
+                              return NULL;
+                           }
+
+                           if (!(flags & FLAG_TREAT_AS_STRING)) {
+                              b = atom_buffer_offset ((atom_t *)src, 0);
+                              if (!b && src->type==atom_BUFFER) {
+                                 fprintf (stderr, "OOM\n");
+                                 mem_free (tmp);
+                                 mem_free (ret);
+                                 return NULL;
+                              }
+                              tmp[0] = b;
+                              mem_free (ret); ret = tmp;
+                              break;
                            }
-                           memset (tmp, 0, sizeof *tmp);
 
-                           tmp[0] = malloc (blen);
+                           blen = atom_string_length (src) + 1;
+                           b = (uint8_t *)atom_to_string (src);
+
+                           tmp[0] = tmp[1] = mem_malloc (blen);
                            if (!tmp[0]) {
                               fprintf (stderr, "OOM (%zu)\n", blen);
+                              mem_free (tmp);
+                              mem_free (ret);
                               return NULL;
                            }
                            memcpy (tmp[0], b, blen);
 
-                           free (ret); ret = tmp;
+                           mem_free (ret); ret = tmp;
 
                            printf ("[%p]\n[%p]\n", ret, b);
                            break;
    }
 
    if (type==shlib_FLOAT) {
-      double tmpd = *(double *)src->data;
+      double tmpd = src->fval;
       float tmpf = tmpd;
       *(float *)ret = tmpf;
    }
@@ -725,45 +795,38 @@ static atom_t *promote_native_to_atom (const shlib_type_t type, void *data)
    if (!ret)
       return NULL;
 
-   ret->data = malloc (8);
-   if (!ret->data) {
-      free (ret);
-      return NULL;
-   }
-   memset (ret->data, 0, 8);
-
    ret->type = atom_INT;
 
    switch (type) {
    case shlib_NONE:
    case shlib_VOID:
-   case shlib_NULL:        free (ret->data); free (ret); ret = NULL;             break;
-
-   case shlib_UINT8_T:     *(uint64_t *)ret->data = *(uint8_t  *)data;           break;
-   case shlib_UINT16_T:    *(uint64_t *)ret->data = *(uint16_t *)data;           break;
-   case shlib_UINT32_T:    *(uint64_t *)ret->data = *(uint32_t *)data;           break;
-   case shlib_UINT64_T:    *(uint64_t *)ret->data = *(uint64_t *)data;           break;
-   case shlib_INT8_T:      *(int64_t  *)ret->data = *(int8_t   *)data;           break;
-   case shlib_INT16_T:     *(int64_t  *)ret->data = *(int16_t  *)data;           break;
-   case shlib_INT32_T:     *(int64_t  *)ret->data = *(int32_t  *)data;           break;
-   case shlib_INT64_T:     *(int64_t  *)ret->data = *(int64_t  *)data;           break;
-   case shlib_FLOAT:       *(float    *)ret->data = *(float    *)data;           break;
-   case shlib_DOUBLE:      *(double   *)ret->data = *(double   *)data;           break;
-   case shlib_SIZE_T:      *(uint64_t *)ret->data = *(size_t   *)data;           break;
-   case shlib_S_CHAR:      *(int64_t  *)ret->data = *(signed char        *)data; break;
-   case shlib_S_SHORT:     *(int64_t  *)ret->data = *(signed short       *)data; break;
-   case shlib_S_INT:       *(int64_t  *)ret->data = *(signed int         *)data; break;
-   case shlib_S_LONG:      *(int64_t  *)ret->data = *(signed long        *)data; break;
-   case shlib_S_LONG_LONG: *(int64_t  *)ret->data = *(signed long long   *)data; break;
-   case shlib_U_CHAR:      *(uint64_t *)ret->data = *(unsigned char      *)data; break;
-   case shlib_U_SHORT:     *(uint64_t *)ret->data = *(unsigned short     *)data; break;
-   case shlib_U_INT:       *(uint64_t *)ret->data = *(unsigned int       *)data; break;
-   case shlib_U_LONG:      *(uint64_t *)ret->data = *(unsigned long      *)data; break;
-   case shlib_U_LONG_LONG: *(uint64_t *)ret->data = *(unsigned long long *)data; break;
-   case shlib_POINTER:     ret->data = data;                                     break;
+   case shlib_NULL:        atom_del (ret); ret = NULL;                 break;
+
+   case shlib_UINT8_T:     ret->ival = *(uint8_t  *)data;              break;
+   case shlib_UINT16_T:    ret->ival = *(uint16_t *)data;              break;
+   case shlib_UINT32_T:    ret->ival = *(uint32_t *)data;              break;
+   case shlib_UINT64_T:    ret->ival = *(uint64_t *)data;              break;
+   case shlib_INT8_T:      ret->ival = *(int8_t   *)data;              break;
+   case shlib_INT16_T:     ret->ival = *(int16_t  *)data;              break;
+   case shlib_INT32_T:     ret->ival = *(int32_t  *)data;              break;
+   case shlib_INT64_T:     ret->ival = *(int64_t  *)data;              break;
+   case shlib_FLOAT:       ret->fval = *(float    *)data;              break;
+   case shlib_DOUBLE:      ret->fval = *(double   *)data;              break;
+   case shlib_SIZE_T:      ret->ival = *(size_t   *)data;              break;
+   case shlib_S_CHAR:      ret->ival = *(signed char        *)data;    break;
+   case shlib_S_SHORT:     ret->ival = *(signed short       *)data;    break;
+   case shlib_S_INT:       ret->ival = *(signed int         *)data;    break;
+   case shlib_S_LONG:      ret->ival = *(signed long        *)data;    break;
+   case shlib_S_LONG_LONG: ret->ival = *(signed long long   *)data;    break;
+   case shlib_U_CHAR:      ret->ival = *(unsigned char      *)data;    break;
+   case shlib_U_SHORT:     ret->ival = *(unsigned short     *)data;    break;
+   case shlib_U_INT:       ret->ival = *(unsigned int       *)data;    break;
+   case shlib_U_LONG:      ret->ival = *(unsigned long      *)data;    break;
+   case shlib_U_LONG_LONG: ret->ival = *(unsigned long long *)data;    break;
+   case shlib_POINTER:     ret->data = *(void **)data;                 break;
    }
 
-   if (type==shlib_DOUBLE)
+   if (type==shlib_DOUBLE || type==shlib_FLOAT)
       ret->type = atom_FLOAT;
 
    if (type==shlib_POINTER)
@@ -806,7 +869,7 @@ static atom_t *rt_funcall_ffi (rt_t *rt, const atom_t *sym,
    tmp = NULL;
    tmp_rt = NULL;
 
-   return_value = malloc (8);
+   return_value = mem_malloc (8);
    if (!return_value) {
       fprintf (stderr, "OOM\n");
       goto errorexit;
@@ -826,7 +889,7 @@ static atom_t *rt_funcall_ffi (rt_t *rt, const atom_t *sym,
       goto errorexit;
    }
 
-   fargs = malloc ((sizeof *fargs) * (nargs_found + 1));
+   fargs = mem_malloc ((sizeof *fargs) * (nargs_found + 1));
    if (!fargs) {
       fprintf (stderr, "OOM\n");
       goto errorexit;
@@ -854,7 +917,7 @@ static atom_t *rt_funcall_ffi (rt_t *rt, const atom_t *sym,
          goto errorexit;
       }
 
-      fargs[i-1].type = *(int64_t *)tmp_expected->data;
+      fargs[i-1].type = tmp_expected->ival;
       atom_del (tmp);
       tmp = NULL;
       tmp_expected = NULL;
@@ -879,10 +942,15 @@ static atom_t *rt_funcall_ffi (rt_t *rt, const atom_t *sym,
       fargs[i-1].data = promote_atom_to_native_data (arg_found, fargs[i-1].type, flags);
 
       atom_list_ins_tail (eval_args, (atom_t *)arg_found);
+
+      if (!fargs[i-1].data && fargs[i-1].type > shlib_NULL) {
+         trap = rt_trap_oom (rt, sym);
+         goto errorexit;
+      }
    }
 
    int errcode = shlib_funcall (rt->shlib, atom_to_string (func),
-                                           (char *)(library->data),
+                                           (char *)atom_to_string (library),
                                            return_type,
                                            return_value,
                                            fargs);
@@ -916,16 +984,16 @@ errorexit:
    }
 
    for (size_t i=0; fargs[i].type; i++) {
-      if (fargs[i].type==shlib_POINTER) {
+      if (fargs[i].type==shlib_POINTER && fargs[i].data) {
          void **tmp = fargs[i].data;
-         free (tmp[0]);
+         mem_free (tmp[1]);
       }
 
-      free ((void *)fargs[i].data);
+      mem_free ((void *)fargs[i].data);
    }
-   free (fargs);
+   mem_free (fargs);
 
-   free (return_value);
+   mem_free (return_value);
 
    return ret;
 }
@@ -952,7 +1020,40 @@ errorexit:
    return ret;
 }
 
-static size_t depth;
+void rt_census_enable (rt_t *rt, FILE *outf)
+{
+   if (!rt)
+      return;
+
+   rt->origin_eval = atom_census_origin ("eval");
+   rt->origin_ffi = atom_census_origin ("ffi");
+
+   rt->census = outf;
+}
+
+bool rt_census_print (const rt_t *rt, FILE *outf)
+{
+   return rt ? atom_census_print (rt->pool, rt->arena, outf) : false;
+}
+
+// Returns the origin to be restored once the call has returned
+static uint16_t census_enter (const rt_t *rt, const atom_t *func,
+                                              uint16_t origin)
+{
+   if (!rt->census)
+      return 0;
+
+   if (func && func->type==atom_SYMBOL)
+      origin = atom_census_origin (func->data);
+
+   return atom_census_set_origin (origin);
+}
+
+static void census_leave (const rt_t *rt, uint16_t origin)
+{
+   if (rt->census)
+      atom_census_set_origin (origin);
+}
 
 static atom_t *rt_list_eval (rt_t *rt, const atom_t *sym, const atom_t *atom)
 {
@@ -962,11 +1063,13 @@ static atom_t *rt_list_eval (rt_t *rt, const atom_t *sym, const atom_t *atom)
 
    void **args = NULL;
    size_t nargs = 0;
+   size_t noom = rt->noom;
+
+   uint16_t origin = census_enter (rt, NULL, rt->origin_eval);
 
    args = ll_new ();
    size_t llen = atom_list_length (atom);
 
-   depth++;
    for (size_t i=0; i<llen; i++) {
 
       atom_t *tmp = (atom_t *)atom_list_index (atom, i);
@@ -979,6 +1082,13 @@ static atom_t *rt_list_eval (rt_t *rt, const atom_t *sym, const atom_t *atom)
 
       rt->flags &= ~FLAG_QUOTE;
 
+      // Once out of memory, the rest of the form is abandoned and the
+      // result of the trap handler is passed up instead.
+      if (rt->noom != noom) {
+         ret = tmp;
+         goto errorexit;
+      }
+
       if (!tmp) {
          XERROR ("Fatal error during evaluation\n");
          continue;
@@ -1012,7 +1122,9 @@ static atom_t *rt_list_eval (rt_t *rt, const atom_t *sym, const atom_t *atom)
 
    if (func->type == atom_NATIVE) {
 
+      uint16_t prev = census_enter (rt, atom_list_index (atom, 0), 0);
       ret = rt_funcall_native (rt, sym, (const atom_t **)args, --nargs);
+      census_leave (rt, prev);
 
    } else {
 
@@ -1021,10 +1133,13 @@ static atom_t *rt_list_eval (rt_t *rt, const atom_t *sym, const atom_t *atom)
       if (func->flags & ATOM_FLAG_FUNC)
          ret = rt_funcall_interp (rt, sym, (const atom_t **)args, --nargs);
 
-      if (func->flags & ATOM_FLAG_FFI)
+      if (func->flags & ATOM_FLAG_FFI) {
+         uint16_t prev = census_enter (rt, NULL, rt->origin_ffi);
          ret = rt_funcall_ffi (rt, sym, (const atom_t **)args, nargs);
+         census_leave (rt, prev);
+      }
 
-      if (ret) ret->flags = 0;
+      if (ret && ret->flags) ret->flags = 0;
    }
 
    atom_list_remove_tail (rt->stack);
@@ -1040,13 +1155,113 @@ errorexit:
    ll_iterate (args, (void (*) (void *))atom_del);
    ll_del (args);
 
-   depth--;
+   census_leave (rt, origin);
+
    return ret;
 }
 
+void rt_set_memory_limit (rt_t *rt, size_t nbytes)
+{
+   if (rt)
+      pool_set_limit (rt->pool, nbytes);
+}
+
+void rt_memory_usage (const rt_t *rt, size_t *current, size_t *highest)
+{
+   if (current)
+      *current = rt ? pool_nbytes (rt->pool) : 0;
+
+   if (highest)
+      *highest = rt ? pool_nbytes_high (rt->pool) : 0;
+}
+
+void rt_buffer_stats (const rt_t *rt, pool_block_stats_t *stats)
+{
+   pool_block_stats (rt ? rt->pool : NULL, stats);
+}
+
+static void gc_pause (rt_t *rt, clock_t start)
+{
+   double nsecs = (double)(clock () - start) * 1e9 / CLOCKS_PER_SEC;
+
+   rt->gc_stats.pause_last_ns = nsecs;
+   rt->gc_stats.pause_total_ns += nsecs;
+   if (nsecs > rt->gc_stats.pause_max_ns)
+      rt->gc_stats.pause_max_ns = nsecs;
+}
+
+void rt_set_gc_threshold (rt_t *rt, size_t nobjects)
+{
+   if (!rt)
+      return;
+
+   rt->gc_threshold = nobjects;
+   rt->gc_next = nobjects;
+}
+
+bool rt_gc_collect (rt_t *rt, const atom_t **roots)
+{
+   bool error = true;
+   const atom_t **all = NULL;
+   size_t nroots = 0;
+
+   // Temporaries of a form being evaluated are not rooted anywhere
+   if (!rt || rt->eval_depth)
+      return false;
+
+   while (roots && roots[nroots])
+      nroots++;
+
+   if (!(all = mem_malloc ((nroots + 4) * sizeof *all)))
+      goto errorexit;
+
+   all[0] = rt->symbols;
+   all[1] = rt->stack;
+   all[2] = rt->traps;
+   for (size_t i=0; i<nroots; i++) {
+      all[i + 3] = roots[i];
+   }
+   all[nroots + 3] = NULL;
+
+   clock_t start = clock ();
+   size_t nlive = pool_nlive (rt->pool);
+
+   if (atom_gc_collect (rt->pool, all) < 0)
+      goto errorexit;
+
+   rt->gc_stats.nmajor++;
+   rt->gc_stats.nfreed += nlive - pool_nlive (rt->pool);
+   gc_pause (rt, start);
+
+   rt->gc_next = pool_nlive (rt->pool) * 2;
+   if (rt->gc_next < rt->gc_threshold)
+      rt->gc_next = rt->gc_threshold;
+
+   error = false;
+
+errorexit:
+
+   mem_free (all);
+
+   return !error;
+}
+
+void rt_gc_stats (const rt_t *rt, rt_gc_stats_t *stats)
+{
+   if (!rt || !stats)
+      return;
+
+   *stats = rt->gc_stats;
+}
+
 atom_t *rt_eval (rt_t *rt, const atom_t *sym, const atom_t *atom)
 {
    atom_t *tmp = NULL;
+   pool_t *prev_pool = atom_set_pool (rt->pool);
+   arena_t *prev_arena = NULL;
+
+   if (rt->eval_depth++ == 0)
+      prev_arena = atom_set_arena (rt->arena);
 
    switch (atom->type) {
       case atom_NATIVE:
@@ -1066,6 +1281,12 @@ atom_t *rt_eval (rt_t *rt, const atom_t *sym, const atom_t *atom)
       case atom_UNKNOWN:   tmp = NULL;                                   break;
    }
 
+   if (pool_nrefused (rt->pool) != rt->noom) {
+      rt->noom = pool_nrefused (rt->pool);
+      atom_del (tmp);
+      tmp = rt_trap_oom (rt, sym);
+   }
+
    if (!tmp) {
       fprintf (stderr, "Eval failed [%p:%s]\n", atom, atom_to_string (atom));
       atom_print (atom, 0, stderr);
@@ -1080,9 +1301,50 @@ atom_t *rt_eval (rt_t *rt, const atom_t *sym, const atom_t *atom)
       exit (-1);
    }
 
+   // The result of a top-level form is the only thing that survives
+   // the arena reset.
+   if (--rt->eval_depth == 0) {
+      clock_t start = clock ();
+
+      if (atom_in_arena (tmp))
+         rt->gc_stats.npromoted++;
+
+      tmp = atom_promote (tmp);
+      atom_gc_extern (tmp);
+      atom_set_arena (prev_arena);
+      atom_arena_reset (rt->arena);
+
+      rt->gc_stats.nminor++;
+      gc_pause (rt, start);
+
+      if (rt->gc_threshold && pool_nlive (rt->pool) >= rt->gc_next)
+         rt_gc_collect (rt, NULL);
+   }
+
+   atom_set_pool (prev_pool);
+
    return tmp;
 }
 
+atom_t *rt_eval_stream (rt_t *rt, token_stream_t *ts)
+{
+   atom_t *ret = NULL;
+   atom_t *form = NULL;
+
+   while ((form = parser_stream_next (ts))) {
+      atom_del (ret);
+      ret = rt_eval (rt, NULL, form);
+      atom_del (form);
+   }
+
+   if (token_stream_error (ts)) {
+      atom_del (ret);
+      return NULL;
+   }
+
+   return ret ? ret : atom_new (atom_NIL, NULL);
+}
+
 void rt_print_numbered_list (atom_t *list, FILE *outf)
 {
    if (!list || !outf)
@@ -1105,7 +1367,19 @@ void rt_print_globals (rt_t *rt, FILE *outf)
 void rt_print_call_stack (rt_t *rt, FILE *outf)
 {
    fprintf (outf, "\nCALL STACK\n");
-   rt_print_numbered_list (rt->stack, outf);
+
+   size_t len = atom_list_length (rt->stack);
+   for (size_t i=0; i<len; i++) {
+      const atom_t *entry = atom_list_index (rt->stack, i);
+      const char *fname;
+      size_t line, charpos;
+
+      fprintf (outf, "[%zu]: ", i);
+      if (atom_srcloc (atom_list_index (entry, 0), &fname, &line, &charpos))
+         fprintf (outf, "%s:%zu:%zu: ", fname, line, charpos);
+      atom_print (entry, 0, outf);
+      fprintf (outf, "\n");
+   }
 }
 
 void rt_print_traps (rt_t *rt, FILE *outf)
@@ -6,9 +6,29 @@
 #include <stdarg.h>
 
 #include "parser/atom.h"
+#include "token/token.h"
+#include "pool/pool.h"
 #include "shlib/shlib.h"
 
 
+// Atoms are still reference counted; the collector only reclaims what
+// was leaked. The arena is the nursery, emptied after every top-level
+// form (a minor collection). Atoms in the pool are collected (a major
+// collection) by rt_gc_collect() and, once the host has set a threshold
+// with rt_set_gc_threshold(), after any top-level form that leaves the
+// pool with that many objects or twice as many as the last collection
+// left, whichever is more.
+typedef struct rt_gc_stats_t rt_gc_stats_t;
+struct rt_gc_stats_t {
+   size_t nminor;
+   size_t nmajor;
+   size_t npromoted;       // Top-level results moved out of the nursery
+   size_t nfreed;          // Pool objects released by major collections
+   double pause_last_ns;
+   double pause_max_ns;
+   double pause_total_ns;
+};
+
 typedef struct rt_t rt_t;
 struct rt_t {
    atom_t *symbols;
@@ -17,6 +37,26 @@ struct rt_t {
 
    shlib_t *shlib;
 
+   // Every atom created by this runtime is allocated from here
+   pool_t *pool;
+
+   // Temporaries created while evaluating a top-level form come from
+   // here; the arena is reset when that form has been evaluated.
+   arena_t *arena;
+   size_t eval_depth;
+
+   size_t gc_threshold;    // 0, the default, for no automatic collections
+   size_t gc_next;
+   rt_gc_stats_t gc_stats;
+
+   // Refused allocations of the pool that have already raised TRAP_OOM
+   size_t noom;
+
+   // Set while the census is enabled
+   FILE *census;
+   uint16_t origin_eval;
+   uint16_t origin_ffi;
+
    bool flags; // Reserved for internal use
 };
 
@@ -28,6 +68,8 @@ typedef atom_t *(rt_builtins_fptr_t) (rt_t *rt, const atom_t *, const atom_t **,
 extern "C" {
 #endif
 
+   // Runtimes may be used on different threads at once, but each of
+   // them, and every atom it allocated, by only one thread at a time.
    rt_t *rt_new (void);
    void rt_del (rt_t *rt);
 
@@ -58,8 +100,43 @@ extern "C" {
    void rt_warn_v (rt_t *rt, const atom_t *sym, atom_t *trap, va_list ap);
    void rt_warn (rt_t *rt, const atom_t *sym, atom_t *warning, ...);
 
+   // Results returned by a top-level rt_eval() stay valid until the
+   // caller deletes them or hands them to atom_gc_release(); any other
+   // atom of this runtime that the caller holds must be passed in roots
+   // (NULL-terminated, may be NULL) to every collection. A host that
+   // holds such atoms across rt_eval() calls should therefore leave
+   // automatic collections off. Collections are refused while a form is
+   // being evaluated.
    atom_t *rt_eval (rt_t *rt, const atom_t *symbols, const atom_t *atom);
 
+   // Evaluates the forms of a stream as they are read, so that evaluation
+   // starts before the input has been read in full and only one form is
+   // held at a time. Returns the result of the last form (nil if there
+   // were none), or NULL if the stream could not be read.
+   atom_t *rt_eval_stream (rt_t *rt, token_stream_t *ts);
+
+   void rt_set_gc_threshold (rt_t *rt, size_t nobjects);
+   bool rt_gc_collect (rt_t *rt, const atom_t **roots);
+   void rt_gc_stats (const rt_t *rt, rt_gc_stats_t *stats);
+
+   // Memory held by the atoms of a runtime, including list vectors and
+   // buffer payloads, is counted in bytes. Going over the limit (0 for
+   // none, the default) raises TRAP_OOM and abandons the rest of the
+   // top-level form, whose value becomes that of the trap handler. The
+   // handler itself runs without a limit.
+   void rt_set_memory_limit (rt_t *rt, size_t nbytes);
+   void rt_memory_usage (const rt_t *rt, size_t *current, size_t *highest);
+
+   // Buffer payloads come from size classes cached by the runtime's pool
+   void rt_buffer_stats (const rt_t *rt, pool_block_stats_t *stats);
+
+   // While the census is enabled, atoms are tagged with the builtin (by
+   // name), "eval" or "ffi" that created them; see atom_census_print().
+   // rt_del() prints a census of whatever is still live to outf (NULL
+   // disables the census) after releasing the runtime's own atoms.
+   void rt_census_enable (rt_t *rt, FILE *outf);
+   bool rt_census_print (const rt_t *rt, FILE *outf);
+
 
 
    void rt_print_numbered_list (atom_t *list, FILE *outf);
@@ -4,9 +4,9 @@
 #include <ffi.h>
 
 #include "shlib/shlib.h"
+#include "ll/ll.h"
+#include "mem/mem.h"
 
-#include "xvector/xvector.h"
-#include "xstring/xstring.h"
 #include "xerror/xerror.h"
 
 typedef struct nvpair_t nvpair_t;
@@ -18,14 +18,14 @@ struct nvpair_t {
 
 static nvpair_t *nv_new (const char *name, void *handle)
 {
-   nvpair_t *ret = malloc (sizeof *ret);
+   nvpair_t *ret = mem_malloc (sizeof *ret);
    if (!ret)
       return NULL;
 
    memset (ret, 0, sizeof *ret);
 
-   if (!(ret->name = xstr_dup (name))) {
-      free (ret);
+   if (!(ret->name = mem_strdup (name))) {
+      mem_free (ret);
       return NULL;
    }
 
@@ -39,16 +39,16 @@ static void nv_del (nvpair_t *nv)
    if (!nv)
       return;
 
-   free (nv->name);
-   free (nv);
+   mem_free (nv->name);
+   mem_free (nv);
 }
 
-static void *nv_find (xvector_t *xv, const char *name)
+static void *nv_find (void **ll, const char *name)
 {
-   size_t len = XVECT_LENGTH (xv);
+   size_t len = ll_length (ll);
 
    for (size_t i=0; i<len; i++) {
-      nvpair_t *nv = XVECT_INDEX (xv, i);
+      nvpair_t *nv = ll_index (ll, i);
       if ((strcmp (name, nv->name))==0)
          return nv->handle;
    }
@@ -57,20 +57,20 @@ static void *nv_find (xvector_t *xv, const char *name)
 }
 
 struct shlib_t {
-   xvector_t *libs;
-   xvector_t *funcs;
+   void **libs;
+   void **funcs;
 };
 
 shlib_t *shlib_new (void)
 {
-   shlib_t *ret = malloc (sizeof *ret);
+   shlib_t *ret = mem_malloc (sizeof *ret);
    if (!ret)
       return NULL;
 
    memset (ret, 0, sizeof *ret);
 
-   ret->libs = xvector_new ();
-   ret->funcs = xvector_new ();
+   ret->libs = ll_new ();
+   ret->funcs = ll_new ();
 
    if (!ret->libs || !ret->funcs) {
       shlib_del (ret);
@@ -85,25 +85,25 @@ void shlib_del (shlib_t *shlib)
    if (!shlib)
       return;
 
-   size_t len = XVECT_LENGTH (shlib->libs);
+   size_t len = ll_length (shlib->libs);
 
    for (size_t i=0; i<len; i++) {
-      nvpair_t *lib = XVECT_INDEX (shlib->libs, i);
+      nvpair_t *lib = ll_index (shlib->libs, i);
       xshare_close (lib->handle);
       nv_del (lib);
    }
-   xvector_free (shlib->libs);
+   ll_del (shlib->libs);
 
 
-   len = XVECT_LENGTH (shlib->funcs);
+   len = ll_length (shlib->funcs);
 
    for (size_t i=0; i<len; i++) {
-      nvpair_t *func = XVECT_INDEX (shlib->funcs, i);
+      nvpair_t *func = ll_index (shlib->funcs, i);
       nv_del (func);
    }
-   xvector_free (shlib->funcs);
+   ll_del (shlib->funcs);
 
-   free (shlib);
+   mem_free (shlib);
 }
 
 
@@ -129,7 +129,7 @@ xshare_library_t shlib_loadlib (shlib_t *shlib, const char *name)
    if (!nv)
       goto errorexit;
 
-   if (!xvector_ins_tail (shlib->libs, nv))
+   if (!ll_ins_tail (&shlib->libs, nv))
       goto errorexit;
 
    error = false;
@@ -171,7 +171,7 @@ xshare_symbol_t shlib_loadfunc (shlib_t *shlib, const char *func,
    if (!(nv = nv_new (func, funchandle)))
       goto errorexit;
 
-   if (!(xvector_ins_tail (shlib->funcs, nv)))
+   if (!(ll_ins_tail (&shlib->funcs, nv)))
       goto errorexit;
 
    error = false;
@@ -280,8 +280,8 @@ int shlib_funcall (shlib_t *shlib, const char *func, const char *lib,
 
    ret_type = *(get_ffi_type (return_type));
 
-   arg_types = malloc ((sizeof *arg_types) * (nargs + 1));
-   arg_values = malloc ((sizeof *arg_values) * (nargs + 1));
+   arg_types = mem_malloc ((sizeof *arg_types) * (nargs + 1));
+   arg_values = mem_malloc ((sizeof *arg_values) * (nargs + 1));
 
    if (!arg_types || !arg_values)
       goto errorexit;
@@ -307,8 +307,8 @@ int shlib_funcall (shlib_t *shlib, const char *func, const char *lib,
 
 errorexit:
 
-   free (arg_types);
-   free (arg_values);
+   mem_free (arg_types);
+   mem_free (arg_values);
 
    return ret;
 }
@@ -1,6 +1,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "token/token.h"
 
@@ -8,6 +10,213 @@
 #include "xstring/xstring.h"
 
 #define TESTFILE     ("token/test_input.csl")
+#define LOADFILE     ("token/test3_input.csl")
+#define SAMEFILE     ("token/test6_input.csl")
+
+#define BENCH_FORMS        (20000)
+#define BENCH_HEADER       (2000)
+
+// Tokenizes a large generated script, with a long comment header and a
+// mix of comments, indented lists, strings and numbers.
+static bool benchmark (void)
+{
+   static const char *header = ";; A long header of comment lines\n";
+   static const char *form =
+      "; Comment before the definition of a function\n"
+      "(define (fn a b)\n"
+      "      (print \"A string with \\\"escapes\\\" in it\" a b)\n"
+      "      (+ a 12 3.5 (* b 1000)))  ; trailing comment\n";
+
+   size_t hlen = strlen (header), flen = strlen (form);
+   char *script = malloc (hlen * BENCH_HEADER + flen * BENCH_FORMS + 1);
+   if (!script)
+      return false;
+
+   char *tmp = script;
+   for (size_t i=0; i<BENCH_HEADER; i++, tmp += hlen)
+      memcpy (tmp, header, hlen);
+   for (size_t i=0; i<BENCH_FORMS; i++, tmp += flen)
+      memcpy (tmp, form, flen);
+   *tmp = 0;
+
+   tmp = script;
+   clock_t start = clock ();
+   token_t **tokens = token_read_string (&tmp, "benchmark");
+   double nsecs = (double)(clock () - start) * 1e9 / CLOCKS_PER_SEC;
+
+   size_t ntokens = token_array_length (tokens);
+   bool ok = tokens && ntokens == BENCH_FORMS * 25;
+   if (ok) {
+      printf ("\nBENCHMARK tokenize %zu bytes, per token: %6.1f ns\n",
+               (size_t)(tmp - script), nsecs / ntokens);
+   } else {
+      XERROR ("Benchmark script gave %zu tokens\n", ntokens);
+   }
+
+   token_array_del (tokens);
+   free (script);
+
+   return ok;
+}
+
+// Strings and symbols of any length are read whole; only the escapes
+// in a string change its text.
+static bool long_tokens (void)
+{
+   size_t len = 100000;
+   char *script = malloc (len * 2 + 32);
+   if (!script)
+      return false;
+
+   char *tmp = script;
+   *tmp++ = '"';
+   for (size_t i=0; i<len; i++)
+      *tmp++ = 'a' + i % 26;
+   strcpy (tmp, "\\\"\" ");
+   tmp += strlen (tmp);
+   for (size_t i=0; i<len; i++)
+      *tmp++ = 'a' + i % 26;
+   *tmp = 0;
+
+   tmp = script;
+   token_t **tokens = token_read_string (&tmp, "long");
+   const char *str = tokens && tokens[0] ? token_string (tokens[0]) : "";
+
+   bool ok = token_array_length (tokens) == 2 &&
+             token_type (tokens[0]) == token_STRING &&
+             token_string_length (tokens[0]) == len + 3 &&
+             token_length (tokens[0]) == len + 4 &&
+             strcmp (&str[len + 1], "\"\"")==0 &&
+             token_string_length (tokens[1]) == len &&
+             strncmp (token_string (tokens[1]), &script[1], len)==0;
+
+   printf ("Long tokens: %zu and %zu bytes\n", token_string_length (tokens[0]),
+                                              token_string_length (tokens[1]));
+   if (!ok)
+      XERROR ("Long tokens were not read whole\n");
+
+   token_array_del (tokens);
+   free (script);
+
+   return ok;
+}
+
+// A part read alone has the tokens, at the positions, of the whole read
+static bool parts (void)
+{
+   static const char *source = "(one two)\n  (three \"four\nfive\")\n(six) ; seven\n";
+
+   char *tmp = (char *)source;
+   token_t **whole = token_read_string (&tmp, "parts");
+   token_t **part = token_read_part (source, 12, 32, "parts", 2, 3),
+           **tail = token_read_part (source, 12, strlen (source), "parts", 2, 3),
+           **cut = token_read_part (source, 12, 20, "parts", 2, 3);
+
+   bool ok = token_array_length (whole) == 11 &&
+             token_array_length (part) == 4 &&
+             token_array_length (tail) == 7 && !cut;
+   for (size_t i=0; ok && i<token_array_length (tail); i++) {
+      token_t *lhs = whole[i + 4], *rhs = tail[i];
+      ok = strcmp (token_string (lhs), token_string (rhs))==0 &&
+           token_offset (lhs) == token_offset (rhs) &&
+           token_line (lhs) == token_line (rhs) &&
+           token_charpos (lhs) == token_charpos (rhs) &&
+           (i >= 4 || token_offset (part[i]) == token_offset (rhs));
+   }
+
+   printf ("Parts of %zu and %zu tokens\n", token_array_length (part),
+                                            token_array_length (tail));
+   if (!ok)
+      XERROR ("Parts were not read as the whole was\n");
+
+   token_array_del (whole);
+   token_array_del (part);
+   token_array_del (tail);
+   token_array_del (cut);
+
+   return ok;
+}
+
+static bool same_strings (token_t **tokens, const char *expected)
+{
+   char joined[64] = "";
+
+   for (size_t i=0; tokens && tokens[i]; i++) {
+      if (strlen (joined) + token_string_length (tokens[i]) + 2 > sizeof joined)
+         return false;
+      if (i)
+         strcat (joined, " ");
+      strcat (joined, token_string (tokens[i]));
+   }
+
+   return tokens && strcmp (joined, expected)==0;
+}
+
+// Each file is loaded once however often it is named, even in a cycle,
+// and is only tokenized the first time it is read. The cycle names the
+// first file by another path, so that it is read again, from the cache.
+static bool load_once (void)
+{
+   size_t nfiles = 0, nhits = 0;
+
+   token_cache_clear ();
+
+   token_t **first = token_read_file (LOADFILE);
+   token_t **second = token_read_file (LOADFILE);
+   token_cache_stats (&nfiles, &nhits);
+
+   FILE *inf = fopen (LOADFILE, "rb");
+   token_stream_t *ts = inf ? token_stream_new (inf, LOADFILE, 0) : NULL;
+   token_t **form = NULL;
+   bool streamed = ts != NULL;
+   const char *expected[] = { "five", "four", "three", NULL };
+   for (size_t i=0; streamed && expected[i]; i++) {
+      form = token_stream_form (ts);
+      streamed = same_strings (form, expected[i]);
+      token_array_del (form);
+   }
+   streamed = streamed && !token_stream_form (ts) && !token_stream_error (ts);
+   token_stream_del (ts);
+   if (inf)
+      fclose (inf);
+
+   bool ok = same_strings (first, "five four three") &&
+             same_strings (second, "five four three") &&
+             nfiles == 3 && nhits == 5 && streamed;
+
+   printf ("Loaded %zu tokens from %zu files, %zu read from the cache\n",
+            token_array_length (first), nfiles, nhits);
+   if (!ok)
+      XERROR ("Files were loaded more than once, or not cached\n");
+
+   token_array_del (first);
+   token_array_del (second);
+
+   return ok;
+}
+
+// Files with the same contents are different files, so both are added,
+// though they are only tokenized once
+static bool same_contents (void)
+{
+   size_t nfiles = 0, nhits = 0;
+
+   token_cache_clear ();
+
+   token_t **tokens = token_read_file (SAMEFILE);
+   token_cache_stats (&nfiles, &nhits);
+
+   bool ok = same_strings (tokens, "seven seven") && nfiles == 2 && nhits == 1;
+
+   printf ("Loaded %zu tokens from %zu files, %zu read from the cache\n",
+            token_array_length (tokens), nfiles, nhits);
+   if (!ok)
+      XERROR ("Files with the same contents were not both loaded\n");
+
+   token_array_del (tokens);
+
+   return ok;
+}
 
 int main (void)
 {
@@ -33,9 +242,65 @@ int main (void)
                                           token_charpos (tokens[i]),
                                           token_type (tokens[i]),
                                           token_string (tokens[i]));
-      token_del (tokens[i]);
    }
-   free (tokens);
+
+   // A mapped file gives the same tokens, which point back into the
+   // source and share a single copy of its name
+   token_t **mapped = token_read_file (TESTFILE);
+   size_t ntokens = token_array_length (tokens);
+   bool same = mapped && token_array_length (mapped) == ntokens;
+   for (size_t i=0; same && i<ntokens; i++) {
+      same = strcmp (token_string (mapped[i]), token_string (tokens[i]))==0 &&
+             token_line (mapped[i]) == token_line (tokens[i]) &&
+             token_offset (mapped[i]) == token_offset (tokens[i]);
+
+      if (same && token_fname (mapped[i]) == token_fname (mapped[0]) &&
+          token_type (mapped[i]) == token_SYMBOL) {
+         same = token_length (mapped[i]) == strlen (token_string (mapped[i])) &&
+                strncmp (&input[token_offset (mapped[i])],
+                         token_string (mapped[i]),
+                         token_length (mapped[i]))==0;
+      }
+   }
+   same = same && !tokens[ntokens] && !mapped[ntokens] &&
+          token_fname (mapped[0]) == token_fname (tokens[0]);
+
+   // Streams give the same tokens a form at a time, whatever the chunks
+   FILE *inf = fopen (TESTFILE, "rb");
+   token_stream_t *ts = inf ? token_stream_new (inf, TESTFILE, 5) : NULL;
+   token_t **form = NULL;
+   size_t index = 0;
+   bool streamed = same && ts;
+   while (streamed && (form = token_stream_form (ts))) {
+      for (size_t i=0; streamed && form[i]; i++, index++) {
+         streamed = index < ntokens &&
+                    strcmp (token_string (form[i]),
+                            token_string (mapped[index]))==0 &&
+                    token_fname (form[i]) == token_fname (mapped[index]) &&
+                    token_line (form[i]) == token_line (mapped[index]) &&
+                    token_charpos (form[i]) == token_charpos (mapped[index]) &&
+                    token_offset (form[i]) == token_offset (mapped[index]);
+      }
+      token_array_del (form);
+   }
+   streamed = streamed && index == ntokens && !token_stream_error (ts);
+   token_stream_del (ts);
+   if (inf)
+      fclose (inf);
+
+   token_array_del (mapped);
+   token_array_del (tokens);
+
+   if (!same || !streamed) {
+      XERROR ("Mapped or streamed tokens differ from those of a string\n");
+      goto errorexit;
+   }
+
+   if (!long_tokens () || !load_once () || !same_contents () || !parts ())
+      goto errorexit;
+
+   if (!benchmark ())
+      goto errorexit;
 
    ret = EXIT_SUCCESS;
 
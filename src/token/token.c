@@ -1,264 +1,1598 @@
+#ifndef PLATFORM_WINDOWS
+#define _POSIX_C_SOURCE    200112L
+#endif
+
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
 
-#include "token/token.h"
-#include "ll/ll.h"
+#ifdef PLATFORM_WINDOWS
+#include <io.h>
+#define read         _read
+#define close        _close
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "token/token.h"
+#include "mem/mem.h"
+
+#include "xerror/xerror.h"
+
+// Tokens are built into growing vectors and then packed, with their
+// text, into a single block (see builder_finish()), so that an array of
+// any size is released with one free. Only the offset and length of a
+// token in its source file are kept, and the file is kept as an index
+// into a table of interned names.
+struct token_t {
+   uint8_t  type;
+   bool     escaped;     // A string whose text is shorter than its source
+   bool     number;      // An INT or FLOAT whose value was read here
+
+   uint32_t file;
+   uint32_t offset;
+   uint32_t length;
+   uint32_t line;
+   uint32_t charpos;
+
+   union {
+      int64_t ival;
+      double  fval;
+   };
+
+   union {
+      const char *string;  // Once the array is complete
+      size_t      text;    // Until then, the offset in the builder's text
+   };
+};
+
+typedef struct token_array_t token_array_t;
+struct token_array_t {
+   size_t ntokens;
+};
+
+#define ARRAY_HDR(tokens)  (&((token_array_t *)(tokens))[-1])
+
+// A #load found while tokenizing a file: the file named at offset name
+// in the text is loaded just before token at.
+typedef struct load_t load_t;
+struct load_t {
+   size_t at;
+   size_t name;
+};
+
+typedef struct builder_t builder_t;
+struct builder_t {
+   token_t *tokens;
+   size_t   ntokens;
+   size_t   tokens_len;
+
+   char    *text;
+   size_t   ntext;
+   size_t   text_len;
+
+   load_t  *loads;
+   size_t   nloads;
+   size_t   loads_len;
+
+   bool     oom;
+};
+
+// base is at offset in the source file. A lexer over part of a stream
+// has more set until the stream runs out; a token or comment cut short by
+// the end of the part is then left unread, with starved set, so that it
+// can be read again once more of the stream is in (see stream_token()).
+// Lines are counted from 1, and line_offset is the offset in the file of
+// the start of the current line.
+typedef struct lexer_t lexer_t;
+struct lexer_t {
+   const char *base;
+   const char *pos;
+   const char *end;
+   uint32_t    file;
+   size_t      line;
+   size_t      line_offset;
+   size_t      offset;
+   bool        more;
+   bool        starved;
+};
+
+// Source file names are interned, and never freed. The table is shared
+// by every thread reading tokens, and moves as it grows.
+static const char **g_fnames = NULL;
+static uint32_t g_nfnames = 0;
+
+#ifndef PLATFORM_WINDOWS
+static pthread_mutex_t g_fnames_lock = PTHREAD_MUTEX_INITIALIZER;
+#define FNAMES_LOCK()      pthread_mutex_lock (&g_fnames_lock)
+#define FNAMES_UNLOCK()    pthread_mutex_unlock (&g_fnames_lock)
+#else
+#define FNAMES_LOCK()
+#define FNAMES_UNLOCK()
+#endif
+
+static bool fname_intern (const char *fname, uint32_t *index)
+{
+   bool ret = false;
+
+   FNAMES_LOCK ();
+
+   for (uint32_t i=0; i<g_nfnames; i++) {
+      if (strcmp (g_fnames[i], fname)==0) {
+         *index = i;
+         ret = true;
+         goto errorexit;
+      }
+   }
+
+   const char **tmp = mem_realloc (g_fnames, sizeof *tmp * (g_nfnames + 1));
+   if (!tmp)
+      goto errorexit;
+
+   g_fnames = tmp;
+   if (!(g_fnames[g_nfnames] = mem_strdup (fname)))
+      goto errorexit;
+
+   *index = g_nfnames++;
+   ret = true;
+
+errorexit:
+   FNAMES_UNLOCK ();
+
+   return ret;
+}
+
+static const char *fname_get (uint32_t index)
+{
+   FNAMES_LOCK ();
+   const char *ret = g_fnames[index];
+   FNAMES_UNLOCK ();
+
+   return ret;
+}
+
+// Every byte is classed with a single lookup. Anything not listed is
+// part of a symbol or number.
+enum char_class_t {
+   cc_SYMBOL = 0,
+   cc_SPACE,
+   cc_NEWLINE,
+   cc_OPERATOR,
+   cc_QUOTE,
+   cc_COMMENT,
+   cc_END,
+};
+
+static const uint8_t g_cclass[256] = {
+   [0]    = cc_END,
+   ['\t'] = cc_SPACE,    ['\v'] = cc_SPACE,    ['\f'] = cc_SPACE,
+   ['\r'] = cc_SPACE,    [' ']  = cc_SPACE,    ['\n'] = cc_NEWLINE,
+   ['(']  = cc_OPERATOR, [')']  = cc_OPERATOR, ['+']  = cc_OPERATOR,
+   ['-']  = cc_OPERATOR, ['*']  = cc_OPERATOR, ['/']  = cc_OPERATOR,
+   ['!']  = cc_OPERATOR, ['\''] = cc_OPERATOR, [',']  = cc_OPERATOR,
+   [':']  = cc_OPERATOR, ['"']  = cc_QUOTE,    [';']  = cc_COMMENT,
+};
+
+#define CCLASS(c)    (g_cclass[(uint8_t)(c)])
+
+#define IS_BLANK(c)  (CCLASS (c)==cc_SPACE || CCLASS (c)==cc_NEWLINE)
+
+// Whitespace, including newlines, is skipped and the closing quote of a
+// string is found sixteen bytes at a time where SSE2 is available. The
+// last few bytes before end are always checked one at a time.
+static const char *skip_space (const char *p, const char *end)
+{
+#ifdef __SSE2__
+   const __m128i space = _mm_set1_epi8 (' ');
+   const __m128i below = _mm_set1_epi8 ('\t' - 1);
+   const __m128i above = _mm_set1_epi8 ('\r' + 1);
+
+   while (end - p >= 16) {
+      __m128i bytes = _mm_loadu_si128 ((const __m128i *)p);
+      __m128i ctrl = _mm_and_si128 (_mm_cmpgt_epi8 (bytes, below),
+                                    _mm_cmplt_epi8 (bytes, above));
+      __m128i blank = _mm_or_si128 (ctrl, _mm_cmpeq_epi8 (bytes, space));
+
+      unsigned mask = ~(unsigned)_mm_movemask_epi8 (blank) & 0xffff;
+      if (mask)
+         return p + __builtin_ctz (mask);
+      p += 16;
+   }
+#endif
+
+   while (p < end && IS_BLANK (*p))
+      p++;
+
+   return p;
+}
+
+static const char *find_quote (const char *p, const char *end)
+{
+#ifdef __SSE2__
+   const __m128i quote = _mm_set1_epi8 ('"');
+   const __m128i escape = _mm_set1_epi8 ('\\');
+
+   while (end - p >= 16) {
+      __m128i bytes = _mm_loadu_si128 ((const __m128i *)p);
+      __m128i found = _mm_or_si128 (_mm_cmpeq_epi8 (bytes, quote),
+                                    _mm_cmpeq_epi8 (bytes, escape));
+
+      unsigned mask = _mm_movemask_epi8 (found);
+      if (mask)
+         return p + __builtin_ctz (mask);
+      p += 16;
+   }
+#endif
+
+   while (p < end && *p != '"' && *p != '\\')
+      p++;
+
+   return p;
+}
+
+// Counts the lines that end between from and to
+static void count_lines (lexer_t *lex, const char *from, const char *to)
+{
+   for (; from < to; from++) {
+      if (*from == '\n') {
+         lex->line++;
+         lex->line_offset = lex->offset + (from + 1 - lex->base);
+      }
+   }
+}
+
+// Skips whitespace and comments. A comment that runs into the end of a
+// lexer with more to come is left for when its end has been read.
+static const char *lex_skip (lexer_t *lex)
+{
+   const char *p = lex->pos;
+
+   for (;;) {
+      const char *blank = p;
+      if ((p = skip_space (p, lex->end)) != blank)
+         count_lines (lex, blank, p);
+
+      if (p >= lex->end || CCLASS (*p) != cc_COMMENT)
+         break;
+
+      const char *eol = memchr (p, '\n', lex->end - p);
+      if (!eol) {
+         if (!lex->more)
+            p = lex->end;
+         break;
+      }
+      p = eol;
+   }
+
+   lex->pos = p;
+   return p;
+}
+
+static enum token_type_t guess_type (const char *str, size_t len)
+{
+   switch (str[0]) {
+      case '|':   return token_BUFFER;
+      case '(':   return token_STARTL;
+      case '\'':  return token_QUOTE;
+      case ')':   return token_ENDL;
+      case '"':   return token_STRING;
+   }
+
+   if (CCLASS (str[0])==cc_OPERATOR)
+      return token_OPERATOR;
+
+   if (len==3 && memcmp (str, "nil", 3)==0)
+      return token_NIL;
+
+   if (!isdigit ((uint8_t)str[0]))
+      return token_SYMBOL;
+
+   return memchr (str, '.', len) ? token_FLOAT : token_INT;
+}
+
+// Powers of ten that are exact as doubles
+static const double g_pow10[] = {
+   1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define MAX_POW10    ((int)(sizeof g_pow10 / sizeof g_pow10[0]) - 1)
+#define MAX_DIGITS   (19)
+#define DIGIT(c)     ((c) - '0')
+
+static bool read_octal (const char *str, const char *end, uint64_t *value)
+{
+   for (*value = 0; str < end; str++) {
+      if (*str < '0' || *str > '7' || *value > (uint64_t)INT64_MAX >> 3)
+         return false;
+      *value = (*value << 3) | DIGIT (*str);
+   }
+
+   return true;
+}
+
+static bool read_hex (const char *str, const char *end, uint64_t *value)
+{
+   for (*value = 0; str < end; str++) {
+      int digit = isdigit ((uint8_t)*str) ? DIGIT (*str)
+                : isxdigit ((uint8_t)*str) ? (tolower ((uint8_t)*str) - 'a' + 10)
+                : -1;
+      if (digit < 0 || *value > (uint64_t)INT64_MAX >> 4)
+         return false;
+      *value = (*value << 4) | (uint64_t)digit;
+   }
+
+   return true;
+}
+
+// Reads the value of a number into its token, as the parser would have
+// read it from the text: integers as sscanf("%i") reads them, in hex
+// after 0x and in octal after a leading 0, and floats in decimal with a
+// fraction, an exponent or both. A float is converted here when one
+// multiplication or division does it exactly, and by strtod() from the
+// text otherwise. Tokens that are not all number, or integers too large
+// for an int64_t, are left for the parser.
+static void scan_number (token_t *token, const char *str, const char *end,
+                                         const char *text)
+{
+   const char *p = str;
+   uint64_t mantissa = 0;
+   int nsig = 0, exp10 = 0;
+   bool is_float = false;
+
+   if (end - str > 2 && str[0]=='0' && (str[1]=='x' || str[1]=='X')) {
+      if ((token->number = read_hex (&str[2], end, &mantissa)))
+         token->ival = (int64_t)mantissa;
+      return;
+   }
+
+   for (; p < end && isdigit ((uint8_t)*p); p++) {
+      if ((mantissa || *p != '0') && ++nsig <= MAX_DIGITS)
+         mantissa = mantissa * 10 + DIGIT (*p);
+   }
+   size_t nint = p - str;
+
+   if (p < end && *p == '.') {
+      is_float = true;
+      for (p++; p < end && isdigit ((uint8_t)*p); p++, exp10--) {
+         if ((mantissa || *p != '0') && ++nsig <= MAX_DIGITS)
+            mantissa = mantissa * 10 + DIGIT (*p);
+      }
+   }
+
+   if (p < end && (*p == 'e' || *p == 'E')) {
+      int exp = 0, sign = 1;
+      is_float = true;
+
+      if (++p < end && (*p == '+' || *p == '-'))
+         sign = *p++ == '-' ? -1 : 1;
+
+      if (p >= end || !isdigit ((uint8_t)*p))
+         return;
+
+      for (; p < end && isdigit ((uint8_t)*p); p++) {
+         if (exp < 100000)
+            exp = exp * 10 + DIGIT (*p);
+      }
+      exp10 += sign * exp;
+   }
+
+   if (p != end)
+      return;
+
+   if (!is_float) {
+      if (str[0]=='0' && nint > 1) {
+         if (!read_octal (str, end, &mantissa))
+            return;
+      } else if (nsig > MAX_DIGITS || mantissa > (uint64_t)INT64_MAX) {
+         return;
+      }
+
+      token->ival = (int64_t)mantissa;
+      token->number = true;
+      return;
+   }
+
+   token->type = token_FLOAT;
+   token->number = true;
+
+   if (nsig > MAX_DIGITS || mantissa > (UINT64_C (1) << 53) ||
+       exp10 < -MAX_POW10 || exp10 > MAX_POW10) {
+      token->fval = strtod (text, NULL);
+      return;
+   }
+
+   token->fval = exp10 < 0 ? (double)mantissa / g_pow10[-exp10]
+                           : (double)mantissa * g_pow10[exp10];
+}
+
+// Makes room for n more bytes of text
+static char *builder_reserve (builder_t *b, size_t n)
+{
+   if (b->ntext + n > b->text_len) {
+      size_t newlen = b->text_len ? b->text_len * 2 : 4096;
+      while (newlen < b->ntext + n)
+         newlen *= 2;
+
+      char *tmp = mem_realloc (b->text, newlen);
+      if (!tmp) {
+         b->oom = true;
+         return NULL;
+      }
+
+      b->text = tmp;
+      b->text_len = newlen;
+   }
+
+   return &b->text[b->ntext];
+}
+
+static bool builder_text (builder_t *b, const char *str, size_t len,
+                                         size_t *text)
+{
+   char *dst = builder_reserve (b, len + 1);
+   if (!dst)
+      return false;
+
+   memcpy (dst, str, len);
+   dst[len] = 0;
+
+   *text = b->ntext;
+   b->ntext += len + 1;
+
+   return true;
+}
+
+// Copies the string in [str, end) without the backslash in front of each
+// escaped character.
+static bool builder_unescape (builder_t *b, const char *str, const char *end,
+                                            size_t *text)
+{
+   char *dst = builder_reserve (b, end - str + 1);
+   if (!dst)
+      return false;
+
+   *text = b->ntext;
+
+   while (str < end) {
+      const char *escape = memchr (str, '\\', end - str);
+      size_t n = (escape ? escape : end) - str;
+
+      memcpy (dst, str, n);
+      dst += n;
+      if (!escape)
+         break;
+
+      *dst++ = escape[1];
+      str = escape + 2;
+   }
+
+   *dst++ = 0;
+   b->ntext = dst - b->text;
+
+   return true;
+}
+
+// Makes room for n more tokens
+static token_t *builder_grow (builder_t *b, size_t n)
+{
+   if (b->ntokens + n > b->tokens_len) {
+      size_t newlen = b->tokens_len ? b->tokens_len * 2 : 256;
+      while (newlen < b->ntokens + n)
+         newlen *= 2;
+
+      token_t *tmp = mem_realloc (b->tokens, sizeof *tmp * newlen);
+      if (!tmp) {
+         b->oom = true;
+         return NULL;
+      }
+
+      b->tokens = tmp;
+      b->tokens_len = newlen;
+   }
+
+   return &b->tokens[b->ntokens];
+}
+
+static bool builder_add (builder_t *b, const token_t *token)
+{
+   token_t *dst = builder_grow (b, 1);
+   if (!dst)
+      return false;
+
+   *dst = *token;
+   b->ntokens++;
+   return true;
+}
+
+static bool builder_load (builder_t *b, size_t name)
+{
+   if (b->nloads >= b->loads_len) {
+      size_t newlen = b->loads_len ? b->loads_len * 2 : 8;
+      load_t *tmp = mem_realloc (b->loads, sizeof *tmp * newlen);
+      if (!tmp) {
+         b->oom = true;
+         return false;
+      }
+
+      b->loads = tmp;
+      b->loads_len = newlen;
+   }
+
+   b->loads[b->nloads].at = b->ntokens;
+   b->loads[b->nloads].name = name;
+   b->nloads++;
+
+   return true;
+}
+
+static void builder_clear (builder_t *b)
+{
+   mem_free (b->tokens);
+   mem_free (b->text);
+   mem_free (b->loads);
+   memset (b, 0, sizeof *b);
+}
+
+// Lays out the header, the NULL-terminated array of pointers, the tokens
+// and their text in one block. Nothing is returned if the builder ran
+// out of memory on the way.
+static token_t **builder_finish (builder_t *b)
+{
+   size_t nptrs = sizeof (token_t *) * (b->ntokens + 1);
+   size_t ntokens = sizeof (token_t) * b->ntokens;
+
+   token_array_t *hdr = b->oom ? NULL :
+                        mem_malloc (sizeof *hdr + nptrs + ntokens + b->ntext);
+   if (!hdr) {
+      builder_clear (b);
+      return NULL;
+   }
+
+   token_t **ret = (token_t **)&hdr[1];
+   token_t *tokens = (token_t *)((char *)ret + nptrs);
+   char *text = (char *)tokens + ntokens;
+
+   hdr->ntokens = b->ntokens;
+   if (b->ntext)
+      memcpy (text, b->text, b->ntext);
+
+   for (size_t i=0; i<b->ntokens; i++) {
+      tokens[i] = b->tokens[i];
+      tokens[i].string = &text[b->tokens[i].text];
+      ret[i] = &tokens[i];
+   }
+   ret[b->ntokens] = NULL;
+
+   builder_clear (b);
+
+   return ret;
+}
+
+// Returns the end of the string that starts at p, or NULL if it runs
+// into end. escaped is set if the string has any backslashes in it.
+static const char *scan_string (const char *p, const char *end, bool *escaped)
+{
+   const char *stop = find_quote (p + 1, end);
+
+   while (stop < end && *stop == '\\') {
+      *escaped = true;
+      stop = stop + 1 < end ? find_quote (stop + 2, end) : end;
+   }
+
+   return stop < end ? stop + 1 : NULL;
+}
+
+static bool snext_token (lexer_t *lex, builder_t *b, token_t *token)
+{
+   bool escaped = false;
+
+   lex->starved = false;
+
+   const char *start = lex_skip (lex);
+   const char *end = start;
+
+   if (start >= lex->end || CCLASS (*start)==cc_COMMENT) {
+      lex->starved = lex->more;
+      return false;
+   }
+
+   size_t offset = lex->offset + (start - lex->base);
+
+   switch (CCLASS (*start)) {
+      case cc_END:
+         return false;
+
+      case cc_OPERATOR:
+         end++;
+         break;
+
+      case cc_QUOTE:
+         if (!(end = scan_string (start, lex->end, &escaped))) {
+            if (!(lex->starved = lex->more)) {
+               XERROR ("End of input while reading string at [%s:%zu,%zu]\n",
+                        fname_get (lex->file), lex->line,
+                        offset - lex->line_offset + 1);
+               lex->pos = lex->end;
+            }
+            return false;
+         }
+         break;
+
+      default:
+         while (end < lex->end && CCLASS (*end)==cc_SYMBOL)
+            end++;
+
+         if (end >= lex->end && lex->more) {
+            lex->starved = true;
+            return false;
+         }
+         break;
+   }
+
+   if (lex->offset + (end - lex->base) > UINT32_MAX)
+      return false;
+
+   bool copied = escaped ? builder_unescape (b, start, end, &token->text)
+                         : builder_text (b, start, end - start, &token->text);
+   if (!copied)
+      return false;
+
+   token->type = guess_type (start, end - start);
+   token->escaped = escaped;
+   token->number = false;
+   if (token->type==token_INT || token->type==token_FLOAT)
+      scan_number (token, start, end, &b->text[token->text]);
+
+   token->file = lex->file;
+   token->offset = (uint32_t)offset;
+   token->length = (uint32_t)(end - start);
+   token->line = (uint32_t)lex->line;
+   token->charpos = (uint32_t)(offset - lex->line_offset + 1);
+
+   // Only strings span lines
+   if (token->type==token_STRING)
+      count_lines (lex, start, end);
+   lex->pos = end;
+
+   return true;
+}
+
+static bool is_load (const builder_t *b, const token_t *token)
+{
+   return strcmp (&b->text[token->text], "#load")==0;
+}
+
+// Returns a copy of the unquoted name of the file to load, and drops the
+// text of both the #load token and the name from the builder.
+static char *load_name (builder_t *b, const token_t *token,
+                                      const token_t *load_fname)
+{
+   char *tmpfname = &b->text[load_fname->text];
+   char *equote = strrchr (tmpfname, '"');
+   if (equote) *equote = 0;
+   if (tmpfname[0] == '"')
+      tmpfname++;
+
+   char *ret = mem_strdup (tmpfname);
+   b->ntext = token->text;
+
+   if (!ret)
+      b->oom = true;
+
+   return ret;
+}
+
+static char *read_file (const char *fname, size_t *len)
+{
+   bool error = true;
+   char *ret = NULL;
+   long flen = 0;
+
+   FILE *inf = fopen (fname, "rb");
+   if (!inf)
+      return NULL;
+
+   if (fseek (inf, 0, SEEK_END) || (flen = ftell (inf)) < 0 ||
+       fseek (inf, 0, SEEK_SET))
+      goto errorexit;
+
+   if (!(ret = mem_malloc (flen + 1)))
+      goto errorexit;
+
+   if (fread (ret, 1, flen, inf) != (size_t)flen)
+      goto errorexit;
+
+   ret[flen] = 0;
+   *len = flen;
+
+   error = false;
+
+errorexit:
+
+   fclose (inf);
+
+   if (error) {
+      mem_free (ret);
+      ret = NULL;
+   }
+
+   return ret;
+}
+
+// A file that is read, known by its name and, where possible, by its
+// device and inode, as it may be loaded by another name.
+typedef struct loaded_t loaded_t;
+struct loaded_t {
+   uint32_t file;
+   bool     known;
+#ifndef PLATFORM_WINDOWS
+   dev_t    dev;
+   ino_t    ino;
+#endif
+};
+
+static void loaded_set (loaded_t *id, uint32_t file, FILE *inf, int fd)
+{
+   memset (id, 0, sizeof *id);
+   id->file = file;
+
+#ifndef PLATFORM_WINDOWS
+   struct stat sb;
+   if (fstat (inf ? fileno (inf) : fd, &sb)==0) {
+      id->known = true;
+      id->dev = sb.st_dev;
+      id->ino = sb.st_ino;
+   }
+#else
+   inf = inf;
+   fd = fd;
+#endif
+}
+
+static bool loaded_same (const loaded_t *lhs, const loaded_t *rhs)
+{
+   if (lhs->file==rhs->file)
+      return true;
+#ifndef PLATFORM_WINDOWS
+   if (lhs->known && rhs->known && lhs->dev==rhs->dev && lhs->ino==rhs->ino)
+      return true;
+#endif
+
+   return false;
+}
+
+// The source is only needed while it is being tokenized, so it is mapped
+// rather than read where possible. Returns NULL (with errno set) if the
+// file cannot be read; an empty file maps to an empty string. The device
+// and inode of a file that is mapped are set in id.
+static const char *source_map (const char *fname, size_t *len, bool *mapped,
+                               loaded_t *id)
+{
+   *mapped = false;
+
+#ifndef PLATFORM_WINDOWS
+   struct stat sb;
+   int fd = open (fname, O_RDONLY);
+   if (fd < 0)
+      return NULL;
+
+   loaded_set (id, id->file, NULL, fd);
+
+   if (fstat (fd, &sb)==0 && S_ISREG (sb.st_mode)) {
+      void *ret = sb.st_size ? mmap (NULL, sb.st_size, PROT_READ,
+                                     MAP_PRIVATE, fd, 0)
+                             : (void *)"";
+      close (fd);
+      if (ret==MAP_FAILED)
+         return NULL;
+
+      *len = sb.st_size;
+      *mapped = true;
+      return ret;
+   }
+
+   close (fd);
+#endif
+
+   return read_file (fname, len);
+}
+
+static void source_unmap (const char *source, size_t len, bool mapped)
+{
+#ifndef PLATFORM_WINDOWS
+   if (mapped) {
+      if (len)
+         munmap ((void *)source, len);
+      return;
+   }
+#endif
+   len = len;
+   mapped = mapped;
+   mem_free ((void *)source);
+}
+
+// The tokens of one file, with its #load directives recorded in loads
+// rather than followed. Fragments of files are cached by their source,
+// found by its hash and checked against a copy of it, for the life of
+// the process and never change once made, so that any number of loads,
+// in any number of runtimes, share one. Their tokens have no file, as
+// the same source may have many names.
+typedef struct fragment_t fragment_t;
+struct fragment_t {
+   fragment_t *next;       // In its cache bucket
+   uint64_t    hash;
+   size_t      len;
+   char       *source;     // Only set once cached
+
+   token_t    *tokens;
+   size_t      ntokens;
+   char       *text;
+   size_t      ntext;
+   load_t     *loads;
+   size_t      nloads;
+};
+
+#define CACHE_BUCKETS      (64)
+#define LOAD_THREADS       (4)
+
+static fragment_t *g_cache[CACHE_BUCKETS];
+static size_t g_cache_nfiles = 0;
+static size_t g_cache_nhits = 0;
+
+#ifndef PLATFORM_WINDOWS
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define CACHE_LOCK()       pthread_mutex_lock (&g_cache_lock)
+#define CACHE_UNLOCK()     pthread_mutex_unlock (&g_cache_lock)
+#else
+#define CACHE_LOCK()
+#define CACHE_UNLOCK()
+#endif
+
+static uint64_t source_hash (const char *source, size_t len)
+{
+   uint64_t ret = UINT64_C (14695981039346656037);
+   for (size_t i=0; i<len; i++) {
+      ret ^= (uint8_t)source[i];
+      ret *= UINT64_C (1099511628211);
+   }
+   return ret;
+}
+
+static void fragment_del (fragment_t *frag)
+{
+   if (!frag)
+      return;
+
+   mem_free (frag->tokens);
+   mem_free (frag->text);
+   mem_free (frag->loads);
+   mem_free (frag->source);
+   mem_free (frag);
+}
+
+// Tokenizes everything the lexer has, keeping the unquoted name of each
+// file to load in the text.
+static fragment_t *fragment_new (lexer_t *lex)
+{
+   builder_t b;
+   token_t token;
+   fragment_t *ret = NULL;
 
-#include "xstring/xstring.h"
-#include "xerror/xerror.h"
+   memset (&b, 0, sizeof b);
 
-struct token_t {
-   enum token_type_t type;
+   while (snext_token (lex, &b, &token)) {
 
-   char *string;
-   char *fname;
-   size_t line;
-   size_t charpos;
-};
+      if (is_load (&b, &token)) {
 
-static bool is_operator (int c)
-{
-   static const char *operators = "()+-*/!',:";
-   return strchr (operators, (char)c);
-}
+         token_t load_fname;
+         if (!snext_token (lex, &b, &load_fname))
+            break;
 
-static enum token_type_t guess_type (const char *str)
-{
-   if (!str || !*str)
-      return token_UNKNOWN;
+         char *name = &b.text[load_fname.text];
+         char *equote = strrchr (name, '"');
+         if (equote) *equote = 0;
+
+         if (!builder_load (&b, load_fname.text + (name[0] == '"')))
+            break;
+         continue;
+      }
+
+      if (!builder_add (&b, &token))
+         break;
+   }
 
-   if (strcmp (str, "nil")==0)   return token_NIL;
-   if (str[0] == '|')            return token_BUFFER;
-   if (str[0] == '(')            return token_STARTL;
-   if (str[0] == '\'')           return token_QUOTE;
-   if (str[0] == ')')            return token_ENDL;
-   if (str[0] == '"')            return token_STRING;
-   if (is_operator (str[0]))     return token_OPERATOR;
-   enum token_type_t type = token_SYMBOL;
-   if (isdigit (str[0]))
-      type = token_INT;
+   if (b.oom || !(ret = mem_calloc (1, sizeof *ret))) {
+      builder_clear (&b);
+      return NULL;
+   }
 
-   if (strchr (str, '.') && type==token_INT)
-      type = token_FLOAT;
+   ret->tokens = b.tokens;
+   ret->ntokens = b.ntokens;
+   ret->text = b.text;
+   ret->ntext = b.ntext;
+   ret->loads = b.loads;
+   ret->nloads = b.nloads;
 
-   return type;
+   return ret;
 }
 
-static token_t *token_new (const char *str, const char *fname,
-                                            size_t line,
-                                            size_t charpos)
+static fragment_t *cache_find (uint64_t hash, const char *source, size_t len)
 {
-   bool error = true;
-   token_t *ret = NULL;
+   fragment_t *ret = g_cache[hash % CACHE_BUCKETS];
+   while (ret && (ret->hash != hash || ret->len != len ||
+                  memcmp (ret->source, source, len)))
+      ret = ret->next;
 
-   if (!(ret = calloc (1, sizeof *ret)))
-      goto errorexit;
+   return ret;
+}
 
-   ret->string = xstr_dup (str);
-   ret->fname = xstr_dup (fname);
+// Returns the fragment for a file. A file read on two threads at once is
+// tokenized on both, and the fragment cached first is kept.
+static fragment_t *cache_fragment (const char *source, size_t len,
+                                   uint32_t file)
+{
+   uint64_t hash = source_hash (source, len);
 
-   if (!ret->string || !ret->string[0] || !ret->fname)
-      goto errorexit;
+   CACHE_LOCK ();
+   fragment_t *ret = cache_find (hash, source, len);
+   if (ret)
+      g_cache_nhits++;
+   CACHE_UNLOCK ();
 
-   ret->line = line;
-   ret->charpos = charpos;
-   ret->type = guess_type (str);
+   if (ret)
+      return ret;
 
-   error = false;
+   lexer_t lex = { source, source, source + len, file, 1, 0, 0, false, false };
+   fragment_t *frag = fragment_new (&lex);
+   if (!frag)
+      return NULL;
 
-errorexit:
-   if (error) {
-      token_del (ret);
-      ret = NULL;
+   frag->hash = hash;
+   frag->len = len;
+   if (!(frag->source = mem_malloc (len + 1))) {
+      fragment_del (frag);
+      return NULL;
+   }
+   memcpy (frag->source, source, len);
+
+   CACHE_LOCK ();
+   if (!(ret = cache_find (hash, source, len))) {
+      ret = frag;
+      ret->next = g_cache[hash % CACHE_BUCKETS];
+      g_cache[hash % CACHE_BUCKETS] = ret;
+      g_cache_nfiles++;
+      frag = NULL;
    }
+   CACHE_UNLOCK ();
+
+   fragment_del (frag);
 
    return ret;
 }
 
-token_t **token_read_file (const char *fname)
-{
-   char *input = NULL;
-   token_t **ret = NULL;
+// Each file named by a #load is a unit of the load. Files are read a
+// round at a time: the first round is the file being read, and each
+// round after that the files first named by the one before.
+typedef struct unit_t unit_t;
+struct unit_t {
+   loaded_t    id;
+   fragment_t *frag;
+   bool        owned;      // Not cached, so deleted with the loader
+   bool        spliced;
+};
 
-   if (!(input = xstr_readfile (fname))) {
-      XERROR ("Unable to read [%s]: %m\n", fname);
-      return NULL;
+typedef struct loader_t loader_t;
+struct loader_t {
+   unit_t   *units;
+   size_t    nunits;
+   size_t    units_len;
+
+   // The units of the round being read
+   size_t    next;
+   size_t    last;
+#ifndef PLATFORM_WINDOWS
+   pthread_mutex_t lock;
+#endif
+};
+
+static unit_t *loader_find (loader_t *ld, const char *fname)
+{
+   for (size_t i=0; i<ld->nunits; i++) {
+      if (strcmp (fname_get (ld->units[i].id.file), fname)==0)
+         return &ld->units[i];
    }
 
-   char *tmp = input;
+   return NULL;
+}
 
-   ret = token_read_string (&tmp, fname);
+static unit_t *loader_add (loader_t *ld, const char *fname)
+{
+   if (ld->nunits >= ld->units_len) {
+      size_t newlen = ld->units_len ? ld->units_len * 2 : 8;
+      unit_t *tmp = mem_realloc (ld->units, sizeof *tmp * newlen);
+      if (!tmp)
+         return NULL;
+
+      ld->units = tmp;
+      ld->units_len = newlen;
+   }
 
-   free (input);
+   unit_t *ret = &ld->units[ld->nunits];
+   memset (ret, 0, sizeof *ret);
+   if (!fname_intern (fname, &ret->id.file))
+      return NULL;
 
+   ld->nunits++;
    return ret;
 }
 
-static token_t *snext_token (char **input, const char *fname,
-                             size_t *line, size_t *cpos)
+static void unit_read (unit_t *unit)
 {
-   bool error = true;
-   token_t *ret = NULL;
-   bool in_str = false;
-   char *start = (*input);
+   const char *fname = fname_get (unit->id.file);
+   size_t len = 0;
+   bool mapped = false;
 
-   char tmps[MAX_TOKEN_LENGTH];
-   size_t ll, cp;
+   if (unit->frag)
+      return;
 
-   ll = line ? *line : 0;
-   cp = cpos ? *cpos : 0;
+   const char *source = source_map (fname, &len, &mapped, &unit->id);
+   if (!source) {
+      XERROR ("Unable to read [%s]: %m\n", fname);
+      return;
+   }
 
-   memset (tmps, 0, sizeof tmps);
+   if (!(unit->frag = cache_fragment (source, len, unit->id.file)))
+      XERROR ("Unable to tokenize [%s]\n", fname);
 
-   // Skip all whitespace
-   while (*start && isspace (*start))
-      start++;
+   source_unmap (source, len, mapped);
+}
 
-   if (!*start)
-      goto errorexit;
+static void *loader_worker (void *arg)
+{
+   loader_t *ld = arg;
+
+   for (;;) {
+#ifndef PLATFORM_WINDOWS
+      pthread_mutex_lock (&ld->lock);
+#endif
+      size_t index = ld->next++;
+#ifndef PLATFORM_WINDOWS
+      pthread_mutex_unlock (&ld->lock);
+#endif
+      if (index >= ld->last)
+         break;
 
-   char *end = start;
-   for (size_t i=0; i<sizeof tmps; i++) {
+      unit_read (&ld->units[index]);
+   }
 
-      if (!end || !*end)
-         break;
+   return NULL;
+}
 
-      if (i >= (sizeof tmps - 1))
-         goto errorexit;
+// Reads the units in [first, last), spreading them over a few threads.
+// A host allocator need not be thread-safe, so with one set they are
+// all read on this thread.
+static void loader_read (loader_t *ld, size_t first, size_t last)
+{
+   ld->next = first;
+   ld->last = last;
 
-      if (*end == ';') {
-         while (*end && *end != '\n')
-            end++;
-         ll++; cp = 1;
-         (*input) = end;
-         ret = snext_token (input, fname, &ll, &cp);
-         if (line) *line = ll;
-         if (cpos) *cpos = cp;
-         return ret;
-      }
+#ifndef PLATFORM_WINDOWS
+   pthread_t threads[LOAD_THREADS - 1];
+   size_t nthreads = 0;
 
-      if (*end == '\n') {
-         ll++; cp = 1;
-      } else {
-         cp++;
-      }
+   while (!mem_hooked () && nthreads < LOAD_THREADS - 1 &&
+          nthreads + 1 < last - first &&
+          pthread_create (&threads[nthreads], NULL, loader_worker, ld)==0)
+      nthreads++;
 
-      if (in_str) {
+   loader_worker (ld);
 
-         if (*end == '"') {
-            in_str = false;
-            tmps[i] = '"';
-            end++;
-            break;
-         }
+   for (size_t i=0; i<nthreads; i++)
+      pthread_join (threads[i], NULL);
+#else
+   loader_worker (ld);
+#endif
+}
 
-         if (*end == '\\') {
-            end++;
-            cp++;
-         }
+// Reads every file that the units already added load, directly or not
+static bool loader_run (loader_t *ld)
+{
+   size_t first = 0;
 
-         tmps[i] = *end;
-         end++;
-         continue;
-      }
+   while (first < ld->nunits) {
+      size_t last = ld->nunits;
 
-      if (*end == '"') {
-         in_str = true;
-         tmps[i] = '"';
-         end++;
-         continue;
-      }
+      loader_read (ld, first, last);
 
-      if (is_operator (*end)) {
-         if (i) {
-         } else {
-            tmps[0] = *end;
-            end++;
+      for (size_t i=first; i<last; i++) {
+         fragment_t *frag = ld->units[i].frag;
+         for (size_t j=0; frag && j<frag->nloads; j++) {
+            const char *fname = &frag->text[frag->loads[j].name];
+            if (!loader_find (ld, fname) && !loader_add (ld, fname))
+               return false;
          }
-         break;
       }
 
-      if (isspace (*end))
+      first = last;
+   }
+
+   return true;
+}
+
+// Units are known by name, so a file is also spliced if the same file
+// was spliced by another name, but not if another file with the same
+// contents was.
+static bool loader_spliced (const loader_t *ld, const unit_t *unit)
+{
+   for (size_t i=0; i<ld->nunits; i++) {
+      if (ld->units[i].spliced && loaded_same (&ld->units[i].id, &unit->id))
+         return true;
+   }
+
+   return false;
+}
+
+// Adds the tokens of a unit to the builder, with those of each file it
+// loads in place of its #load. A file is only added the first time it
+// is loaded, which also ends any cycle of loads.
+static bool loader_splice (loader_t *ld, builder_t *b, unit_t *unit)
+{
+   fragment_t *frag = unit->frag;
+
+   if (!frag || loader_spliced (ld, unit))
+      return true;
+
+   unit->spliced = true;
+
+   size_t base = b->ntext;
+   char *text = builder_reserve (b, frag->ntext);
+   if (!text)
+      return false;
+
+   memcpy (text, frag->text, frag->ntext);
+   b->ntext += frag->ntext;
+
+   // The tokens up to each #load are copied at once
+   size_t i = 0;
+   for (size_t load=0; load<=frag->nloads; load++) {
+      size_t at = load < frag->nloads ? frag->loads[load].at : frag->ntokens;
+      token_t *dst = builder_grow (b, at - i);
+      if (!dst && at > i)
+         return false;
+
+      b->ntokens += at - i;
+      for (; i<at; i++, dst++) {
+         *dst = frag->tokens[i];
+         dst->text += base;
+         dst->file = unit->id.file;
+      }
+
+      if (load == frag->nloads)
          break;
 
-      tmps[i] = *end;
-      end++;
+      unit_t *dep = loader_find (ld, &frag->text[frag->loads[load].name]);
+      if (dep && !loader_splice (ld, b, dep))
+         return false;
    }
 
-   if (in_str) {
-      XERROR ("End of input while reading string [%s]\n", tmps);
-      goto errorexit;
+   return true;
+}
+
+static void loader_del (loader_t *ld)
+{
+   for (size_t i=0; i<ld->nunits; i++) {
+      if (ld->units[i].owned)
+         fragment_del (ld->units[i].frag);
    }
 
-   if (!(ret = token_new (tmps, fname, (*line), (*cpos))))
-      goto errorexit;
+   mem_free (ld->units);
 
-   error = false;
-errorexit:
+#ifndef PLATFORM_WINDOWS
+   pthread_mutex_destroy (&ld->lock);
+#endif
+}
 
-   if (error) {
-      token_del (ret);
-      ret = NULL;
-   }
+// Loads everything the first unit loads, and returns all of its tokens
+static token_t **loader_finish (loader_t *ld)
+{
+   builder_t b;
+   token_t **ret = NULL;
 
-   if (line) (*line) = ll;
-   if (cpos) (*cpos) = cp;
+   memset (&b, 0, sizeof b);
 
-   (*input) = end;
+   if (loader_run (ld) && loader_splice (ld, &b, &ld->units[0]))
+      ret = builder_finish (&b);
+   else
+      builder_clear (&b);
+
+   loader_del (ld);
 
    return ret;
+}
+
+static bool loader_init (loader_t *ld)
+{
+   memset (ld, 0, sizeof *ld);
+#ifndef PLATFORM_WINDOWS
+   return pthread_mutex_init (&ld->lock, NULL)==0;
+#else
+   return true;
+#endif
+}
+
+token_t **token_read_file (const char *fname)
+{
+   loader_t ld;
+   if (!loader_init (&ld))
+      return NULL;
+
+   unit_t *root = loader_add (&ld, fname);
+   if (root)
+      unit_read (root);
+
+   if (!root || !root->frag) {
+      loader_del (&ld);
+      return NULL;
+   }
 
+   return loader_finish (&ld);
 }
 
 token_t **token_read_string (char **input, const char *fname)
 {
-   token_t **ret = NULL;
-   token_t *token = NULL;
+   loader_t ld;
+   if (!loader_init (&ld))
+      return NULL;
+
+   // A string is not cached, as it is seldom read twice
+   unit_t *root = loader_add (&ld, fname);
+   if (root) {
+      lexer_t lex = { *input, *input, *input + strlen (*input), root->id.file,
+                      1, 0, 0, false, false };
+      root->frag = fragment_new (&lex);
+      root->owned = true;
+      *input = (char *)lex.pos;
+   }
+
+   if (!root || !root->frag) {
+      loader_del (&ld);
+      return NULL;
+   }
+
+   return loader_finish (&ld);
+}
+
+// The lexer is told there is more to come unless end is the end of the
+// source, so that a token cut short by end leaves it starved before end.
+token_t **token_read_part (const char *source, size_t start, size_t end,
+                           const char *fname, size_t line, size_t charpos)
+{
+   loader_t ld;
+   if (!loader_init (&ld))
+      return NULL;
+
+   unit_t *root = loader_add (&ld, fname);
+   if (root) {
+      lexer_t lex = { &source[start], &source[start], &source[end],
+                      root->id.file, line, start - (charpos - 1), start,
+                      source[end] != 0, false };
+      root->frag = fragment_new (&lex);
+      root->owned = true;
+      if (lex.starved && lex.pos < lex.end) {
+         fragment_del (root->frag);
+         root->frag = NULL;
+      }
+   }
+
+   if (!root || !root->frag) {
+      loader_del (&ld);
+      return NULL;
+   }
+
+   return loader_finish (&ld);
+}
+
+void token_cache_stats (size_t *nfiles, size_t *nhits)
+{
+   CACHE_LOCK ();
+   *nfiles = g_cache_nfiles;
+   *nhits = g_cache_nhits;
+   CACHE_UNLOCK ();
+}
+
+void token_cache_clear (void)
+{
+   CACHE_LOCK ();
+   for (size_t i=0; i<CACHE_BUCKETS; i++) {
+      while (g_cache[i]) {
+         fragment_t *frag = g_cache[i];
+         g_cache[i] = frag->next;
+         fragment_del (frag);
+      }
+   }
+   g_cache_nfiles = 0;
+   g_cache_nhits = 0;
+   CACHE_UNLOCK ();
+}
+
+// A stream reads its input a chunk at a time into a window, from which
+// consumed bytes are dropped before the next chunk is read. Files loaded
+// with #load are pushed as sources of their own and read in the same
+// way, then popped at their end.
+typedef struct source_t source_t;
+struct source_t {
+   source_t *next;      // The source that loaded this one
+   FILE     *inf;       // Read from inf if set, from fd otherwise
+   int       fd;
+   bool      owned;     // Opened by the stream, so closed by it too
+   bool      eof;
+
+   char     *buf;
+   size_t    buf_len;
+   lexer_t   lex;       // Over the unread part of buf
+};
+
+// Each file is only read once, so that a file loaded again, or a cycle
+// of loads, is skipped.
+struct token_stream_t {
+   source_t *source;
+   size_t    chunk;
+   bool      error;
+
+   loaded_t *loaded;
+   size_t    nloaded;
+};
+
+static bool stream_loaded (const token_stream_t *ts, const loaded_t *id)
+{
+   for (size_t i=0; i<ts->nloaded; i++) {
+      if (loaded_same (&ts->loaded[i], id))
+         return true;
+   }
+
+   return false;
+}
+
+static source_t *source_push (token_stream_t *ts, FILE *inf, int fd,
+                                                  const char *fname)
+{
+   source_t *ret = mem_calloc (1, sizeof *ret);
+   if (!ret)
+      return NULL;
 
-   if (!(ret = (token_t **)ll_new ()))
+   loaded_t *loaded = mem_realloc (ts->loaded,
+                                   sizeof *loaded * (ts->nloaded + 1));
+   if (loaded)
+      ts->loaded = loaded;
+
+   if (!loaded || !fname_intern (fname, &ret->lex.file)) {
+      mem_free (ret);
       return NULL;
+   }
 
-   size_t line = 0, charpos = 0;
+   loaded_set (&ts->loaded[ts->nloaded++], ret->lex.file, inf, fd);
+   ret->inf = inf;
+   ret->fd = fd;
+   ret->lex.line = 1;
+   ret->lex.more = true;
+   ret->next = ts->source;
+   ts->source = ret;
 
-   while ((token = snext_token (input, fname, &line, &charpos))!=NULL) {
+   return ret;
+}
+
+static void source_pop (token_stream_t *ts)
+{
+   source_t *src = ts->source;
+
+   if (src->owned)
+      fclose (src->inf);
+
+   ts->source = src->next;
+   mem_free (src->buf);
+   mem_free (src);
+}
+
+// Drops the consumed part of the window and reads another chunk after
+// what is left of it, growing the buffer only if a single token does not
+// fit.
+static bool source_fill (source_t *src, size_t chunk)
+{
+   lexer_t *lex = &src->lex;
+   size_t keep = lex->end - lex->pos;
+
+   if (src->buf && lex->pos > src->buf) {
+      lex->offset += lex->pos - src->buf;
+      memmove (src->buf, lex->pos, keep);
+   }
+
+   if (src->buf_len - keep < chunk) {
+      char *tmp = mem_realloc (src->buf, keep + chunk);
+      if (!tmp)
+         return false;
 
-      if (strcmp (token->string, "#load")==0) {
+      src->buf = tmp;
+      src->buf_len = keep + chunk;
+   }
+
+   long nbytes = src->inf ? (long)fread (&src->buf[keep], 1, chunk, src->inf)
+                          : (long)read (src->fd, &src->buf[keep], chunk);
+   if (nbytes < 0 || (src->inf && ferror (src->inf)))
+      return false;
 
-         token_t *load_fname = snext_token (input, fname, &line, &charpos);
+   src->eof = nbytes==0;
+   lex->more = !src->eof;
+   lex->base = lex->pos = src->buf;
+   lex->end = &src->buf[keep + nbytes];
 
-         char *tmpfname = strrchr (load_fname->string, '"');
-         if (tmpfname) *tmpfname = 0;
-         tmpfname = load_fname->string[0] == '"'
-                     ? &load_fname->string[1]
-                     : load_fname->string;
+   return true;
+}
 
-         token_t **subv = token_read_file (tmpfname);
+// A token that runs into the end of the window may continue in the next
+// chunk, so it is read again once there is more in the window.
+static bool stream_token (token_stream_t *ts, builder_t *b, token_t *token)
+{
+   while (ts->source && !ts->error) {
+      source_t *src = ts->source;
 
-         token_del (load_fname);
+      if (src->buf && snext_token (&src->lex, b, token))
+         return true;
 
-         for (size_t i=0; subv && subv[i]; i++) {
-            ll_ins_tail ((void ***)&ret, subv[i]);
+      if (src->buf && !src->lex.starved) {
+         if (b->oom || !src->eof) {
+            ts->error = true;
+            return false;
          }
-         free (subv);
-         token_del (token);
+
+         source_pop (ts);
          continue;
       }
-      ll_ins_tail ((void ***)&ret, token);
+
+      if (!source_fill (src, ts->chunk)) {
+         XERROR ("Unable to read [%s]: %m\n", fname_get (src->lex.file));
+         ts->error = true;
+      }
+   }
+
+   return false;
+}
+
+static token_stream_t *stream_new (FILE *inf, int fd, const char *fname,
+                                                      size_t chunk)
+{
+   token_stream_t *ret = mem_calloc (1, sizeof *ret);
+   if (!ret)
+      return NULL;
+
+   ret->chunk = chunk ? chunk : TOKEN_STREAM_CHUNK;
+
+   if (!source_push (ret, inf, fd, fname)) {
+      token_stream_del (ret);
+      return NULL;
    }
 
    return ret;
 }
 
-void token_del (token_t *token)
+token_stream_t *token_stream_new (FILE *inf, const char *fname, size_t chunk)
 {
-   if (!token)
+   return inf ? stream_new (inf, -1, fname, chunk) : NULL;
+}
+
+token_stream_t *token_stream_new_fd (int fd, const char *fname, size_t chunk)
+{
+   return fd >= 0 ? stream_new (NULL, fd, fname, chunk) : NULL;
+}
+
+void token_stream_del (token_stream_t *ts)
+{
+   if (!ts)
       return;
 
-   free (token->string);
-   free (token->fname);
-   free (token);
+   while (ts->source)
+      source_pop (ts);
+
+   mem_free (ts->loaded);
+   mem_free (ts);
+}
+
+bool token_stream_error (const token_stream_t *ts)
+{
+   return !ts || ts->error;
+}
+
+// A form is a single token, or a list up to its closing parenthesis
+token_t **token_stream_form (token_stream_t *ts)
+{
+   builder_t b;
+   token_t token;
+   size_t depth = 0;
+
+   memset (&b, 0, sizeof b);
+
+   while (stream_token (ts, &b, &token)) {
+
+      if (is_load (&b, &token)) {
+
+         token_t load_fname;
+         if (!stream_token (ts, &b, &load_fname))
+            break;
+
+         char *name = load_name (&b, &token, &load_fname);
+         if (!name) {
+            ts->error = true;
+            break;
+         }
+
+         FILE *inf = fopen (name, "rb");
+         uint32_t file = 0;
+         loaded_t id;
+         if (inf && fname_intern (name, &file)) {
+            loaded_set (&id, file, inf, -1);
+            if (stream_loaded (ts, &id)) {
+               fclose (inf);
+               mem_free (name);
+               continue;
+            }
+         }
+
+         source_t *src = inf ? source_push (ts, inf, -1, name) : NULL;
+         if (!src) {
+            XERROR ("Unable to read [%s]: %m\n", name);
+            if (inf)
+               fclose (inf);
+         } else {
+            src->owned = true;
+         }
+
+         mem_free (name);
+         continue;
+      }
+
+      if (!builder_add (&b, &token)) {
+         ts->error = true;
+         break;
+      }
+
+      if (token.type==token_STARTL)
+         depth++;
+
+      if (token.type==token_ENDL && depth)
+         depth--;
+
+      if (!depth)
+         break;
+   }
+
+   if (!b.ntokens || ts->error) {
+      builder_clear (&b);
+      return NULL;
+   }
+
+   return builder_finish (&b);
+}
+
+size_t token_array_length (token_t **tokens)
+{
+   return tokens ? ARRAY_HDR (tokens)->ntokens : 0;
+}
+
+void token_array_del (token_t **tokens)
+{
+   if (tokens)
+      mem_free (ARRAY_HDR (tokens));
 }
 
 const char *token_string (token_t *token)
@@ -268,7 +1602,33 @@ const char *token_string (token_t *token)
 
 const char *token_fname (token_t *token)
 {
-   return token ? token->fname : NULL;
+   return token ? fname_get (token->file) : NULL;
+}
+
+size_t token_string_length (token_t *token)
+{
+   if (!token)
+      return 0;
+
+   return token->escaped ? strlen (token->string) : token->length;
+}
+
+bool token_int_value (token_t *token, int64_t *value)
+{
+   if (!token || !token->number || token->type != token_INT)
+      return false;
+
+   *value = token->ival;
+   return true;
+}
+
+bool token_float_value (token_t *token, double *value)
+{
+   if (!token || !token->number || token->type != token_FLOAT)
+      return false;
+
+   *value = token->fval;
+   return true;
 }
 
 size_t token_line (token_t *token)
@@ -281,8 +1641,17 @@ size_t token_charpos (token_t *token)
    return token ? token->charpos : 0;
 }
 
+size_t token_offset (token_t *token)
+{
+   return token ? token->offset : 0;
+}
+
+size_t token_length (token_t *token)
+{
+   return token ? token->length : 0;
+}
+
 enum token_type_t token_type (token_t *token)
 {
    return token ? token->type : 0;
 }
-
@@ -2,11 +2,16 @@
 #ifndef H_TOKEN
 #define H_TOKEN
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 
-#define MAX_TOKEN_LENGTH      (1024)
+// Streams read this much input at a time unless told otherwise
+#define TOKEN_STREAM_CHUNK    (64 * 1024)
 
 typedef struct token_t token_t;
+typedef struct token_stream_t token_stream_t;
 
 enum token_type_t {
    token_UNKNOWN = 0,
@@ -26,16 +31,72 @@ enum token_type_t {
 extern "C" {
 #endif
 
+   // The returned array is NULL-terminated. The tokens and their text
+   // live in the same block as the array, so that token_array_del()
+   // releases all of them at once.
+   //
+   // A file named by #load is read only the first time it is loaded, by
+   // that name or, where the system tells, by any other, so that cycles
+   // of loads end; files that only have the same contents are each
+   // read. The files loaded are read a round at a
+   // time, those of each round on a few threads unless mem_set_allocator()
+   // was used. The tokens of every file read are cached by its content
+   // for the life of the process, and a file is only tokenized again if
+   // it changes. token_cache_clear() frees the cache; it must not be
+   // called while another thread is reading tokens.
    token_t **token_read_file (const char *fname);
    token_t **token_read_string (char **input, const char *fname);
 
-   void token_del (token_t *token);
+   // Reads the tokens of source from offset start to offset end alone,
+   // as a part of the file fname: start must be where a token may begin,
+   // on line and at charpos, and the tokens have the positions they have
+   // in the whole source, which must end in a 0. Unless end is where the
+   // source ends, NULL is returned if a token, string or comment runs
+   // past end. #load is followed as by token_read_string().
+   token_t **token_read_part (const char *source, size_t start, size_t end,
+                              const char *fname, size_t line, size_t charpos);
 
+   size_t token_array_length (token_t **tokens);
+   void token_array_del (token_t **tokens);
+
+   void token_cache_stats (size_t *nfiles, size_t *nhits);
+   void token_cache_clear (void);
+
+   // A stream hands out the tokens of one top-level form at a time, in
+   // an array like that of token_read_file(), reading only as much of
+   // the input as it needs to. Memory use is bounded by the size of the
+   // largest form rather than of the input. token_stream_form() returns
+   // NULL at the end of the input, or on error, which is when
+   // token_stream_error() returns true. The file or descriptor is not
+   // closed by token_stream_del(). Files loaded by a stream are read as
+   // they are reached, only once each, and are not cached.
+   token_stream_t *token_stream_new (FILE *inf, const char *fname, size_t chunk);
+   token_stream_t *token_stream_new_fd (int fd, const char *fname, size_t chunk);
+   void token_stream_del (token_stream_t *ts);
+   token_t **token_stream_form (token_stream_t *ts);
+   bool token_stream_error (const token_stream_t *ts);
+
+   // Tokens may be of any length. The text of a string token keeps its
+   // quotes but not the backslashes of its escapes; token_string_length()
+   // only has to count the text of such a string.
    const char *token_string (token_t *token);
+   size_t      token_string_length (token_t *token);
    const char *token_fname (token_t *token);
+
+   // Numbers are read by the lexer, in hex after 0x and in octal after
+   // a leading 0. These return false for any token but an INT or FLOAT,
+   // and for one that is not all number, which is left to be read from
+   // its text.
+   bool token_int_value (token_t *token, int64_t *value);
+   bool token_float_value (token_t *token, double *value);
+
    size_t      token_line (token_t *token);
    size_t      token_charpos (token_t *token);
 
+   // Where the token was found in its source file, in bytes
+   size_t      token_offset (token_t *token);
+   size_t      token_length (token_t *token);
+
    enum token_type_t token_type (token_t *token);
 
 #ifdef __cplusplus